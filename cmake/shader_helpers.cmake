@@ -6,7 +6,7 @@ function(COMPILE_SPIRV_SHADER SHADER_FILE)
     set(SPIRV_OUTPUT "${SHADER_FILE}.spv")
     add_custom_command(
         OUTPUT ${SPIRV_OUTPUT}
-        COMMAND ${Vulkan_GLSLANG_VALIDATOR_EXECUTABLE} -V ${SHADER_FILE} -o ${SPIRV_OUTPUT}
+        COMMAND ${Vulkan_GLSLANG_VALIDATOR_EXECUTABLE} -V ${SHADER_DEFINES} ${SHADER_FILE} -o ${SPIRV_OUTPUT}
         DEPENDS ${SHADER_FILE})
     set(COMPILE_SPIRV_SHADER_RETURN ${SPIRV_OUTPUT} PARENT_SCOPE)
 endfunction()
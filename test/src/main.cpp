@@ -1,5 +1,24 @@
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
 #include "gtest/gtest.h"
+#include "voxel/cpu_tracer.h"
+#include "voxel/importers.h"
+#include "voxel/paged_vdb.h"
 #include "voxel/vdb.h"
+#include "voxel/versioned_vdb.h"
+#include "voxel/voxelizer.h"
 
 namespace spor::vox {
 class TestInspector {
@@ -10,6 +29,17 @@ public:
 
     const std::vector<uint8_t>& get_voxels() { return vdb_.h_voxels_; }
 
+    const DirtyRanges& get_dirty_nodes() { return vdb_.dirty_nodes_; }
+
+    const DirtyRanges& get_dirty_voxels() { return vdb_.dirty_voxels_; }
+
+    // as if the tree had just been uploaded
+    void clear_dirty() {
+        auto& vdb = const_cast<VDB&>(vdb_);
+        vdb.dirty_nodes_.clear();
+        vdb.dirty_voxels_.clear();
+    }
+
 private:
     const VDB& vdb_;
 };
@@ -17,6 +47,73 @@ private:
 
 using namespace spor;
 
+namespace {
+
+// Node counts that depend on the tree's shape too much to work out in general are only checked
+// for the default 4^3 nodes
+constexpr bool kDefaultNodeConfig = std::is_same_v<vox::VDB::config_t, vox::NodeConfig<2>>;
+
+// Height of the tree built for a volume whose longest axis has `size` voxels
+size_t expected_height(uint32_t size) {
+    size_t level = 1;
+    while (vox::detail::node_extent(level).x < size) {
+        ++level;
+    }
+    return level;
+}
+
+// Nodes at `level` it takes to cover `dims`
+size_t nodes_covering(vox::VDB::coord_t dims, size_t level) {
+    auto grid = (dims + vox::detail::node_extent(level) - 1u) / vox::detail::node_extent(level);
+    return static_cast<size_t>(grid.x) * grid.y * grid.z;
+}
+
+// Nodes of a tree over `dims` in which no node is empty or uniform
+size_t full_tree_nodes(vox::VDB::coord_t dims) {
+    size_t count = 0;
+    for (size_t level = 1; level <= expected_height(std::max({dims.x, dims.y, dims.z})); ++level) {
+        count += nodes_covering(dims, level);
+    }
+    return count;
+}
+
+// Ball of `radius` voxels around `center`, numbered by their distance from it
+auto sphere_sampler(vox::VDB::coord_t center, float radius) {
+    return [center, radius](vox::VDB::coord_t pos) -> uint8_t {
+        int dist = static_cast<int>(glm::distance(glm::vec3(center), glm::vec3(pos)));
+        return dist > radius ? 0 : dist + 1;
+    };
+}
+
+// Height field over x/z between `base` and `base + range` voxels, in a handful of values so the
+// leaves along its surface are neither empty nor uniform
+auto terrain_sampler(uint32_t base, uint32_t range) {
+    return [base, range](vox::VDB::coord_t pos) -> uint8_t {
+        return pos.y < base + (pos.x * 7 + pos.z * 3) % range ? 1 + (pos.x + pos.z) % 5 : 0;
+    };
+}
+
+// `sampler` with the box [0, max) set to 3, which builds into tiles at every level it covers
+template <typename Sampler>
+auto with_tiles(vox::VDB::coord_t max, Sampler sampler) {
+    return [max, sampler](vox::VDB::coord_t pos) -> uint8_t {
+        return glm::all(glm::lessThan(pos, max)) ? 3 : sampler(pos);
+    };
+}
+
+template <typename Work>
+double time_ms(Work&& work) {
+    auto start = std::chrono::steady_clock::now();
+    work();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+// Benchmarks print their timings instead of asserting on them
+std::ostream& bench_log() { return std::cout << "[ BENCH    ] "; }
+
+}  // namespace
+
 TEST(TestTreeBuild, Solid) {
     auto sampler = [](vox::VDB::coord_t pos) { return static_cast<uint8_t>(1); };
 
@@ -25,7 +122,12 @@ TEST(TestTreeBuild, Solid) {
         vdb.build_from(vox::VDB::coord_t(4, 4, 4), sampler);
         spor::vox::TestInspector i(vdb);
         EXPECT_EQ(i.get_nodes().size(), 1);
-        EXPECT_EQ(i.get_voxels().size(), 4 * 4 * 4);
+        EXPECT_EQ(i.get_voxels().size(), 0);
+
+        // a uniform root is a tile
+        EXPECT_TRUE(i.get_nodes().front().is_leaf);
+        EXPECT_EQ(i.get_nodes().front().child_mask, 0);
+        EXPECT_EQ(i.get_nodes().front().child_offset, 1);
 
         for (size_t z = 0; z < 4; ++z) {
             for (size_t y = 0; y < 4; ++y) {
@@ -40,11 +142,10 @@ TEST(TestTreeBuild, Solid) {
         vox::VDB vdb(nullptr);
         vdb.build_from(vox::VDB::coord_t(16, 16, 16), sampler);
         spor::vox::TestInspector i(vdb);
-        EXPECT_EQ(i.get_nodes().size(), 1 + 64);
-        EXPECT_EQ(i.get_voxels().size(), 16 * 16 * 16);
 
-        // a 2 level tree will have the root's leaves starting at 1
-        EXPECT_EQ(i.get_nodes().front().child_offset, 1);
+        // uniform leaves collapse into tiles, and then so does the root
+        EXPECT_EQ(i.get_nodes().size(), 1);
+        EXPECT_EQ(i.get_voxels().size(), 0);
 
         for (size_t z = 0; z < 16; ++z) {
             for (size_t y = 0; y < 16; ++y) {
@@ -65,7 +166,7 @@ TEST(TestTreeBuild, SolidNumbered) {
         vox::VDB vdb(nullptr);
         vdb.build_from(vox::VDB::coord_t(4, 4, 4), sampler);
         spor::vox::TestInspector i(vdb);
-        EXPECT_EQ(i.get_nodes().size(), 1);
+        EXPECT_EQ(i.get_nodes().size(), full_tree_nodes(vox::VDB::coord_t(4)));
         EXPECT_EQ(i.get_voxels().size(), 4 * 4 * 4);
 
         for (size_t z = 0; z < 4; ++z) {
@@ -84,11 +185,13 @@ TEST(TestTreeBuild, SolidNumbered) {
         vox::VDB vdb(nullptr);
         vdb.build_from(vox::VDB::coord_t(16, 16, 16), sampler);
         spor::vox::TestInspector i(vdb);
-        EXPECT_EQ(i.get_nodes().size(), 1 + 64);
+        EXPECT_EQ(i.get_nodes().size(), full_tree_nodes(vox::VDB::coord_t(16)));
         EXPECT_EQ(i.get_voxels().size(), 16 * 16 * 16);
 
-        // a 2 level tree will have the root's leaves starting at 1
-        EXPECT_EQ(i.get_nodes().front().child_offset, 1);
+        // the root's children come last, in a 2 level tree right after the root at 1
+        const auto& root = i.get_nodes().front();
+        EXPECT_EQ(root.child_offset,
+                  i.get_nodes().size() - vox::detail::popcount(root.child_mask));
 
         for (size_t z = 0; z < 16; ++z) {
             for (size_t y = 0; y < 16; ++y) {
@@ -106,14 +209,7 @@ TEST(TestTreeBuild, TestSphere) {
 
     const vox::VDB::coord_t center(kSize / 2);
 
-    auto sampler = [center, kRadius](vox::VDB::coord_t pos) -> uint8_t {
-        int dist = static_cast<int>(glm::distance(glm::vec3(center), glm::vec3(pos)));
-        if (dist > kRadius) {
-            return 0;
-        } else {
-            return dist + 1;
-        }
-    };
+    auto sampler = sphere_sampler(center, kRadius);
 
     vox::VDB vdb(nullptr);
     vdb.build_from(vox::VDB::coord_t(kSize), sampler);
@@ -151,14 +247,7 @@ TEST(TestTreeBuild, TestSphereLarge) {
 
     const vox::VDB::coord_t center(kSize / 2);
 
-    auto sampler = [center, kRadius](vox::VDB::coord_t pos) -> uint8_t {
-        int dist = static_cast<int>(glm::distance(glm::vec3(center), glm::vec3(pos)));
-        if (dist > kRadius) {
-            return 0;
-        } else {
-            return dist + 1;
-        }
-    };
+    auto sampler = sphere_sampler(center, kRadius);
 
     vox::VDB vdb(nullptr);
     vdb.build_from(vox::VDB::coord_t(kSize), sampler);
@@ -190,6 +279,2850 @@ TEST(TestTreeBuild, TestSphereLarge) {
     }
 }
 
+TEST(TestTreeBuild, ParallelDeterministic) {
+    constexpr size_t kRadius = 20.f;
+    constexpr size_t kSize = 64;
+
+    const vox::VDB::coord_t center(kSize / 2);
+
+    auto sampler = sphere_sampler(center, kRadius);
+
+    vox::VDB serial(nullptr);
+    serial.build_from(vox::VDB::coord_t(kSize), sampler);
+    spor::vox::TestInspector s(serial);
+
+    for (size_t num_threads : {2, 3, 8, 64, 100}) {
+        vox::BuildOptions options;
+        options.num_threads = num_threads;
+
+        vox::VDB parallel(nullptr);
+        parallel.build_from(vox::VDB::coord_t(kSize), sampler, options);
+        spor::vox::TestInspector p(parallel);
+
+        ASSERT_EQ(p.get_nodes().size(), s.get_nodes().size()) << num_threads;
+        EXPECT_EQ(std::memcmp(p.get_nodes().data(), s.get_nodes().data(),
+                              s.get_nodes().size() * sizeof(vox::SVNode)),
+                  0)
+            << num_threads;
+        EXPECT_EQ(p.get_voxels(), s.get_voxels()) << num_threads;
+    }
+}
+
+TEST(TestTreeBuild, ParallelScaling) {
+    constexpr size_t kRadius = 105.f;
+    constexpr size_t kSize = 256;
+
+    const vox::VDB::coord_t center(kSize / 2);
+
+    auto sampler = sphere_sampler(center, kRadius);
+
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    double serial_ms = 0.0;
+    for (size_t num_threads = 1; num_threads <= max_threads; ++num_threads) {
+        vox::BuildOptions options;
+        options.num_threads = num_threads;
+
+        vox::VDB vdb(nullptr);
+
+        double elapsed_ms
+            = time_ms([&]() { vdb.build_from(vox::VDB::coord_t(kSize), sampler, options); });
+
+        if (num_threads == 1) {
+            serial_ms = elapsed_ms;
+        }
+
+        bench_log() << "build_from " << kSize << "^3, " << num_threads << " thread(s): "
+                    << elapsed_ms << " ms (" << serial_ms / elapsed_ms << "x)" << std::endl;
+
+        EXPECT_EQ(vdb.get_voxel(center), 1);
+    }
+}
+
+TEST(TestTreeBuild, BrickSampler) {
+    constexpr size_t kRadius = 20.f;
+    constexpr size_t kSize = 64;
+
+    const vox::VDB::coord_t center(kSize / 2);
+
+    auto sampler = sphere_sampler(center, kRadius);
+
+    auto brick_sampler = [&sampler](vox::VDB::coord_t min, vox::VDB::coord_t extent, uint8_t* out) {
+        for (size_t z = 0; z < extent.z; ++z) {
+            for (size_t y = 0; y < extent.y; ++y) {
+                for (size_t x = 0; x < extent.x; ++x) {
+                    *out++ = sampler(min + vox::VDB::coord_t(x, y, z));
+                }
+            }
+        }
+    };
+
+    vox::VDB reference(nullptr);
+    reference.build_from(vox::VDB::coord_t(kSize), sampler);
+    spor::vox::TestInspector r(reference);
+
+    for (size_t brick_level : {1, 2, 3, 10}) {
+        for (size_t num_threads : {1, 4}) {
+            vox::BuildOptions options;
+            options.brick_level = brick_level;
+            options.num_threads = num_threads;
+
+            vox::VDB vdb(nullptr);
+            vdb.build_from(vox::VDB::coord_t(kSize), brick_sampler, options);
+            spor::vox::TestInspector i(vdb);
+
+            ASSERT_EQ(i.get_nodes().size(), r.get_nodes().size()) << brick_level;
+            EXPECT_EQ(std::memcmp(i.get_nodes().data(), r.get_nodes().data(),
+                                  r.get_nodes().size() * sizeof(vox::SVNode)),
+                      0)
+                << brick_level;
+            EXPECT_EQ(i.get_voxels(), r.get_voxels()) << brick_level;
+        }
+    }
+}
+
+TEST(TestTreeBuild, BrickSamplerOverhead) {
+    constexpr size_t kSize = 256;
+
+    // cheap enough that the per-call overhead dominates
+    auto sampler = [](vox::VDB::coord_t pos) -> uint8_t { return (pos.x ^ pos.y ^ pos.z) & 1; };
+
+    auto brick_sampler = [&sampler](vox::VDB::coord_t min, vox::VDB::coord_t extent, uint8_t* out) {
+        for (size_t z = 0; z < extent.z; ++z) {
+            for (size_t y = 0; y < extent.y; ++y) {
+                for (size_t x = 0; x < extent.x; ++x) {
+                    *out++ = sampler(min + vox::VDB::coord_t(x, y, z));
+                }
+            }
+        }
+    };
+
+    vox::VDB per_voxel(nullptr);
+    double per_voxel_ms
+        = time_ms([&]() { per_voxel.build_from(vox::VDB::coord_t(kSize), sampler); });
+
+    vox::VDB per_brick(nullptr);
+    double per_brick_ms
+        = time_ms([&]() { per_brick.build_from(vox::VDB::coord_t(kSize), brick_sampler); });
+
+    bench_log() << "build_from " << kSize << "^3, per-voxel sampler: " << per_voxel_ms
+                << " ms, brick sampler: " << per_brick_ms << " ms" << std::endl;
+
+    spor::vox::TestInspector a(per_voxel);
+    spor::vox::TestInspector b(per_brick);
+    EXPECT_EQ(a.get_voxels(), b.get_voxels());
+}
+
+TEST(TestTreeBuild, ClassifiedSphere) {
+    constexpr size_t kRadius = 40.f;
+    constexpr size_t kSize = 128;
+
+    const vox::VDB::coord_t center(kSize / 2);
+
+    size_t sampled = 0;
+    auto sphere = sphere_sampler(center, kRadius);
+    auto sampler = [&sphere, &sampled](vox::VDB::coord_t pos) {
+        ++sampled;
+        return sphere(pos);
+    };
+
+    vox::BuildOptions options;
+    options.classify_region = [center, kRadius](glm::uvec3 min, glm::uvec3 max) {
+        auto nearest = glm::clamp(center, min, max - 1u);
+        auto furthest = glm::mix(min, max - 1u, glm::lessThanEqual(center * 2u, min + max - 1u));
+
+        int near_dist = static_cast<int>(glm::distance(glm::vec3(center), glm::vec3(nearest)));
+        int far_dist = static_cast<int>(glm::distance(glm::vec3(center), glm::vec3(furthest)));
+
+        if (near_dist > static_cast<int>(kRadius)) {
+            return vox::Region{vox::Region::Kind::kEmpty};
+        } else if (near_dist == far_dist) {
+            return vox::Region{vox::Region::Kind::kUniform, static_cast<uint8_t>(near_dist + 1)};
+        }
+
+        return vox::Region{vox::Region::Kind::kMixed};
+    };
+
+    vox::VDB reference(nullptr);
+    reference.build_from(vox::VDB::coord_t(kSize), sampler);
+    spor::vox::TestInspector r(reference);
+    size_t full_samples = sampled;
+
+    for (size_t num_threads : {1, 4}) {
+        options.num_threads = num_threads;
+
+        sampled = 0;
+        vox::VDB vdb(nullptr);
+        vdb.build_from(vox::VDB::coord_t(kSize), sampler, options);
+        spor::vox::TestInspector i(vdb);
+
+        ASSERT_EQ(i.get_nodes().size(), r.get_nodes().size());
+        EXPECT_EQ(std::memcmp(i.get_nodes().data(), r.get_nodes().data(),
+                              r.get_nodes().size() * sizeof(vox::SVNode)),
+                  0);
+        EXPECT_EQ(i.get_voxels(), r.get_voxels());
+
+        if (num_threads == 1) {
+            // only the leaves crossing the shell of the sphere are left to sample
+            EXPECT_LT(sampled * 4, full_samples);
+        }
+    }
+}
+
+TEST(TestTreeBuild, ClassifiedUniform) {
+    auto sampler = [](vox::VDB::coord_t) -> uint8_t {
+        ADD_FAILURE() << "uniform regions should not be sampled";
+        return 0;
+    };
+
+    vox::BuildOptions options;
+    options.classify_region = [](glm::uvec3 min, glm::uvec3 max) {
+        if (max.z <= 8) {
+            return vox::Region{vox::Region::Kind::kUniform, 3};
+        } else if (min.z >= 8) {
+            return vox::Region{vox::Region::Kind::kEmpty};
+        }
+
+        return vox::Region{vox::Region::Kind::kMixed};
+    };
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(16, 16, 16), sampler, options);
+    spor::vox::TestInspector i(vdb);
+    // the root's children below z = 8 are tiles, the others are empty
+    EXPECT_EQ(i.get_nodes().size(),
+              1 + nodes_covering(vox::VDB::coord_t(16, 16, 8), vdb.height() - 1));
+    EXPECT_EQ(i.get_voxels().size(), 0);
+
+    for (size_t z = 0; z < 16; ++z) {
+        for (size_t y = 0; y < 16; ++y) {
+            for (size_t x = 0; x < 16; ++x) {
+                EXPECT_EQ(vdb.get_voxel({x, y, z}), z < 8 ? 3 : 0);
+            }
+        }
+    }
+}
+
+TEST(TestTreeBuild, Anisotropic) {
+    const vox::VDB::coord_t dims(37, 20, 5);
+
+    size_t sampled = 0;
+    auto sampler = [&dims, &sampled](vox::VDB::coord_t pos) -> uint8_t {
+        EXPECT_TRUE(pos.x < dims.x && pos.y < dims.y && pos.z < dims.z);
+        ++sampled;
+        return static_cast<uint8_t>((pos.x * 7 + pos.y * 3 + pos.z) % 5);
+    };
+
+    auto brick_sampler = [&sampler](vox::VDB::coord_t min, vox::VDB::coord_t extent, uint8_t* out) {
+        for (size_t z = 0; z < extent.z; ++z) {
+            for (size_t y = 0; y < extent.y; ++y) {
+                for (size_t x = 0; x < extent.x; ++x) {
+                    *out++ = sampler(min + vox::VDB::coord_t(x, y, z));
+                }
+            }
+        }
+    };
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(dims, sampler);
+    spor::vox::TestInspector i(vdb);
+
+    EXPECT_EQ(sampled, dims.x * dims.y * dims.z);
+    EXPECT_EQ(vdb.size(), dims);
+    EXPECT_EQ(vdb.height(), expected_height(37));
+
+    for (size_t z = 0; z < dims.z; ++z) {
+        for (size_t y = 0; y < dims.y; ++y) {
+            for (size_t x = 0; x < dims.x; ++x) {
+                EXPECT_EQ(vdb.get_voxel({x, y, z}), (x * 7 + y * 3 + z) % 5);
+            }
+        }
+    }
+
+    EXPECT_THROW(vdb.get_voxel({dims.x, 0, 0}), std::invalid_argument);
+    EXPECT_THROW(vdb.get_voxel({0, 0, dims.z}), std::invalid_argument);
+
+    for (size_t brick_level : {1, 2, 3}) {
+        vox::BuildOptions options;
+        options.brick_level = brick_level;
+
+        sampled = 0;
+        vox::VDB bricks(nullptr);
+        bricks.build_from(dims, brick_sampler, options);
+        spor::vox::TestInspector b(bricks);
+
+        EXPECT_EQ(sampled, dims.x * dims.y * dims.z) << brick_level;
+        EXPECT_EQ(b.get_voxels(), i.get_voxels()) << brick_level;
+        ASSERT_EQ(b.get_nodes().size(), i.get_nodes().size()) << brick_level;
+        EXPECT_EQ(std::memcmp(b.get_nodes().data(), i.get_nodes().data(),
+                              i.get_nodes().size() * sizeof(vox::SVNode)),
+                  0)
+            << brick_level;
+    }
+}
+
+TEST(TestTreeBuild, AnisotropicTerrain) {
+    const vox::VDB::coord_t dims(300, 300, 64);
+
+    size_t sampled = 0;
+    auto sampler = [&sampled](vox::VDB::coord_t pos) -> uint8_t {
+        ++sampled;
+        return pos.z < 20 + (pos.x + pos.y) % 7 ? 1 : 0;
+    };
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(dims, sampler);
+
+    EXPECT_EQ(sampled, dims.x * dims.y * dims.z);
+    EXPECT_EQ(vdb.size(), dims);
+
+    EXPECT_EQ(vdb.get_voxel({299, 299, 0}), 1);
+    EXPECT_EQ(vdb.get_voxel({299, 299, 63}), 0);
+    EXPECT_THROW(vdb.get_voxel({300, 0, 0}), std::invalid_argument);
+    EXPECT_THROW(vdb.get_voxel({0, 0, 64}), std::invalid_argument);
+}
+
+TEST(TestTreeBuild, DenseMatchesSampler) {
+    const vox::VDB::coord_t dims(37, 20, 50);
+
+    auto value = [](size_t x, size_t y, size_t z) -> uint8_t {
+        return static_cast<uint8_t>((x * 7 + y * 3 + z) % 5 * (z % 9 < 4));
+    };
+
+    std::vector<uint8_t> dense(dims.x * dims.y * dims.z);
+    for (size_t z = 0; z < dims.z; ++z) {
+        for (size_t y = 0; y < dims.y; ++y) {
+            for (size_t x = 0; x < dims.x; ++x) {
+                dense[x + (y + z * dims.y) * dims.x] = value(x, y, z);
+            }
+        }
+    }
+
+    vox::VDB sampled(nullptr);
+    sampled.build_from(dims, [&](vox::VDB::coord_t pos) { return value(pos.x, pos.y, pos.z); });
+    spor::vox::TestInspector s(sampled);
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from_dense(dense.data(), dims);
+    spor::vox::TestInspector i(vdb);
+
+    // same nodes and voxels, only laid out in a different order
+    EXPECT_EQ(vdb.height(), sampled.height());
+    EXPECT_EQ(vdb.size(), dims);
+    EXPECT_EQ(i.get_nodes().size(), s.get_nodes().size());
+    EXPECT_EQ(i.get_voxels().size(), s.get_voxels().size());
+
+    for (size_t z = 0; z < dims.z; ++z) {
+        for (size_t y = 0; y < dims.y; ++y) {
+            for (size_t x = 0; x < dims.x; ++x) {
+                EXPECT_EQ(vdb.get_voxel({x, y, z}), value(x, y, z)) << x << " " << y << " " << z;
+            }
+        }
+    }
+
+    // z-major layout through strides
+    std::vector<uint8_t> transposed(dense.size());
+    for (size_t z = 0; z < dims.z; ++z) {
+        for (size_t y = 0; y < dims.y; ++y) {
+            for (size_t x = 0; x < dims.x; ++x) {
+                transposed[z + (y + x * dims.y) * dims.z] = value(x, y, z);
+            }
+        }
+    }
+
+    vox::VDB strided(nullptr);
+    strided.build_from_dense(transposed.data(), dims,
+                             glm::u64vec3(dims.y * dims.z, dims.z, 1));
+    spor::vox::TestInspector t(strided);
+    EXPECT_EQ(t.get_voxels(), i.get_voxels());
+
+    // streamed slabs produce the same layout as the whole array
+    uint32_t next_z = 0;
+    vox::VDB streamed(nullptr);
+    streamed.build_from_dense(dims, [&](uint32_t z, uint32_t depth, uint8_t* out) {
+        EXPECT_EQ(z, next_z);
+        EXPECT_LE(z + depth, dims.z);
+        next_z = z + depth;
+        std::memcpy(out, dense.data() + z * dims.x * dims.y, depth * dims.x * dims.y);
+    });
+    EXPECT_EQ(next_z, dims.z);
+
+    spor::vox::TestInspector st(streamed);
+    EXPECT_EQ(st.get_voxels(), i.get_voxels());
+    ASSERT_EQ(st.get_nodes().size(), i.get_nodes().size());
+    EXPECT_EQ(std::memcmp(st.get_nodes().data(), i.get_nodes().data(),
+                          i.get_nodes().size() * sizeof(vox::SVNode)),
+              0);
+}
+
+TEST(TestTreeBuild, DenseSmall) {
+    if (vox::detail::node_extent(1).x < 4) {
+        GTEST_SKIP() << "needs leaves of at least 4^3 voxels";
+    }
+
+    // a single leaf is its own root
+    std::vector<uint8_t> dense(3 * 2 * 4, 0);
+    dense[1] = 5;
+    dense[3 * 2 * 4 - 1] = 9;
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from_dense(dense.data(), vox::VDB::coord_t(3, 2, 4));
+    spor::vox::TestInspector i(vdb);
+
+    EXPECT_EQ(vdb.height(), 1);
+    EXPECT_EQ(i.get_nodes().size(), 1);
+    EXPECT_EQ(i.get_voxels(), std::vector<uint8_t>({5, 9}));
+    EXPECT_EQ(vdb.get_voxel({1, 0, 0}), 5);
+    EXPECT_EQ(vdb.get_voxel({2, 1, 3}), 9);
+    EXPECT_EQ(vdb.get_voxel({0, 0, 0}), 0);
+}
+
+TEST(TestTreeBuild, DenseOverhead) {
+    constexpr size_t kSize = 256;
+
+    auto sampler = [](vox::VDB::coord_t pos) -> uint8_t { return (pos.x ^ pos.y ^ pos.z) & 1; };
+
+    std::vector<uint8_t> dense(kSize * kSize * kSize);
+    for (size_t i = 0; i < dense.size(); ++i) {
+        dense[i] = sampler(vox::VDB::coord_t(i % kSize, (i / kSize) % kSize, i / (kSize * kSize)));
+    }
+
+    vox::VDB per_voxel(nullptr);
+    double per_voxel_ms
+        = time_ms([&]() { per_voxel.build_from(vox::VDB::coord_t(kSize), sampler); });
+
+    vox::VDB from_dense(nullptr);
+    double dense_ms
+        = time_ms([&]() { from_dense.build_from_dense(dense.data(), vox::VDB::coord_t(kSize)); });
+
+    bench_log() << kSize << "^3, build_from: " << per_voxel_ms
+                << " ms, build_from_dense: " << dense_ms << " ms" << std::endl;
+
+    spor::vox::TestInspector a(per_voxel);
+    spor::vox::TestInspector b(from_dense);
+    EXPECT_EQ(a.get_nodes().size(), b.get_nodes().size());
+    EXPECT_EQ(a.get_voxels().size(), b.get_voxels().size());
+}
+
+TEST(TestTreeBuild, PointsMatchSampler) {
+    const vox::VDB::coord_t dims(70, 33, 129);
+
+    // scattered points with plenty of duplicates, some of which reduce to empty voxels
+    std::vector<vox::VoxelPoint> points;
+    uint32_t state = 12345;
+    auto next = [&state]() { return state = state * 1664525u + 1013904223u; };
+    for (size_t i = 0; i < 20000; ++i) {
+        vox::VDB::coord_t pos((next() >> 8) % dims.x, (next() >> 8) % dims.y,
+                              (next() >> 8) % dims.z);
+        pos.z &= ~7u;  // crowd them into fewer voxels
+        points.push_back({pos, static_cast<uint8_t>((next() >> 8) % 4)});
+    }
+
+    for (auto reduction : {vox::PointReduction::kLastWins, vox::PointReduction::kMax}) {
+        std::unordered_map<vox::VDB::coord_t, uint8_t> expected;
+        for (const auto& point : points) {
+            auto [it, inserted] = expected.emplace(point.pos, point.value);
+            if (!inserted) {
+                it->second = reduction == vox::PointReduction::kMax
+                                 ? std::max(it->second, point.value)
+                                 : point.value;
+            }
+        }
+
+        auto sampler = [&expected](vox::VDB::coord_t pos) -> uint8_t {
+            auto it = expected.find(pos);
+            return it == expected.end() ? 0 : it->second;
+        };
+
+        vox::VDB sampled(nullptr);
+        sampled.build_from(dims, sampler);
+        spor::vox::TestInspector s(sampled);
+
+        for (size_t num_threads : {1, 4}) {
+            vox::BuildOptions options;
+            options.num_threads = num_threads;
+            options.duplicates = reduction;
+
+            vox::VDB vdb(nullptr);
+            vdb.build_from_points(dims, points, options);
+            spor::vox::TestInspector i(vdb);
+
+            EXPECT_EQ(i.get_voxels(), s.get_voxels());
+            ASSERT_EQ(i.get_nodes().size(), s.get_nodes().size());
+            EXPECT_EQ(std::memcmp(i.get_nodes().data(), s.get_nodes().data(),
+                                  s.get_nodes().size() * sizeof(vox::SVNode)),
+                      0);
+        }
+    }
+}
+
+TEST(TestTreeBuild, PointsEdgeCases) {
+    const vox::VDB::coord_t dims(16);
+
+    {
+        vox::VDB vdb(nullptr);
+        vdb.build_from_points(dims, {});
+        spor::vox::TestInspector i(vdb);
+
+        EXPECT_EQ(i.get_nodes().size(), 1);
+        EXPECT_EQ(i.get_nodes().front().child_mask, 0);
+        EXPECT_EQ(vdb.get_voxel({3, 4, 5}), 0);
+    }
+
+    {
+        vox::VDB vdb(nullptr);
+        vdb.build_from_points(dims, {{{15, 15, 15}, 2}, {{0, 0, 0}, 1}, {{15, 15, 15}, 0}});
+        EXPECT_EQ(vdb.get_voxel({0, 0, 0}), 1);
+        EXPECT_EQ(vdb.get_voxel({15, 15, 15}), 0);  // last wins, even when it is empty
+    }
+
+    {
+        // rejected calls leave the tree as it was
+        vox::VDB vdb(nullptr);
+        vdb.build_from_points(dims, {{{3, 4, 5}, 7}});
+        EXPECT_THROW(vdb.build_from_points(dims, {{{16, 0, 0}, 1}}), std::invalid_argument);
+        EXPECT_THROW(vdb.build_from_points(vox::VDB::coord_t(1u << 31), {}),
+                     std::invalid_argument);
+        EXPECT_EQ(vdb.size(), dims);
+        EXPECT_EQ(vdb.get_voxel({3, 4, 5}), 7);
+    }
+}
+
+TEST(TestTreeBuild, PointsScaling) {
+    constexpr uint32_t kSize = 2048;
+    constexpr size_t kPoints = 4'000'000;
+
+    std::vector<vox::VoxelPoint> points(kPoints);
+    uint32_t state = 1;
+    auto next = [&state]() { return state = state * 1664525u + 1013904223u; };
+    for (auto& point : points) {
+        point = {vox::VDB::coord_t(next() % kSize, next() % kSize, next() % kSize), 1};
+    }
+
+    vox::BuildOptions serial;
+    vox::VDB a(nullptr);
+    double serial_ms
+        = time_ms([&]() { a.build_from_points(vox::VDB::coord_t(kSize), points, serial); });
+
+    vox::BuildOptions parallel;
+    parallel.num_threads = 0;
+    vox::VDB b(nullptr);
+    double parallel_ms
+        = time_ms([&]() { b.build_from_points(vox::VDB::coord_t(kSize), points, parallel); });
+
+    bench_log() << "build_from_points " << kPoints << " points in " << kSize
+                << "^3, 1 thread: " << serial_ms << " ms, " << std::thread::hardware_concurrency()
+                << " threads: " << parallel_ms << " ms" << std::endl;
+
+    spor::vox::TestInspector i(a);
+    spor::vox::TestInspector j(b);
+    EXPECT_EQ(i.get_voxels(), j.get_voxels());
+    EXPECT_EQ(i.get_nodes().size(), j.get_nodes().size());
+}
+
+TEST(TestTreeBuild, Tiles) {
+    const vox::VDB::coord_t dims(128, 128, 96);
+
+    // solid ground with a layer of mixed voxels on top
+    auto sampler = [](vox::VDB::coord_t pos) -> uint8_t {
+        if (pos.z < 40) {
+            return pos.z < 32 ? 2 : 1;
+        }
+        return pos.z < 42 && (pos.x + pos.y) % 3 == 0 ? 3 : 0;
+    };
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(dims, sampler);
+    spor::vox::TestInspector i(vdb);
+
+    // only the leaves of the mixed layer hold voxels, the ground is covered by a few tiles instead
+    // of the leaves it would take otherwise
+    size_t mixed = 0;
+    for (size_t y = 0; y < dims.y; ++y) {
+        for (size_t x = 0; x < dims.x; ++x) {
+            mixed += 2 * ((x + y) % 3 == 0);
+        }
+    }
+    EXPECT_EQ(i.get_voxels().size(), mixed);
+    EXPECT_LT(i.get_nodes().size(), nodes_covering(vox::VDB::coord_t(dims.x, dims.y, 1), 1) * 4);
+
+    for (size_t z = 0; z < dims.z; ++z) {
+        for (size_t y = 0; y < dims.y; y += 7) {
+            for (size_t x = 0; x < dims.x; x += 3) {
+                ASSERT_EQ(vdb.get_voxel({x, y, z}), sampler({x, y, z}))
+                    << x << " " << y << " " << z;
+            }
+        }
+    }
+
+    auto expect_same_layout = [&i](const vox::VDB& other, const char* name) {
+        spor::vox::TestInspector o(other);
+        EXPECT_EQ(o.get_voxels(), i.get_voxels()) << name;
+        ASSERT_EQ(o.get_nodes().size(), i.get_nodes().size()) << name;
+        EXPECT_EQ(std::memcmp(o.get_nodes().data(), i.get_nodes().data(),
+                              i.get_nodes().size() * sizeof(vox::SVNode)),
+                  0)
+            << name;
+    };
+
+    vox::BuildOptions parallel;
+    parallel.num_threads = 4;
+    vox::VDB threaded(nullptr);
+    threaded.build_from(dims, sampler, parallel);
+    expect_same_layout(threaded, "parallel");
+
+    std::vector<vox::VoxelPoint> points;
+    std::vector<uint8_t> dense(dims.x * dims.y * dims.z);
+    for (size_t z = 0; z < dims.z; ++z) {
+        for (size_t y = 0; y < dims.y; ++y) {
+            for (size_t x = 0; x < dims.x; ++x) {
+                auto value = sampler({x, y, z});
+                dense[x + (y + z * dims.y) * dims.x] = value;
+                if (value != 0) {
+                    points.push_back({{x, y, z}, value});
+                }
+            }
+        }
+    }
+
+    vox::VDB from_points(nullptr);
+    from_points.build_from_points(dims, points);
+    expect_same_layout(from_points, "points");
+
+    // the dense build emits the same nodes in another order
+    vox::VDB from_dense(nullptr);
+    from_dense.build_from_dense(dense.data(), dims);
+    spor::vox::TestInspector d(from_dense);
+    EXPECT_EQ(d.get_nodes().size(), i.get_nodes().size());
+    EXPECT_EQ(d.get_voxels().size(), i.get_voxels().size());
+
+    // classified uniform regions become tiles without being generated
+    vox::BuildOptions classified;
+    classified.classify_region = [](glm::uvec3, glm::uvec3 max) {
+        if (max.z <= 32) {
+            return vox::Region{vox::Region::Kind::kUniform, 2};
+        }
+        return vox::Region{vox::Region::Kind::kMixed};
+    };
+    vox::VDB from_classified(nullptr);
+    from_classified.build_from(dims, sampler, classified);
+    expect_same_layout(from_classified, "classified");
+}
+
+TEST(TestTreeBuild, Deduplicate) {
+    {
+        vox::VDB vdb(nullptr);
+        vdb.build_from(vox::VDB::coord_t(64), [](vox::VDB::coord_t pos) -> uint8_t {
+            return pos.x % 4 == 0 ? 1 : 0;
+        });
+        vdb.deduplicate();
+        spor::vox::TestInspector i(vdb);
+
+        // one leaf array shared by every level 2 node, and the root's array of those
+        if (kDefaultNodeConfig) {
+            EXPECT_EQ(i.get_nodes().size(), 1 + 64 + 64);
+            EXPECT_EQ(i.get_voxels().size(), 16);
+        }
+        EXPECT_EQ(vdb.get_voxel({60, 0, 17}), 1);
+        EXPECT_EQ(vdb.get_voxel({63, 0, 17}), 0);
+    }
+
+    // terrain repeating every 16 voxels
+    const vox::VDB::coord_t dims(256, 256, 64);
+    auto sampler = [](vox::VDB::coord_t pos) -> uint8_t {
+        auto height = 20 + (pos.x % 16 + pos.y % 16) / 4;
+        return pos.z < height ? static_cast<uint8_t>(1 + pos.z / 8) : 0;
+    };
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(dims, sampler);
+    spor::vox::TestInspector i(vdb);
+    auto tree_nodes = i.get_nodes().size();
+    auto tree_voxels = i.get_voxels().size();
+
+    vdb.deduplicate();
+    auto dag_nodes = i.get_nodes().size();
+    auto dag_voxels = i.get_voxels().size();
+
+    bench_log() << "deduplicate " << dims.x << "x" << dims.y << "x" << dims.z
+                << " terrain: " << tree_nodes << " -> " << dag_nodes << " nodes, " << tree_voxels
+                << " -> " << dag_voxels << " voxels" << std::endl;
+
+    EXPECT_LT(dag_nodes * 10, tree_nodes);
+    EXPECT_LT(dag_voxels * 10, tree_voxels);
+
+    for (size_t z = 0; z < dims.z; ++z) {
+        for (size_t y = 0; y < dims.y; y += 3) {
+            for (size_t x = 0; x < dims.x; x += 5) {
+                ASSERT_EQ(vdb.get_voxel({x, y, z}), sampler({x, y, z}))
+                    << x << " " << y << " " << z;
+            }
+        }
+    }
+
+    // already shared, nothing left to merge
+    auto nodes = i.get_nodes();
+    auto voxels = i.get_voxels();
+    vdb.deduplicate();
+    EXPECT_EQ(i.get_voxels(), voxels);
+    ASSERT_EQ(i.get_nodes().size(), nodes.size());
+    EXPECT_EQ(std::memcmp(i.get_nodes().data(), nodes.data(), nodes.size() * sizeof(vox::SVNode)),
+              0);
+}
+
+TEST(TestLeafEncoding, PaletteRoundTrip) {
+    // 1, 2, 3, 5, 16 and 17 distinct values, the last one falls back to plain bytes
+    for (size_t distinct : {1, 2, 3, 5, 16, 17}) {
+        for (size_t count : {1, 7, 64}) {
+            std::vector<uint8_t> voxels(count);
+            for (size_t i = 0; i < count; ++i) {
+                voxels[i] = static_cast<uint8_t>(1 + (i * 5) % distinct);
+            }
+
+            std::vector<uint8_t> encoded{42};  // leaves do not start at 0
+            vox::palette::encode_leaf(voxels.data(), count, encoded);
+            const uint8_t* leaf = encoded.data() + 1;
+
+            EXPECT_EQ(vox::palette::leaf_size(leaf, count), encoded.size() - 1);
+            EXPECT_LE(encoded.size() - 1, count + 1);
+            for (size_t i = 0; i < count; ++i) {
+                EXPECT_EQ(vox::palette::decode_leaf(leaf, i), voxels[i])
+                    << distinct << " " << count << " " << i;
+            }
+        }
+    }
+}
+
+TEST(TestTreeBuild, PaletteEncoding) {
+    const vox::VDB::coord_t dims(128, 128, 64);
+
+    // terrain layers of a few materials
+    auto sampler = [](vox::VDB::coord_t pos) -> uint8_t {
+        auto height = 30 + (pos.x * 3 + pos.y * 5) % 11;
+        if (pos.z >= height) {
+            return 0;
+        }
+        return static_cast<uint8_t>(1 + (pos.z + (pos.x ^ pos.y) % 3) / 9);
+    };
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(dims, sampler);
+    spor::vox::TestInspector i(vdb);
+    auto bytes = i.get_voxels();
+
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+    EXPECT_EQ(vdb.voxel_encoding(), vox::VoxelEncoding::kPalette);
+
+    bench_log() << "palette encoding: " << bytes.size() << " -> "
+                << i.get_voxels().size() << " voxel bytes" << std::endl;
+    // leaves of 2^3 voxels have little to share a palette among
+    EXPECT_LT(i.get_voxels().size() * (vox::detail::kLeafVoxels == 64 ? 2 : 1), bytes.size());
+
+    auto check = [&]() {
+        for (size_t z = 0; z < dims.z; ++z) {
+            for (size_t y = 0; y < dims.y; y += 3) {
+                for (size_t x = 0; x < dims.x; ++x) {
+                    ASSERT_EQ(vdb.get_voxel({x, y, z}), sampler({x, y, z}))
+                        << x << " " << y << " " << z;
+                }
+            }
+        }
+    };
+    check();
+
+    // encodings are aware of shared runs
+    vdb.deduplicate();
+    check();
+
+    vdb.encode_voxels(vox::VoxelEncoding::kBytes);
+    check();
+
+    // a rebuild starts over with plain bytes
+    vdb.build_from(dims, sampler);
+    EXPECT_EQ(vdb.voxel_encoding(), vox::VoxelEncoding::kBytes);
+    EXPECT_EQ(i.get_voxels(), bytes);
+}
+
+TEST(TestTreeEdit, SetVoxel) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(16), [](vox::VDB::coord_t pos) -> uint8_t {
+        return pos.z < 4 ? 1 + pos.x % 2 : 0;
+    });
+    spor::vox::TestInspector i(vdb);
+    auto nodes = i.get_nodes().size();
+    auto voxels = i.get_voxels().size();
+
+    // a new value of an active voxel is written in place
+    auto result = vdb.set_voxel({3, 2, 1}, 7);
+    EXPECT_EQ(vdb.get_voxel({3, 2, 1}), 7);
+    EXPECT_TRUE(result.nodes.empty());
+    ASSERT_EQ(result.voxels.size(), 1);
+    EXPECT_EQ(result.voxels[0].end - result.voxels[0].begin, 1);
+    EXPECT_EQ(i.get_voxels().size(), voxels);
+
+    // erasing shrinks the leaf's run in place
+    result = vdb.set_voxel({3, 2, 1}, 0);
+    EXPECT_EQ(vdb.get_voxel({3, 2, 1}), 0);
+    EXPECT_EQ(vdb.get_voxel({2, 2, 1}), 1);
+    EXPECT_EQ(vdb.get_voxel({3, 3, 1}), 2);
+    EXPECT_EQ(result.nodes.size(), 1);
+    EXPECT_EQ(i.get_voxels().size(), voxels);
+
+    // a new leaf needs a new array for its parent
+    auto root_mask = i.get_nodes()[0].child_mask;
+    result = vdb.set_voxel({9, 9, 9}, 5);
+    EXPECT_EQ(vdb.get_voxel({9, 9, 9}), 5);
+    if (kDefaultNodeConfig) {
+        EXPECT_EQ(i.get_nodes().size(), nodes + 17);  // the root's 16 leaves and the new one
+    }
+    ASSERT_EQ(result.nodes.size(), 2);
+    EXPECT_EQ(result.nodes[0].begin, 0);  // the root
+    EXPECT_EQ(result.nodes[1].end, i.get_nodes().size());
+
+    // and removing it again drops it from that array
+    vdb.set_voxel({9, 9, 9}, 0);
+    EXPECT_EQ(vdb.get_voxel({9, 9, 9}), 0);
+    EXPECT_EQ(i.get_nodes()[0].child_mask, root_mask);
+
+    EXPECT_THROW(vdb.set_voxel({16, 0, 0}, 1), std::invalid_argument);
+}
+
+TEST(TestTreeEdit, MatchesReference) {
+    const vox::VDB::coord_t dims(70, 64, 45);
+
+    std::vector<uint8_t> reference(dims.x * dims.y * dims.z);
+    auto at = [&](size_t x, size_t y, size_t z) -> uint8_t& {
+        return reference[x + (y + z * dims.y) * dims.x];
+    };
+
+    for (size_t z = 0; z < dims.z; ++z) {
+        for (size_t y = 0; y < dims.y; ++y) {
+            for (size_t x = 0; x < dims.x; ++x) {
+                at(x, y, z) = z < 10 + (x + y) % 5 ? 1 + z / 8 : 0;
+            }
+        }
+    }
+
+    uint32_t state = 7;
+    auto next = [&state]() { return (state = state * 1664525u + 1013904223u) >> 8; };
+
+    for (int variant = 0; variant < 3; ++variant) {
+        auto expected = reference;
+        auto at_expected = [&](size_t x, size_t y, size_t z) -> uint8_t& {
+            return expected[x + (y + z * dims.y) * dims.x];
+        };
+
+        vox::VDB vdb(nullptr);
+        vdb.build_from_dense(expected.data(), dims);
+        if (variant == 1) {
+            vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+        } else if (variant == 2) {
+            vdb.deduplicate();
+        }
+
+        for (int step = 0; step < 40; ++step) {
+            uint8_t value = next() % 4;
+            switch (step % 4) {
+                case 0: {
+                    vox::VDB::coord_t pos(next() % dims.x, next() % dims.y, next() % dims.z);
+                    vdb.set_voxel(pos, value);
+                    at_expected(pos.x, pos.y, pos.z) = value;
+                    break;
+                }
+                case 1: {
+                    vox::VDB::coord_t min(next() % dims.x, next() % dims.y, next() % dims.z);
+                    auto max = min + vox::VDB::coord_t(next() % 40, next() % 40, next() % 40);
+                    vdb.fill_box(min, max, value);
+                    for (size_t z = min.z; z < std::min(max.z, dims.z); ++z) {
+                        for (size_t y = min.y; y < std::min(max.y, dims.y); ++y) {
+                            for (size_t x = min.x; x < std::min(max.x, dims.x); ++x) {
+                                at_expected(x, y, z) = value;
+                            }
+                        }
+                    }
+                    break;
+                }
+                case 2: {
+                    glm::vec3 center(next() % dims.x, next() % dims.y, next() % dims.z);
+                    float radius = (next() % 200) / 10.f;
+                    vdb.fill_sphere(center, radius, value);
+                    for (size_t z = 0; z < dims.z; ++z) {
+                        for (size_t y = 0; y < dims.y; ++y) {
+                            for (size_t x = 0; x < dims.x; ++x) {
+                                auto d = glm::vec3(x, y, z) - center;
+                                if (glm::dot(d, d) <= radius * radius) {
+                                    at_expected(x, y, z) = value;
+                                }
+                            }
+                        }
+                    }
+                    break;
+                }
+                case 3: {
+                    std::vector<vox::VoxelPoint> edits;
+                    for (int e = 0; e < 300; ++e) {
+                        vox::VDB::coord_t pos(next() % dims.x, next() % 8, next() % dims.z);
+                        edits.push_back({pos, static_cast<uint8_t>(next() % 3)});
+                        at_expected(pos.x, pos.y, pos.z) = edits.back().value;
+                    }
+                    vdb.apply_edits(edits);
+                    break;
+                }
+            }
+
+            for (size_t z = 0; z < dims.z; ++z) {
+                for (size_t y = 0; y < dims.y; ++y) {
+                    for (size_t x = 0; x < dims.x; ++x) {
+                        ASSERT_EQ(vdb.get_voxel({x, y, z}), at_expected(x, y, z))
+                            << variant << " " << step << ": " << x << " " << y << " " << z;
+                    }
+                }
+            }
+        }
+
+        // the edited tree is as compact as a fresh build, apart from the unreferenced arrays
+        vox::VDB rebuilt(nullptr);
+        rebuilt.build_from_dense(expected.data(), dims);
+        spor::vox::TestInspector a(vdb);
+        spor::vox::TestInspector b(rebuilt);
+        if (variant == 0) {
+            vdb.deduplicate();
+            rebuilt.deduplicate();
+            EXPECT_EQ(a.get_nodes().size(), b.get_nodes().size());
+            EXPECT_EQ(a.get_voxels().size(), b.get_voxels().size());
+        }
+    }
+}
+
+TEST(TestTreeEdit, FillCollapsesToTiles) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(64), [](vox::VDB::coord_t pos) -> uint8_t {
+        return (pos.x ^ pos.y ^ pos.z) & 1;
+    });
+
+    vdb.fill_box(vox::VDB::coord_t(0), vox::VDB::coord_t(64), 3);
+    spor::vox::TestInspector i(vdb);
+    EXPECT_TRUE(vox::detail::is_tile(i.get_nodes()[0]));
+    EXPECT_EQ(vdb.get_voxel({12, 40, 63}), 3);
+
+    // carving out of a tile only splits the nodes on the way: the root and at most the 8 level 2
+    // nodes the sphere touches get new arrays
+    auto nodes = i.get_nodes().size();
+    auto result = vdb.fill_sphere(glm::vec3(20.f), 5.f, 0);
+    EXPECT_EQ(vdb.get_voxel({20, 20, 20}), 0);
+    EXPECT_EQ(vdb.get_voxel({20, 20, 26}), 3);
+    EXPECT_LE(i.get_nodes().size() - nodes, 64 + 8 * 64);
+    ASSERT_FALSE(result.nodes.empty());
+    EXPECT_EQ(result.nodes.back().end, i.get_nodes().size());
+}
+
+TEST(TestTreeEdit, BrushVersusRebuild) {
+    constexpr uint32_t kSize = 256;
+    auto sampler
+        = [](vox::VDB::coord_t pos) -> uint8_t { return pos.z < 100 + pos.x % 13 ? 1 : 0; };
+
+    vox::VDB vdb(nullptr);
+    double rebuild_ms = time_ms([&]() { vdb.build_from(vox::VDB::coord_t(kSize), sampler); });
+
+    constexpr int kStrokes = 100;
+    double stroke_ms = time_ms([&]() {
+        for (int i = 0; i < kStrokes; ++i) {
+            vdb.fill_sphere(glm::vec3(20 + i * 2, 128, 100), 6.f, i % 2 ? 2 : 0);
+        }
+    });
+
+    bench_log() << kSize << "^3 rebuild: " << rebuild_ms
+                << " ms, sphere stroke: " << stroke_ms / kStrokes << " ms" << std::endl;
+
+    EXPECT_EQ(vdb.get_voxel({218, 128, 100}), 2);
+}
+
+TEST(TestDeviceSync, DirtyRanges) {
+    vox::DirtyRanges dirty;
+    EXPECT_TRUE(dirty.empty());
+
+    dirty.add({10, 12});
+    dirty.add({0, 4});
+    dirty.add({4, 6});
+    dirty.add({7, 7});
+    dirty.add({11, 20});
+
+    auto merged = dirty.merged(18);
+    ASSERT_EQ(merged.size(), 2);
+    EXPECT_EQ(merged[0].begin, 0);
+    EXPECT_EQ(merged[0].end, 6);
+    EXPECT_EQ(merged[1].begin, 10);
+    EXPECT_EQ(merged[1].end, 18);
+
+    // ranges close enough are uploaded together
+    EXPECT_EQ(dirty.merged(18, 4).size(), 1);
+
+    dirty.mark_all();
+    dirty.add({3, 5});
+    merged = dirty.merged(30);
+    ASSERT_EQ(merged.size(), 1);
+    EXPECT_EQ(merged[0].end, 30);
+
+    dirty.clear();
+    EXPECT_TRUE(dirty.empty());
+    EXPECT_TRUE(dirty.merged(30).empty());
+}
+
+TEST(TestDeviceSync, EditsMarkDirty) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(64), [](vox::VDB::coord_t pos) -> uint8_t {
+        return pos.y < 20 ? 1 + pos.x % 3 : 0;
+    });
+    spor::vox::TestInspector i(vdb);
+
+    // a build has to be uploaded in full
+    EXPECT_TRUE(i.get_dirty_nodes().all());
+    EXPECT_TRUE(i.get_dirty_voxels().all());
+
+    // edits on top of it do not change that
+    vdb.set_voxel({1, 1, 1}, 9);
+    EXPECT_TRUE(i.get_dirty_voxels().all());
+
+    i.clear_dirty();
+
+    // once clean, only what the edits wrote is dirty
+    auto first = vdb.set_voxel({1, 1, 1}, 4);
+    auto second = vdb.fill_sphere({40, 18, 40}, 5.f, 7);
+    EXPECT_FALSE(i.get_dirty_voxels().empty());
+
+    auto expected = second.voxels;
+    expected.insert(expected.end(), first.voxels.begin(), first.voxels.end());
+    vox::merge_ranges(expected);
+
+    auto voxels = i.get_dirty_voxels().merged(i.get_voxels().size());
+    ASSERT_EQ(voxels.size(), expected.size());
+    for (size_t r = 0; r < voxels.size(); ++r) {
+        EXPECT_EQ(voxels[r].begin, expected[r].begin);
+        EXPECT_EQ(voxels[r].end, expected[r].end);
+    }
+
+    auto nodes = i.get_dirty_nodes().merged(i.get_nodes().size());
+    ASSERT_EQ(nodes.size(), second.nodes.size());
+    EXPECT_EQ(nodes.back().end, i.get_nodes().size());
+
+    // re-encoding rewrites every array
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+    EXPECT_TRUE(i.get_dirty_nodes().all());
+    EXPECT_TRUE(i.get_dirty_voxels().all());
+}
+
+TEST(TestVersionedVDB, SnapshotIsolation) {
+    vox::VDB tree(nullptr);
+    tree.build_from(vox::VDB::coord_t(64), [](vox::VDB::coord_t pos) -> uint8_t {
+        return pos.y < 10 + pos.x % 7 ? 1 + pos.z % 3 : 0;
+    });
+
+    // every write sets these far apart voxels to the same value, so a reader must never see them
+    // disagree
+    const vox::VDB::coord_t probes[] = {{1, 2, 3}, {50, 50, 50}, {60, 5, 60}};
+    auto value_of = [](uint64_t version) { return static_cast<uint8_t>(version % 250 + 1); };
+    for (auto pos : probes) {
+        tree.set_voxel(pos, value_of(0));
+    }
+    vox::VersionedVDB vdb(std::move(tree), 8);
+
+    constexpr uint64_t kWrites = 300;
+    std::atomic<bool> done{false};
+    std::atomic<size_t> failures{0};
+
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < 3; ++r) {
+        readers.emplace_back([&, r]() {
+            while (!done) {
+                auto snapshot = vdb.read();
+                for (int pass = 0; pass < 2; ++pass) {
+                    for (auto pos : probes) {
+                        failures += snapshot->get_voxel(pos) != value_of(snapshot->version());
+                    }
+                    // a pinned version does not change, however long it is held
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    for (uint64_t i = 1; i <= kWrites; ++i) {
+        auto version = vdb.write([&](vox::VDB& tree) {
+            for (auto pos : probes) {
+                tree.set_voxel(pos, value_of(i));
+            }
+            tree.fill_sphere({32.f, 8.f, 32.f}, 3.f + i % 5, value_of(i));
+        });
+        EXPECT_EQ(version, i);
+    }
+
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(failures, 0);
+
+    // old versions live exactly as long as a reader pins them
+    {
+        auto pinned = vdb.read();
+        vdb.write([](vox::VDB& tree) { tree.set_voxel({0, 0, 0}, 9); });
+        vdb.write([](vox::VDB& tree) { tree.set_voxel({0, 0, 0}, 8); });
+        EXPECT_EQ(vdb.retained_versions(), 2);
+        EXPECT_EQ(pinned->version(), kWrites);
+        EXPECT_NE(pinned->get_voxel({0, 0, 0}), 8);
+        EXPECT_EQ(vdb.read()->get_voxel({0, 0, 0}), 8);
+    }
+    vdb.write([](vox::VDB& tree) { tree.deduplicate(); });
+    EXPECT_EQ(vdb.retained_versions(), 1);
+
+    auto snapshot = vdb.read();
+    EXPECT_EQ(snapshot->get_voxel({0, 0, 0}), 8);
+    EXPECT_EQ(snapshot->get_voxel({60, 5, 60}), value_of(kWrites));
+    EXPECT_EQ(snapshot->get_voxel({6, 0, 1}), 2);
+}
+
+TEST(TestVersionedVDB, Contention) {
+    constexpr uint32_t kSize = 128;
+    constexpr size_t kReaders = 4;
+    constexpr auto kDuration = std::chrono::milliseconds(300);
+
+    vox::VDB tree(nullptr);
+    tree.build_from(vox::VDB::coord_t(kSize), terrain_sampler(40, 30));
+    vox::VersionedVDB vdb(std::move(tree), kReaders + 1);
+
+    // million voxel queries per second over all readers, and versions published per second
+    auto run = [&](bool with_writer) {
+        std::atomic<bool> done{false};
+        std::atomic<size_t> queries{0};
+        size_t writes = 0;
+
+        std::vector<std::thread> readers;
+        for (size_t r = 0; r < kReaders; ++r) {
+            readers.emplace_back([&, r]() {
+                std::mt19937 rng(static_cast<uint32_t>(r));
+                std::uniform_int_distribution<uint32_t> coord(0, kSize - 1);
+                size_t count = 0;
+                uint32_t sum = 0;
+                while (!done) {
+                    auto snapshot = vdb.read();
+                    for (int i = 0; i < 256; ++i) {
+                        sum += snapshot->get_voxel({coord(rng), coord(rng), coord(rng)});
+                    }
+                    count += 256;
+                }
+                queries += count + (sum == ~0u);
+            });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> pos(0.f, float(kSize));
+        while (std::chrono::steady_clock::now() - start < kDuration) {
+            if (with_writer) {
+                vdb.write([&](vox::VDB& tree) {
+                    tree.fill_sphere({pos(rng), 60.f, pos(rng)}, 5.f, uint8_t(writes % 7));
+                });
+                ++writes;
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return std::make_pair(queries / elapsed.count() / 1e6, writes / elapsed.count());
+    };
+
+    auto [alone, unused] = run(false);
+    auto [contended, writes_per_s] = run(true);
+    bench_log() << kReaders << " readers on " << kSize
+                << "^3: " << alone << " Mqueries/s alone, " << contended
+                << " Mqueries/s with 1 writer publishing " << writes_per_s << " versions/s"
+                << std::endl;
+
+    EXPECT_GT(contended, 0.0);
+    EXPECT_GT(writes_per_s, 0.0);
+    // the versions pinned during the last publish are only reclaimed by the next one
+    EXPECT_LE(vdb.retained_versions(), kReaders + 1);
+}
+
+TEST(TestAccessor, MatchesGetVoxel) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(70, 40, 90),
+                   with_tiles({16, 40, 16}, terrain_sampler(10, 17)));
+
+    auto compare = [&](const char* what) {
+        SCOPED_TRACE(what);
+        auto size = vdb.size();
+
+        // sequential, then in a scattered order through the same accessor
+        vox::VDB::Accessor accessor(vdb);
+        for (uint32_t z = 0; z < size.z; ++z) {
+            for (uint32_t y = 0; y < size.y; ++y) {
+                for (uint32_t x = 0; x < size.x; ++x) {
+                    ASSERT_EQ(accessor.get_voxel({x, y, z}), vdb.get_voxel({x, y, z}));
+                }
+            }
+        }
+
+        std::mt19937 rng(7);
+        for (int i = 0; i < 20000; ++i) {
+            vox::VDB::coord_t pos(rng() % size.x, rng() % size.y, rng() % size.z);
+            ASSERT_EQ(accessor.get_voxel(pos), vdb.get_voxel(pos));
+        }
+
+        EXPECT_THROW(accessor.get_voxel({0, size.y, 0}), std::invalid_argument);
+    };
+
+    compare("bytes");
+    vdb.fill_sphere({40.f, 20.f, 40.f}, 9.f, 6);
+    compare("edited");
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+    compare("palette");
+}
+
+TEST(TestAccessor, Benchmark) {
+    constexpr uint32_t kSize = 128;
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(kSize), terrain_sampler(40, 30));
+
+    std::vector<vox::VDB::coord_t> sequential;
+    for (uint32_t z = 0; z < kSize; ++z) {
+        for (uint32_t y = 0; y < kSize; ++y) {
+            for (uint32_t x = 0; x < kSize; ++x) {
+                sequential.emplace_back(x, y, z);
+            }
+        }
+    }
+
+    std::mt19937 rng(11);
+    std::vector<vox::VDB::coord_t> random(sequential.size());
+    for (auto& pos : random) {
+        pos = vox::VDB::coord_t(rng() % kSize, rng() % kSize, rng() % kSize);
+    }
+
+    // 7-point stencil around every interior voxel
+    std::vector<vox::VDB::coord_t> stencil;
+    const glm::ivec3 offsets[]
+        = {{0, 0, 0}, {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+    for (uint32_t z = 1; z + 1 < kSize; z += 2) {
+        for (uint32_t y = 1; y + 1 < kSize; ++y) {
+            for (uint32_t x = 1; x + 1 < kSize; ++x) {
+                for (auto offset : offsets) {
+                    stencil.push_back(vox::VDB::coord_t(glm::ivec3(x, y, z) + offset));
+                }
+            }
+        }
+    }
+
+    // ns per lookup of `lookup` over `positions`, checking both agree
+    auto time = [&](const std::vector<vox::VDB::coord_t>& positions, auto&& lookup) {
+        uint64_t sum = 0;
+        double elapsed_ms = time_ms([&]() {
+            for (auto pos : positions) {
+                sum += lookup(pos);
+            }
+        });
+        return std::make_pair(elapsed_ms * 1e6 / positions.size(), sum);
+    };
+
+    auto bench = [&](const char* name, const std::vector<vox::VDB::coord_t>& positions) {
+        auto [direct_ns, direct_sum]
+            = time(positions, [&](vox::VDB::coord_t pos) { return vdb.get_voxel(pos); });
+
+        vox::VDB::Accessor accessor(vdb);
+        auto [cached_ns, cached_sum]
+            = time(positions, [&](vox::VDB::coord_t pos) { return accessor.get_voxel(pos); });
+
+        EXPECT_EQ(direct_sum, cached_sum);
+        bench_log() << name << " " << kSize << "^3: get_voxel " << direct_ns
+                    << " ns, accessor " << cached_ns << " ns per lookup" << std::endl;
+    };
+
+    bench("sequential", sequential);
+    bench("random", random);
+    bench("stencil", stencil);
+}
+
+TEST(TestBatchLookup, MatchesGetVoxel) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(70, 40, 90),
+                   with_tiles({16, 40, 16}, terrain_sampler(10, 17)));
+
+    std::mt19937 rng(3);
+    std::vector<vox::VDB::coord_t> positions;
+    for (int i = 0; i < 50000; ++i) {
+        // some of them outside of the volume, and plenty of repeats
+        positions.emplace_back(rng() % 80, rng() % 48, rng() % 100);
+    }
+
+    auto compare = [&](const char* what) {
+        SCOPED_TRACE(what);
+        std::vector<uint8_t> values(positions.size());
+        size_t outside = vdb.get_voxels(positions.data(), positions.size(), values.data(), 255);
+
+        size_t expected_outside = 0;
+        for (size_t i = 0; i < positions.size(); ++i) {
+            auto pos = positions[i];
+            if (glm::any(glm::greaterThanEqual(pos, vdb.size()))) {
+                ++expected_outside;
+                ASSERT_EQ(values[i], 255);
+            } else {
+                ASSERT_EQ(values[i], vdb.get_voxel(pos));
+            }
+        }
+        EXPECT_EQ(outside, expected_outside);
+    };
+
+    compare("bytes");
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+    compare("palette");
+
+    EXPECT_TRUE(vdb.get_voxels(std::vector<vox::VDB::coord_t>{}).empty());
+    EXPECT_EQ(vdb.get_voxels({{20, 2, 20}, {100, 0, 0}, {1, 1, 1}}),
+              (std::vector<uint8_t>{vdb.get_voxel({20, 2, 20}), 0, 3}));
+}
+
+TEST(TestBatchLookup, Benchmark) {
+    constexpr uint32_t kSize = 256;
+    constexpr size_t kQueries = 1 << 20;
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(kSize), terrain_sampler(80, 60));
+
+    // random points, points clustered around a few hundred centers like a physics step's, and a
+    // scan of whole rows
+    std::mt19937 rng(5);
+    std::vector<vox::VDB::coord_t> random(kQueries), clustered(kQueries), rows(kQueries);
+    for (auto& pos : random) {
+        pos = vox::VDB::coord_t(rng() % kSize, rng() % kSize, rng() % kSize);
+    }
+    for (size_t i = 0; i < kQueries; i += 4096) {
+        glm::ivec3 center(rng() % kSize, rng() % kSize, rng() % kSize);
+        for (size_t j = i; j < i + 4096; ++j) {
+            glm::ivec3 offset(rng() % 16, rng() % 16, rng() % 16);
+            clustered[j] = vox::VDB::coord_t(glm::clamp(center + offset - 8, 0, int(kSize) - 1));
+        }
+    }
+    for (size_t i = 0; i < kQueries; ++i) {
+        rows[i] = vox::detail::pos_from_index(i, vox::VDB::coord_t(kSize));
+    }
+
+    auto bench = [&](const char* name, const std::vector<vox::VDB::coord_t>& positions) {
+        std::vector<uint8_t> single(positions.size()), batched(positions.size());
+
+        double single_ms = time_ms([&]() {
+            for (size_t i = 0; i < positions.size(); ++i) {
+                single[i] = vdb.get_voxel(positions[i]);
+            }
+        });
+        double batched_ms = time_ms(
+            [&]() { vdb.get_voxels(positions.data(), positions.size(), batched.data()); });
+
+        EXPECT_EQ(single, batched);
+        bench_log() << positions.size() << " " << name << " lookups in " << kSize
+                    << "^3: get_voxel " << single_ms << " ms, get_voxels " << batched_ms << " ms"
+                    << std::endl;
+    };
+
+    bench("random", random);
+    bench("clustered", clustered);
+    bench("row", rows);
+}
+
+TEST(TestIterators, MatchesGetVoxel) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(70, 40, 90),
+                   with_tiles({32, 16, 32}, terrain_sampler(10, 17)));
+
+    auto compare = [&](const char* what) {
+        SCOPED_TRACE(what);
+        auto size = vdb.size();
+
+        std::vector<uint8_t> expected(size.x * size.y * size.z);
+        size_t active = 0;
+        for (uint32_t z = 0; z < size.z; ++z) {
+            for (uint32_t y = 0; y < size.y; ++y) {
+                for (uint32_t x = 0; x < size.x; ++x) {
+                    auto value = vdb.get_voxel({x, y, z});
+                    expected[vox::detail::pos_to_index({x, y, z}, size)] = value;
+                    active += value != 0;
+                }
+            }
+        }
+
+        // every active voxel exactly once
+        std::vector<uint8_t> seen(expected.size(), 0);
+        size_t visited = 0;
+        for (const auto& voxel : vdb.active_voxels()) {
+            ASSERT_TRUE(glm::all(glm::lessThan(voxel.pos, size)));
+            auto index = vox::detail::pos_to_index(voxel.pos, size);
+            ASSERT_EQ(seen[index], 0);
+            seen[index] = voxel.value;
+            ++visited;
+        }
+        EXPECT_EQ(visited, active);
+        EXPECT_EQ(seen, expected);
+
+        // leaves cover the active voxels, and the nodes of every level cover the leaves
+        size_t covered = 0;
+        for (const auto& leaf : vdb.leaves()) {
+            auto extent = vox::detail::node_extent(leaf.level);
+            ASSERT_TRUE(leaf.node.is_leaf);
+            EXPECT_EQ(leaf.min % extent, vox::VDB::coord_t(0));
+            covered += vox::detail::is_tile(leaf.node)
+                           ? extent.x * extent.y * extent.z
+                           : std::bitset<64>(leaf.node.child_mask).count();
+        }
+        EXPECT_EQ(covered, active);
+
+        for (size_t level = 1; level <= vdb.height(); ++level) {
+            size_t count = 0;
+            for (const auto& node : vdb.nodes(level)) {
+                EXPECT_EQ(node.level, level);
+                if (vox::detail::is_tile(node.node)) {
+                    EXPECT_EQ(vdb.get_voxel(node.min), node.node.child_offset);
+                }
+                ++count;
+            }
+            EXPECT_GT(count, 0);
+            EXPECT_EQ(level == vdb.height(), count == 1);
+        }
+        EXPECT_THROW(vdb.nodes(vdb.height() + 1), std::invalid_argument);
+
+        // in parallel, the same leaves in some order
+        std::mutex mutex;
+        std::vector<std::pair<size_t, size_t>> serial, parallel;
+        for (const auto& leaf : vdb.leaves()) {
+            serial.emplace_back(leaf.level, vox::detail::pos_to_index(leaf.min, size + 64u));
+        }
+        vdb.for_each_leaf(
+            [&](const vox::NodeRef& leaf) {
+                std::lock_guard<std::mutex> lock(mutex);
+                parallel.emplace_back(leaf.level, vox::detail::pos_to_index(leaf.min, size + 64u));
+            },
+            4);
+        std::sort(serial.begin(), serial.end());
+        std::sort(parallel.begin(), parallel.end());
+        EXPECT_EQ(serial, parallel);
+    };
+
+    compare("bytes");
+    vdb.fill_sphere({50.f, 20.f, 60.f}, 8.f, 0);
+    compare("edited");
+    vdb.deduplicate();
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+    compare("palette DAG");
+
+    vox::VDB empty(nullptr);
+    empty.build_from(vox::VDB::coord_t(20), [](vox::VDB::coord_t) -> uint8_t { return 0; });
+    EXPECT_EQ(empty.active_voxels().begin(), empty.active_voxels().end());
+}
+
+TEST(TestIterators, Benchmark) {
+    constexpr uint32_t kSize = 256;
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(kSize), [](vox::VDB::coord_t pos) -> uint8_t {
+        return std::abs(int(pos.y) - 60 - int(pos.x * 7 + pos.z * 3) % 30) < 2 ? 1 + pos.x % 5 : 0;
+    });
+
+    size_t dense_sum = 0;
+    double dense_ms = time_ms([&]() {
+        for (uint32_t z = 0; z < kSize; ++z) {
+            for (uint32_t y = 0; y < kSize; ++y) {
+                for (uint32_t x = 0; x < kSize; ++x) {
+                    dense_sum += vdb.get_voxel({x, y, z});
+                }
+            }
+        }
+    });
+
+    size_t sum = 0, count = 0;
+    double active_ms = time_ms([&]() {
+        for (const auto& voxel : vdb.active_voxels()) {
+            sum += voxel.value;
+            ++count;
+        }
+    });
+
+    EXPECT_EQ(sum, dense_sum);
+    bench_log() << count << " active voxels of " << kSize << "^3: get_voxel over the volume "
+                << dense_ms << " ms, active_voxels() " << active_ms << " ms" << std::endl;
+}
+
+TEST(TestDenseCopy, MatchesGetVoxel) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(70, 40, 90),
+                   with_tiles({32, 16, 32}, terrain_sampler(10, 17)));
+
+    auto compare = [&](vox::VDB::coord_t min, vox::VDB::coord_t max, size_t num_threads) {
+        SCOPED_TRACE(::testing::Message() << min.x << "," << min.y << "," << min.z << " - " << max.x
+                                          << "," << max.y << "," << max.z << ", " << num_threads
+                                          << " threads");
+        auto extent = max - min;
+
+        // x-major, and z-major with padding between the rows
+        std::vector<uint8_t> packed(extent.x * extent.y * extent.z, 0xAA);
+        vdb.copy_to_dense(min, max, packed.data(), num_threads);
+
+        glm::u64vec3 strides(extent.z * (extent.y + 1), extent.z, 1);
+        std::vector<uint8_t> strided(strides.x * extent.x, 0xAA);
+        vdb.copy_to_dense(min, max, strided.data(), strides, num_threads);
+
+        for (uint32_t z = 0; z < extent.z; ++z) {
+            for (uint32_t y = 0; y < extent.y; ++y) {
+                for (uint32_t x = 0; x < extent.x; ++x) {
+                    auto pos = min + vox::VDB::coord_t(x, y, z);
+                    uint8_t expected
+                        = glm::all(glm::lessThan(pos, vdb.size())) ? vdb.get_voxel(pos) : 0;
+                    ASSERT_EQ(packed[vox::detail::pos_to_index({x, y, z}, extent)], expected);
+                    ASSERT_EQ(strided[x * strides.x + y * strides.y + z * strides.z], expected);
+                }
+            }
+        }
+    };
+
+    auto compare_boxes = [&]() {
+        compare({0, 0, 0}, vdb.size(), 1);
+        compare({5, 3, 17}, {38, 29, 60}, 1);
+        compare({5, 3, 17}, {38, 29, 60}, 3);
+        compare({60, 30, 80}, {100, 50, 140}, 4);  // sticking out of the volume
+        compare({1, 1, 1}, {2, 2, 2}, 2);
+    };
+
+    compare_boxes();
+    vdb.fill_sphere({50.f, 20.f, 60.f}, 8.f, 0);
+    vdb.deduplicate();
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+    compare_boxes();
+}
+
+TEST(TestDenseCopy, Benchmark) {
+    constexpr uint32_t kSize = 256;
+    constexpr uint32_t kWindow = 128;
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(kSize), terrain_sampler(80, 60));
+
+    vox::VDB::coord_t min(50, 30, 70), max = min + kWindow;
+    std::vector<uint8_t> expected(kWindow * kWindow * kWindow), dense(expected.size());
+
+    double get_voxel_ms = time_ms([&]() {
+        for (uint32_t z = 0; z < kWindow; ++z) {
+            for (uint32_t y = 0; y < kWindow; ++y) {
+                for (uint32_t x = 0; x < kWindow; ++x) {
+                    expected[vox::detail::pos_to_index({x, y, z}, vox::VDB::coord_t(kWindow))]
+                        = vdb.get_voxel(min + vox::VDB::coord_t(x, y, z));
+                }
+            }
+        }
+    });
+
+    double serial_ms = time_ms([&]() { vdb.copy_to_dense(min, max, dense.data()); });
+    EXPECT_EQ(dense, expected);
+
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::fill(dense.begin(), dense.end(), 0);
+    double parallel_ms
+        = time_ms([&]() { vdb.copy_to_dense(min, max, dense.data(), num_threads); });
+    EXPECT_EQ(dense, expected);
+
+    bench_log() << kWindow << "^3 window of " << kSize << "^3: get_voxel " << get_voxel_ms
+                << " ms, copy_to_dense " << serial_ms << " ms, " << num_threads << " threads "
+                << parallel_ms << " ms" << std::endl;
+}
+
+namespace {
+
+// Steps the ray through every voxel of the volume, sampling each with get_voxel
+std::optional<vox::RayHit> raycast_voxels(vox::VDB& vdb, glm::vec3 origin, glm::vec3 dir,
+                                          float tmax) {
+    glm::vec3 size(vdb.size());
+    float t = 0.f, t_exit = tmax;
+    glm::ivec3 normal(0);
+    for (int axis = 0; axis < 3; ++axis) {
+        if (dir[axis] == 0.f) {
+            if (origin[axis] < 0.f || origin[axis] >= size[axis]) {
+                return std::nullopt;
+            }
+            continue;
+        }
+        float t_low = -origin[axis] / dir[axis], t_high = (size[axis] - origin[axis]) / dir[axis];
+        if (t_low > t_high) {
+            std::swap(t_low, t_high);
+        }
+        if (t_low > t) {
+            t = t_low;
+            normal = glm::ivec3(0);
+            normal[axis] = dir[axis] > 0.f ? -1 : 1;
+        }
+        t_exit = std::min(t_exit, t_high);
+    }
+    if (t_exit <= t) {
+        return std::nullopt;
+    }
+
+    glm::vec3 entry = origin + dir * t;
+    glm::ivec3 voxel, step;
+    glm::vec3 t_next;
+    for (int axis = 0; axis < 3; ++axis) {
+        voxel[axis] = std::clamp(static_cast<int>(std::floor(entry[axis])), 0,
+                                 static_cast<int>(size[axis]) - 1);
+        step[axis] = dir[axis] > 0.f ? 1 : dir[axis] < 0.f ? -1 : 0;
+        t_next[axis] = step[axis] != 0 ? (voxel[axis] + (step[axis] > 0) - origin[axis]) / dir[axis]
+                                       : std::numeric_limits<float>::infinity();
+    }
+
+    while (t < t_exit) {
+        if (uint8_t value = vdb.get_voxel(vox::VDB::coord_t(voxel))) {
+            return vox::RayHit{vox::VDB::coord_t(voxel), value, normal, t};
+        }
+
+        int axis = t_next.x <= t_next.y && t_next.x <= t_next.z ? 0 : t_next.y <= t_next.z ? 1 : 2;
+        voxel[axis] += step[axis];
+        if (voxel[axis] < 0 || voxel[axis] >= static_cast<int>(size[axis])) {
+            break;
+        }
+        t = t_next[axis];
+        t_next[axis] = (voxel[axis] + (step[axis] > 0) - origin[axis]) / dir[axis];
+        normal = glm::ivec3(0);
+        normal[axis] = -step[axis];
+    }
+    return std::nullopt;
+}
+
+}  // namespace
+
+TEST(TestRaycast, MatchesVoxelDDA) {
+    vox::VDB vdb(nullptr);
+    auto sphere = sphere_sampler({60, 35, 45}, 15.f);
+    vdb.build_from(vox::VDB::coord_t(100, 60, 80),
+                   with_tiles({32, 16, 32}, [&sphere](vox::VDB::coord_t pos) -> uint8_t {
+                       if (uint8_t value = sphere(pos)) {
+                           return value;
+                       }
+                       return pos.x % 23 == 0 && pos.z % 19 == 0 ? 7 : 0;  // thin pillars
+                   }));
+
+    std::mt19937 rng(18);
+    std::uniform_real_distribution<float> outside(-40.f, 140.f), unit(-1.f, 1.f);
+
+    size_t hits = 0;
+    auto compare = [&](glm::vec3 origin, glm::vec3 dir, float tmax) {
+        SCOPED_TRACE(::testing::Message() << "origin " << origin.x << "," << origin.y << ","
+                                          << origin.z << " dir " << dir.x << "," << dir.y << ","
+                                          << dir.z << " tmax " << tmax);
+        auto expected = raycast_voxels(vdb, origin, dir, tmax);
+        auto hit = vdb.raycast(origin, dir, tmax);
+        ASSERT_EQ(hit.has_value(), expected.has_value());
+        if (hit) {
+            ++hits;
+            ASSERT_EQ(hit->voxel, expected->voxel);
+            ASSERT_EQ(hit->value, expected->value);
+            ASSERT_EQ(hit->normal, expected->normal);
+            ASSERT_NEAR(hit->t, expected->t, 1e-3f * std::max(1.f, expected->t));
+        }
+    };
+
+    auto compare_rays = [&]() {
+        for (int i = 0; i < 3000; ++i) {
+            glm::vec3 origin(outside(rng), outside(rng), outside(rng));
+            glm::vec3 target(outside(rng) * 0.5f + 25.f, outside(rng) * 0.3f + 15.f,
+                             outside(rng) * 0.4f + 20.f);
+            compare(origin, target - origin, std::numeric_limits<float>::infinity());
+            compare(origin, glm::normalize(target - origin), 90.f);
+        }
+        for (int i = 0; i < 1000; ++i) {
+            glm::vec3 origin(std::abs(unit(rng)) * 100.f, std::abs(unit(rng)) * 60.f,
+                             std::abs(unit(rng)) * 80.f);
+            compare(origin, {unit(rng), unit(rng), unit(rng)},
+                    std::numeric_limits<float>::infinity());
+        }
+
+        // axis-aligned, through the middle of voxels
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int i = 0; i < 50; ++i) {
+                glm::vec3 origin(std::floor(std::abs(unit(rng)) * 99.f) + 0.5f,
+                                 std::floor(std::abs(unit(rng)) * 59.f) + 0.5f,
+                                 std::floor(std::abs(unit(rng)) * 79.f) + 0.5f);
+                glm::vec3 dir(0.f);
+                dir[axis] = i % 2 ? 1.f : -1.f;
+                origin[axis] = i % 2 ? -5.f : 150.f;
+                compare(origin, dir, std::numeric_limits<float>::infinity());
+            }
+        }
+
+        // missing the volume, and stopping short of it
+        EXPECT_FALSE(vdb.raycast({-10.f, 70.f, 5.f}, {1.f, 0.f, 0.f}));
+        EXPECT_FALSE(vdb.raycast({-10.f, 5.f, 5.f}, {1.f, 0.f, 0.f}, 9.f));
+        EXPECT_FALSE(vdb.raycast({-10.f, 5.f, 5.f}, {-1.f, 0.f, 0.f}));
+    };
+
+    compare_rays();
+    vdb.fill_sphere({20.f, 10.f, 20.f}, 6.f, 0);
+    vdb.deduplicate();
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+    compare_rays();
+    EXPECT_GT(hits, 3000u);
+
+    EXPECT_THROW(vdb.raycast({1.f, 1.f, 1.f}, glm::vec3(0.f)), std::invalid_argument);
+
+    // a volume scaled by 2 and moved by 10 along x, rays given in world space
+    glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.f), {10.f, 0.f, 0.f}), glm::vec3(2.f));
+    auto world = vdb.raycast(glm::inverse(model), {0.f, 1.f, 1.f}, {1.f, 0.f, 0.f});
+    auto local = vdb.raycast({-5.f, 0.5f, 0.5f}, {0.5f, 0.f, 0.f});
+    ASSERT_TRUE(world && local);
+    EXPECT_EQ(world->voxel, local->voxel);
+    EXPECT_EQ(world->normal, glm::ivec3(-1, 0, 0));
+    EXPECT_NEAR(world->t, 10.f, 1e-4f);
+    EXPECT_NEAR(world->t, local->t, 1e-4f);
+}
+
+TEST(TestRaycast, Benchmark) {
+    constexpr uint32_t kSize = 256;
+    constexpr size_t kRays = 20000;
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(kSize), terrain_sampler(40, 30));
+
+    // a camera above the terrain looking down at it
+    std::mt19937 rng(19);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    std::vector<std::pair<glm::vec3, glm::vec3>> rays(kRays);
+    for (auto& ray : rays) {
+        ray.first = glm::vec3(-20.f, 220.f, -20.f);
+        ray.second = glm::vec3(1.f + unit(rng) * 0.6f, -0.7f + unit(rng) * 0.3f,
+                               1.f + unit(rng) * 0.6f);
+    }
+
+    constexpr float kInf = std::numeric_limits<float>::infinity();
+    std::vector<std::optional<vox::RayHit>> expected(kRays), hits(kRays);
+
+    double voxel_ms = time_ms([&]() {
+        for (size_t i = 0; i < kRays; ++i) {
+            expected[i] = raycast_voxels(vdb, rays[i].first, rays[i].second, kInf);
+        }
+    });
+
+    double hierarchical_ms = time_ms([&]() {
+        for (size_t i = 0; i < kRays; ++i) {
+            hits[i] = vdb.raycast(rays[i].first, rays[i].second);
+        }
+    });
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < kRays; ++i) {
+        mismatches += hits[i].has_value() != expected[i].has_value()
+                      || (hits[i] && hits[i]->voxel != expected[i]->voxel);
+    }
+    EXPECT_EQ(mismatches, 0u);
+
+    bench_log() << kRays << " rays into " << kSize << "^3: voxel stepping "
+                << kRays / voxel_ms / 1e3 << " Mrays/s, hierarchical "
+                << kRays / hierarchical_ms / 1e3 << " Mrays/s" << std::endl;
+}
+
+namespace {
+
+struct Ray {
+    glm::vec3 origin, dir;
+    float tmax;
+};
+
+// Cast `rays` N at a time, returning the hits and the time taken
+template <size_t N>
+std::vector<std::optional<vox::RayHit>> raycast_packets(const vox::VDB& vdb,
+                                                        const std::vector<Ray>& rays,
+                                                        double* ms = nullptr) {
+    std::vector<std::optional<vox::RayHit>> result(rays.size());
+    vox::RayHit hits[N];
+
+    double elapsed_ms = time_ms([&]() {
+        for (size_t first = 0; first < rays.size(); first += N) {
+            vox::RayPacket<N> packet;
+            for (size_t lane = 0; lane < N && first + lane < rays.size(); ++lane) {
+                const auto& ray = rays[first + lane];
+                packet.set_ray(lane, ray.origin, ray.dir, ray.tmax);
+            }
+
+            uint32_t hit_mask = vdb.raycast(packet, hits);
+            for (size_t lane = 0; lane < N && first + lane < rays.size(); ++lane) {
+                if (hit_mask & (1u << lane)) {
+                    result[first + lane] = hits[lane];
+                }
+            }
+        }
+    });
+    if (ms) {
+        *ms = elapsed_ms;
+    }
+
+    return result;
+}
+
+// Rays through the pixels of a kSide x kSide image, ordered in 4x4 tiles so that packets of up
+// to 16 consecutive rays are neighboring pixels
+std::vector<Ray> camera_rays(glm::vec3 eye, glm::vec3 forward, glm::vec3 right, glm::vec3 up,
+                             int side, float tmax = std::numeric_limits<float>::infinity()) {
+    std::vector<Ray> rays;
+    for (int tile_y = 0; tile_y < side; tile_y += 4) {
+        for (int tile_x = 0; tile_x < side; tile_x += 4) {
+            for (int y = tile_y; y < tile_y + 4; ++y) {
+                for (int x = tile_x; x < tile_x + 4; ++x) {
+                    float u = (x + 0.5f) / side * 2.f - 1.f, v = (y + 0.5f) / side * 2.f - 1.f;
+                    rays.push_back({eye, forward + right * u + up * v, tmax});
+                }
+            }
+        }
+    }
+    return rays;
+}
+
+}  // namespace
+
+TEST(TestRaycast, PacketsMatchSingleRays) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(100, 60, 80),
+                   with_tiles({32, 16, 32}, terrain_sampler(20, 23)));
+
+    std::mt19937 rng(19);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+    std::vector<Ray> rays = camera_rays({-20.f, 90.f, -30.f}, {1.f, -0.8f, 1.f},
+                                        {0.6f, 0.f, -0.6f}, {-0.3f, 0.6f, -0.3f}, 32);
+    auto inside = camera_rays({50.3f, 50.6f, 40.2f}, {0.2f, -1.f, 0.1f}, {1.f, 0.f, 0.f},
+                              {0.f, 0.f, 1.f}, 16, 30.f);
+    rays.insert(rays.end(), inside.begin(), inside.end());
+    for (int i = 0; i < 2000; ++i) {
+        glm::vec3 origin(unit(rng) * 80.f + 50.f, unit(rng) * 60.f + 30.f, unit(rng) * 70.f + 40.f);
+        glm::vec3 dir(unit(rng), unit(rng), unit(rng));
+        if (i % 7 == 0) {
+            dir[i % 3] = 0.f;  // parallel to an axis plane
+        }
+        rays.push_back({origin, dir, i % 5 == 0 ? 40.f : std::numeric_limits<float>::infinity()});
+    }
+
+    auto compare = [&](const std::vector<std::optional<vox::RayHit>>& hits) {
+        size_t num_hits = 0;
+        for (size_t i = 0; i < rays.size(); ++i) {
+            SCOPED_TRACE(::testing::Message() << "ray " << i);
+            auto expected = vdb.raycast(rays[i].origin, rays[i].dir, rays[i].tmax);
+            ASSERT_EQ(hits[i].has_value(), expected.has_value());
+            if (expected) {
+                ++num_hits;
+                ASSERT_EQ(hits[i]->voxel, expected->voxel);
+                ASSERT_EQ(hits[i]->value, expected->value);
+                ASSERT_EQ(hits[i]->normal, expected->normal);
+                ASSERT_FLOAT_EQ(hits[i]->t, expected->t);
+            }
+        }
+        EXPECT_GT(num_hits, rays.size() / 3);
+    };
+
+    auto compare_packets = [&]() {
+        compare(raycast_packets<4>(vdb, rays));
+        compare(raycast_packets<8>(vdb, rays));
+        compare(raycast_packets<16>(vdb, rays));
+    };
+
+    compare_packets();
+    vdb.fill_sphere({20.f, 10.f, 20.f}, 6.f, 0);
+    vdb.deduplicate();
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+    compare_packets();
+
+    // inactive lanes are left alone
+    vox::RayPacket<8> packet;
+    packet.set_ray(2, {-10.f, 5.f, 5.f}, {1.f, 0.1f, 0.1f});
+    packet.set_ray(5, {-10.f, 5.f, 5.f}, {-1.f, 0.1f, 0.1f});
+    vox::RayHit hits[8];
+    EXPECT_EQ(vdb.raycast(packet, hits), 1u << 2);
+}
+
+TEST(TestRaycast, PacketBenchmark) {
+    constexpr uint32_t kSize = 256;
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(kSize), terrain_sampler(40, 30));
+
+    // a camera looking down at the terrain, and rays in random directions from random places
+    auto coherent = camera_rays({-20.f, 220.f, -20.f}, {1.f, -0.7f, 1.f}, {0.6f, 0.f, -0.6f},
+                                {-0.3f, 0.5f, -0.3f}, 256);
+    std::mt19937 rng(19);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    std::vector<Ray> incoherent(coherent.size());
+    for (auto& ray : incoherent) {
+        ray = {glm::vec3(unit(rng), unit(rng) * 0.2f + 0.7f, unit(rng)) * float(kSize),
+               glm::vec3(unit(rng), unit(rng), unit(rng)), std::numeric_limits<float>::infinity()};
+    }
+
+    for (const auto* rays : {&coherent, &incoherent}) {
+        std::vector<std::optional<vox::RayHit>> expected(rays->size());
+        double single_ms = time_ms([&]() {
+            for (size_t i = 0; i < rays->size(); ++i) {
+                expected[i] = vdb.raycast((*rays)[i].origin, (*rays)[i].dir);
+            }
+        });
+
+        double packet_ms[3];
+        auto hits_4 = raycast_packets<4>(vdb, *rays, &packet_ms[0]);
+        auto hits_8 = raycast_packets<8>(vdb, *rays, &packet_ms[1]);
+        auto hits_16 = raycast_packets<16>(vdb, *rays, &packet_ms[2]);
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < rays->size(); ++i) {
+            for (const auto* hits : {&hits_4, &hits_8, &hits_16}) {
+                mismatches += (*hits)[i].has_value() != expected[i].has_value()
+                              || ((*hits)[i] && (*hits)[i]->voxel != expected[i]->voxel);
+            }
+        }
+        EXPECT_EQ(mismatches, 0u);
+
+        auto mrays = [&](double ms) { return rays->size() / ms / 1e3; };
+        bench_log() << rays->size() << (rays == &coherent ? " coherent" : " incoherent")
+                    << " rays: single " << mrays(single_ms) << " Mrays/s, packets of 4 "
+                    << mrays(packet_ms[0]) << ", of 8 " << mrays(packet_ms[1]) << ", of 16 "
+                    << mrays(packet_ms[2]) << std::endl;
+    }
+}
+
+namespace {
+
+// The viewer's camera for an orbit around a volume of `size` voxels scaled down by 5
+vox::TracerCamera orbit_camera(glm::vec3 size, glm::vec3 camera_pos, float aspect) {
+    glm::mat4 model = glm::scale(glm::mat4(1.f), glm::vec3(0.2f));
+    model = glm::translate(model, -size / 2.f);
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.f), aspect, 0.1f, 1000.f);
+    projection[1][1] *= -1.f;
+    auto view_no_trans = glm::lookAt(glm::vec3(0.f), -camera_pos, glm::vec3(0.f, 0.f, 1.f));
+
+    return {glm::inverse(projection * view_no_trans), glm::inverse(model), camera_pos};
+}
+
+}  // namespace
+
+TEST(TestCpuTracer, MatchesRaycast) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(96, 80, 64),
+                   with_tiles({32, 32, 16}, sphere_sampler({55, 45, 30}, 20.f)));
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+
+    constexpr uint32_t kWidth = 160, kHeight = 120;
+    auto camera = orbit_camera(glm::vec3(vdb.size()), {18.f, -22.f, 12.f}, 4.f / 3.f);
+    auto image = vox::trace_image(vdb, camera, kWidth, kHeight, 1);
+    EXPECT_EQ(vox::trace_image(vdb, camera, kWidth, kHeight, 3), image);
+
+    // every pixel against VDB::raycast along the same primary ray: a hit is shaded by the axis of
+    // the face it enters through, other rays through the volume only pick up fog
+    size_t hits = 0, fog = 0, mismatches = 0;
+    for (uint32_t y = 0; y < kHeight; ++y) {
+        for (uint32_t x = 0; x < kWidth; ++x) {
+            const uint8_t* pixel = &image[(y * kWidth + x) * 4];
+
+            glm::vec2 uv((x + 0.5f) / kWidth * 2.f - 1.f, (y + 0.5f) / kHeight * 2.f - 1.f);
+            glm::vec4 far = camera.inv_vp * glm::vec4(uv.x, uv.y, 1.f, 1.f);
+            glm::vec3 dir = glm::normalize(glm::vec3(far.x, far.y, far.z) / far.w);
+            glm::vec4 origin = camera.inv_m * glm::vec4(camera.camera_pos, 1.f);
+            auto hit = vdb.raycast(glm::vec3(origin.x, origin.y, origin.z), dir);
+
+            if (hit) {
+                ++hits;
+                int axis = hit->normal.x != 0 ? 0 : hit->normal.y != 0 ? 1 : 2;
+                uint8_t shade = std::array<uint8_t, 3>{128, 179, 230}[axis];
+                mismatches += pixel[3] != 255 || pixel[0] != shade;
+            } else {
+                fog += pixel[3] > 0;
+                mismatches += pixel[3] == 255 || pixel[0] != pixel[3];
+            }
+        }
+    }
+
+    EXPECT_GT(hits, kWidth * kHeight / 20);
+    EXPECT_GT(fog, kWidth * kHeight / 10);
+    EXPECT_LT(mismatches, kWidth * kHeight / 200);  // rays grazing voxel edges
+}
+
+TEST(TestCpuTracer, Benchmark) {
+    constexpr uint32_t kSize = 256;
+    constexpr uint32_t kWidth = 640, kHeight = 360;
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(kSize),
+                   sphere_sampler(vox::VDB::coord_t(kSize / 2), 105.f));
+
+    auto camera = orbit_camera(glm::vec3(vdb.size()), {40.f, 30.f, 25.f}, 16.f / 9.f);
+
+    std::vector<uint8_t> serial, parallel;
+    double serial_ms
+        = time_ms([&]() { serial = vox::trace_image(vdb, camera, kWidth, kHeight, 1); });
+
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    double parallel_ms = time_ms(
+        [&]() { parallel = vox::trace_image(vdb, camera, kWidth, kHeight, num_threads); });
+    EXPECT_EQ(parallel, serial);
+
+    constexpr double kPixels = kWidth * kHeight;
+    bench_log() << kWidth << "x" << kHeight << " of a " << kSize << "^3 sphere: 1 thread "
+                << kPixels / serial_ms / 1e3 << " Mpixels/s, " << num_threads << " threads "
+                << kPixels / parallel_ms / 1e3 << " Mpixels/s" << std::endl;
+}
+
+TEST(TestSerialization, RoundTrip) {
+    constexpr uint32_t kSize = 100;
+    auto sampler = [](vox::VDB::coord_t pos) -> uint8_t {
+        return pos.y < 30 + (pos.x * 7 + pos.z * 3) % 40 ? 1 + (pos.x / 8 + pos.z / 8) % 5 : 0;
+    };
+
+    auto path = (std::filesystem::temp_directory_path() / "spor_round_trip.vdb").string();
+    for (int variant = 0; variant < 3; ++variant) {
+        vox::VDB vdb(nullptr);
+        vdb.build_from(vox::VDB::coord_t(kSize, kSize / 2, kSize + 17), sampler);
+        if (variant >= 1) {
+            vdb.deduplicate();
+        }
+        if (variant >= 2) {
+            vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+        }
+        vdb.save(path);
+
+        vox::VDB loaded(nullptr);
+        loaded.build_from(vox::VDB::coord_t(8), sampler);  // replaced by load
+        loaded.load(path);
+
+        vox::TestInspector expected(vdb), actual(loaded);
+        EXPECT_EQ(loaded.height(), vdb.height());
+        EXPECT_EQ(loaded.size(), vdb.size());
+        EXPECT_EQ(loaded.voxel_encoding(), vdb.voxel_encoding());
+        EXPECT_EQ(actual.get_voxels(), expected.get_voxels());
+        ASSERT_EQ(actual.get_nodes().size(), expected.get_nodes().size());
+
+        // the voxel section ends the file and starts on a page
+        EXPECT_EQ((std::filesystem::file_size(path) - expected.get_voxels().size()) % 4096, 0);
+        EXPECT_EQ(std::memcmp(actual.get_nodes().data(), expected.get_nodes().data(),
+                              expected.get_nodes().size() * sizeof(vox::SVNode)),
+                  0);
+
+        // the loaded tree still has to be uploaded
+        EXPECT_TRUE(actual.get_dirty_nodes().all());
+
+        for (uint32_t z = 0; z < vdb.size().z; z += 3) {
+            for (uint32_t y = 0; y < vdb.size().y; y += 2) {
+                for (uint32_t x = 0; x < vdb.size().x; ++x) {
+                    ASSERT_EQ(loaded.get_voxel({x, y, z}), sampler({x, y, z}));
+                }
+            }
+        }
+
+        // and edits work on it as on the original
+        loaded.fill_box({10, 10, 10}, {20, 20, 20}, 9);
+        EXPECT_EQ(loaded.get_voxel({15, 15, 15}), 9);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(TestSerialization, RejectsInvalidFiles) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(64), [](vox::VDB::coord_t pos) -> uint8_t {
+        return (pos.x + pos.y + pos.z) % 3 == 0 ? 1 + pos.x % 4 : 0;
+    });
+
+    auto path = (std::filesystem::temp_directory_path() / "spor_invalid.vdb").string();
+    vdb.save(path);
+
+    std::vector<char> bytes(std::filesystem::file_size(path));
+    std::ifstream(path, std::ios::binary).read(bytes.data(), bytes.size());
+
+    auto write = [&path](const std::vector<char>& contents) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc)
+            .write(contents.data(), contents.size());
+    };
+
+    auto expect_rejected = [&]() {
+        vox::VDB loaded(nullptr);
+        loaded.build_from(vox::VDB::coord_t(8), [](vox::VDB::coord_t) -> uint8_t { return 3; });
+        EXPECT_THROW(loaded.load(path), std::runtime_error);
+        // left unchanged
+        EXPECT_EQ(loaded.size(), vox::VDB::coord_t(8));
+        EXPECT_EQ(loaded.get_voxel({1, 2, 3}), 3);
+    };
+
+    EXPECT_THROW(vdb.load(path + ".missing"), std::runtime_error);
+
+    write({});
+    expect_rejected();
+
+    auto corrupt = bytes;
+    corrupt[0] = 'X';  // magic
+    write(corrupt);
+    expect_rejected();
+
+    corrupt = bytes;
+    corrupt[8] = 2;  // version
+    write(corrupt);
+    expect_rejected();
+
+    write(std::vector<char>(bytes.begin(), bytes.end() - 1));  // truncated voxels
+    expect_rejected();
+
+    // a node pointing past the end of the node array
+    corrupt = bytes;
+    uint32_t bad_offset = 0x7fffffff;
+    std::memcpy(corrupt.data() + 4096, &bad_offset, sizeof(bad_offset));
+    write(corrupt);
+    expect_rejected();
+
+    write(bytes);
+    vox::VDB loaded(nullptr);
+    loaded.load(path);
+    EXPECT_EQ(loaded.get_voxel({3, 0, 0}), vdb.get_voxel({3, 0, 0}));
+
+    std::filesystem::remove(path);
+}
+
+TEST(TestSerialization, Benchmark) {
+    constexpr uint32_t kSize = 256;
+
+    vox::VDB vdb(nullptr);
+    double build_ms = time_ms([&]() {
+        vdb.build_from(vox::VDB::coord_t(kSize),
+                       sphere_sampler(vox::VDB::coord_t(kSize / 2), 105.f));
+    });
+
+    auto path = (std::filesystem::temp_directory_path() / "spor_benchmark.vdb").string();
+    double save_ms = time_ms([&]() { vdb.save(path); });
+
+    vox::VDB loaded(nullptr);
+    double load_ms = time_ms([&]() { loaded.load(path); });
+
+    bench_log() << kSize << "^3 sphere, " << std::filesystem::file_size(path) / (1024 * 1024)
+                << " MiB: build " << build_ms << " ms, save " << save_ms << " ms, load "
+                << load_ms << " ms" << std::endl;
+
+    std::filesystem::remove(path);
+}
+
+TEST(TestPagedVDB, MatchesVDB) {
+    // tiles above and at the page level
+    auto sampler = with_tiles(vox::VDB::coord_t(32), sphere_sampler({60, 50, 40}, 30.f));
+
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(100, 90, 80), sampler);
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+
+    auto path = (std::filesystem::temp_directory_path() / "spor_paged.vdb").string();
+    for (size_t page_level = 1; page_level < vdb.height(); ++page_level) {
+        vox::PagedVDB::write(vdb, path, page_level);
+        vox::PagedVDB paged(path, 64 * 1024);
+        EXPECT_EQ(paged.size(), vdb.size());
+        EXPECT_EQ(paged.height(), vdb.height());
+
+        for (uint32_t z = 0; z < vdb.size().z; z += 3) {
+            for (uint32_t y = 0; y < vdb.size().y; y += 2) {
+                for (uint32_t x = 0; x < vdb.size().x; ++x) {
+                    ASSERT_EQ(paged.get_voxel({x, y, z}), vdb.get_voxel({x, y, z}));
+                }
+            }
+        }
+
+        std::mt19937 rng(page_level);
+        std::uniform_real_distribution<float> pos(-20.f, 120.f), dir(-1.f, 1.f);
+        for (int i = 0; i < 2000; ++i) {
+            glm::vec3 origin(pos(rng), pos(rng), pos(rng));
+            glm::vec3 direction(dir(rng), dir(rng), dir(rng));
+            auto expected = vdb.raycast(origin, direction);
+            auto actual = paged.raycast(origin, direction);
+            ASSERT_EQ(actual.has_value(), expected.has_value());
+            if (expected) {
+                EXPECT_EQ(actual->voxel, expected->voxel);
+                EXPECT_EQ(actual->value, expected->value);
+                EXPECT_EQ(actual->normal, expected->normal);
+                EXPECT_NEAR(actual->t, expected->t, 1e-3f * std::max(1.f, expected->t));
+            }
+        }
+
+        // leaves cover the same voxels with the same values
+        size_t expected_voxels = 0, actual_voxels = 0;
+        for (const auto& leaf : vdb.leaves()) {
+            expected_voxels += leaf.level > 1 || vox::detail::is_tile(leaf.node)
+                                   ? size_t(1) << (3 * vox::detail::Config::log2_extent(leaf.level))
+                                   : vox::detail::popcount(leaf.node.child_mask);
+        }
+        paged.for_each_leaf([&](const vox::NodeRef& leaf) {
+            if (leaf.level > 1 || vox::detail::is_tile(leaf.node)) {
+                actual_voxels += size_t(1) << (3 * vox::detail::Config::log2_extent(leaf.level));
+                EXPECT_EQ(paged.get_voxel(leaf.min), leaf.node.child_offset);
+            } else {
+                actual_voxels += vox::detail::popcount(leaf.node.child_mask);
+            }
+        });
+        EXPECT_EQ(actual_voxels, expected_voxels);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(TestPagedVDB, Residency) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(128), [](vox::VDB::coord_t pos) -> uint8_t {
+        return (pos.x * 7 + pos.y * 3 + pos.z) % 5 == 0 ? 1 + pos.y % 4 : 0;
+    });
+
+    constexpr size_t kPageLevel = 2;
+    const uint32_t extent = vox::detail::node_extent(kPageLevel).x;
+
+    auto path = (std::filesystem::temp_directory_path() / "spor_residency.vdb").string();
+    vox::PagedVDB::write(vdb, path, kPageLevel);
+
+    // room for a handful of pages only
+    vox::PagedVDB paged(path, 12 * 1024);
+    EXPECT_EQ(paged.get_voxel({1, 2, 3}), vdb.get_voxel({1, 2, 3}));
+    EXPECT_EQ(paged.get_voxel({2, 1, 3}), vdb.get_voxel({2, 1, 3}));
+    auto stats = paged.stats();
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.evictions, 0);
+    EXPECT_EQ(stats.resident_pages, 1);
+
+    for (uint32_t z = 0; z < 128; z += extent) {
+        for (uint32_t y = 0; y < 128; y += extent) {
+            for (uint32_t x = 0; x < 128; x += extent) {
+                ASSERT_EQ(paged.get_voxel({x, y, z}), vdb.get_voxel({x, y, z}));
+            }
+        }
+    }
+    const size_t num_pages = nodes_covering(vox::VDB::coord_t(128), kPageLevel);
+    stats = paged.stats();
+    EXPECT_EQ(stats.misses, num_pages);
+    EXPECT_GT(stats.evictions, 0);
+    EXPECT_LE(stats.resident_bytes, paged.budget_bytes());
+    EXPECT_EQ(stats.evictions, stats.misses - stats.resident_pages);
+
+    paged.reset_stats();
+    EXPECT_EQ(paged.stats().misses, 0);
+    EXPECT_EQ(paged.stats().resident_pages, stats.resident_pages);
+
+    // a prefetched box is served from the cache
+    vox::PagedVDB prefetched_box(path, 12 * 1024);
+    const vox::VDB::coord_t box_min(24, 24, 32), box_max(40, 40, 40);
+    auto box_pages = (box_max + extent - 1u) / extent - box_min / extent;
+    const size_t num_box_pages = static_cast<size_t>(box_pages.x) * box_pages.y * box_pages.z;
+    prefetched_box.prefetch(box_min, box_max);
+    EXPECT_EQ(prefetched_box.stats().misses, num_box_pages);
+    for (uint32_t z = 32; z < 40; ++z) {
+        for (uint32_t y = 24; y < 40; ++y) {
+            for (uint32_t x = 24; x < 40; ++x) {
+                ASSERT_EQ(prefetched_box.get_voxel({x, y, z}), vdb.get_voxel({x, y, z}));
+            }
+        }
+    }
+    EXPECT_EQ(prefetched_box.stats().misses, num_box_pages);
+
+    // so is what the camera sees, nearest first, while what is behind it is not prefetched
+    vox::PagedVDB unlimited(path, 64 * 1024 * 1024);
+    glm::vec3 eye(64.f, 64.f, 64.f);
+    glm::mat4 mvp = glm::perspective(glm::radians(30.f), 1.f, 0.1f, 1000.f)
+                    * glm::lookAt(eye, eye + glm::vec3(1.f, 0.f, 0.f), glm::vec3(0.f, 0.f, 1.f));
+    unlimited.prefetch(mvp);
+    auto prefetched = unlimited.stats().misses;
+    EXPECT_GT(prefetched, 0);
+    EXPECT_LT(prefetched, num_pages / 2);
+
+    EXPECT_EQ(unlimited.get_voxel({120, 64, 64}), vdb.get_voxel({120, 64, 64}));
+    EXPECT_EQ(unlimited.stats().misses, prefetched);
+    EXPECT_EQ(unlimited.get_voxel({10, 64, 64}), vdb.get_voxel({10, 64, 64}));
+    EXPECT_EQ(unlimited.stats().misses, prefetched + 1);
+
+    std::filesystem::remove(path);
+}
+
+TEST(TestImporters, RawVolume) {
+    const vox::VDB::coord_t dims(37, 20, 23);
+    auto sample = [](uint32_t x, uint32_t y, uint32_t z) -> uint32_t {
+        return (x * 131 + y * 71 + z * 29) % 4096;
+    };
+
+    auto path = (std::filesystem::temp_directory_path() / "spor_volume.raw").string();
+    for (uint32_t bits : {8u, 16u}) {
+        vox::RawVolumeFormat format;
+        format.dims = dims;
+        format.bits = bits;
+        format.big_endian = bits == 16;
+        format.header_bytes = 5;
+        if (bits == 16) {
+            format.threshold = 1000;
+            format.range_min = 1500;
+            format.range_max = 3500;
+        }
+
+        std::vector<char> bytes(format.header_bytes, 'h');
+        for (uint32_t z = 0; z < dims.z; ++z) {
+            for (uint32_t y = 0; y < dims.y; ++y) {
+                for (uint32_t x = 0; x < dims.x; ++x) {
+                    uint32_t value = sample(x, y, z);
+                    if (bits == 8) {
+                        bytes.push_back(static_cast<char>(value % 256));
+                    } else {
+                        bytes.push_back(static_cast<char>(value >> 8));
+                        bytes.push_back(static_cast<char>(value & 0xff));
+                    }
+                }
+            }
+        }
+        std::ofstream(path, std::ios::binary).write(bytes.data(), bytes.size());
+
+        vox::VDB vdb(nullptr);
+        vox::import_raw(vdb, path, format);
+        EXPECT_EQ(vdb.size(), dims);
+
+        for (uint32_t z = 0; z < dims.z; ++z) {
+            for (uint32_t y = 0; y < dims.y; ++y) {
+                for (uint32_t x = 0; x < dims.x; ++x) {
+                    uint32_t value = sample(x, y, z);
+                    uint8_t expected;
+                    if (bits == 8) {
+                        expected = static_cast<uint8_t>(value % 256);
+                    } else if (value < 1000) {
+                        expected = 0;
+                    } else {
+                        uint32_t clamped = std::clamp(value, 1500u, 3500u);
+                        expected = static_cast<uint8_t>(1 + std::lround((clamped - 1500) * 0.127));
+                    }
+                    ASSERT_EQ(vdb.get_voxel({x, y, z}), expected) << x << " " << y << " " << z;
+                }
+            }
+        }
+
+        // the file has to hold every sample
+        bytes.pop_back();
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size());
+        EXPECT_THROW(vox::import_raw(vdb, path, format), std::runtime_error);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(TestImporters, RawBenchmark) {
+    constexpr uint32_t kSize = 256;
+
+    auto path = (std::filesystem::temp_directory_path() / "spor_benchmark.raw").string();
+    {
+        auto sampler = sphere_sampler(vox::VDB::coord_t(kSize / 2), 105.f);
+        std::vector<char> slice(kSize * kSize);
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        for (uint32_t z = 0; z < kSize; ++z) {
+            for (uint32_t y = 0; y < kSize; ++y) {
+                for (uint32_t x = 0; x < kSize; ++x) {
+                    slice[x + y * kSize] = sampler({x, y, z});
+                }
+            }
+            file.write(slice.data(), slice.size());
+        }
+    }
+
+    vox::RawVolumeFormat format;
+    format.dims = vox::VDB::coord_t(kSize);
+
+    vox::VDB vdb(nullptr);
+    double import_ms = time_ms([&]() { vox::import_raw(vdb, path, format); });
+    EXPECT_EQ(vdb.get_voxel({128, 128, 128}), 1);
+
+    bench_log() << kSize << "^3 8-bit raw volume: "
+                << kSize * kSize * kSize / import_ms * 1e3 / (1024 * 1024) << " MiB/s"
+                << std::endl;
+
+    std::filesystem::remove(path);
+}
+
+namespace {
+
+// Writes a .vox file chunk by chunk
+class VoxWriter {
+public:
+    void i32(int32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            bytes_.push_back(static_cast<char>((static_cast<uint32_t>(value) >> (8 * i)) & 0xff));
+        }
+    }
+
+    void string(const std::string& value) {
+        i32(static_cast<int32_t>(value.size()));
+        bytes_.insert(bytes_.end(), value.begin(), value.end());
+    }
+
+    void dict(const std::vector<std::pair<std::string, std::string>>& pairs) {
+        i32(static_cast<int32_t>(pairs.size()));
+        for (const auto& [key, value] : pairs) {
+            string(key);
+            string(value);
+        }
+    }
+
+    // a chunk without children whose content `write` appends
+    template <typename Write> void chunk(const std::string& id, Write&& write) {
+        bytes_.insert(bytes_.end(), id.begin(), id.end());
+        size_t sizes = bytes_.size();
+        i32(0);
+        i32(0);
+        write();
+        int32_t content = static_cast<int32_t>(bytes_.size() - sizes - 8);
+        std::memcpy(bytes_.data() + sizes, &content, sizeof(content));
+    }
+
+    void model(glm::ivec3 size, const std::vector<std::array<uint8_t, 4>>& voxels) {
+        chunk("SIZE", [&]() {
+            i32(size.x);
+            i32(size.y);
+            i32(size.z);
+        });
+        chunk("XYZI", [&]() {
+            i32(static_cast<int32_t>(voxels.size()));
+            for (const auto& voxel : voxels) {
+                bytes_.insert(bytes_.end(), voxel.begin(), voxel.end());
+            }
+        });
+    }
+
+    void save(const std::string& path) const {
+        std::vector<char> file{'V', 'O', 'X', ' '};
+        auto append_i32 = [&file](int32_t value) {
+            file.insert(file.end(), reinterpret_cast<const char*>(&value),
+                        reinterpret_cast<const char*>(&value) + sizeof(value));
+        };
+        append_i32(150);
+        file.insert(file.end(), {'M', 'A', 'I', 'N'});
+        append_i32(0);
+        append_i32(static_cast<int32_t>(bytes_.size()));
+        file.insert(file.end(), bytes_.begin(), bytes_.end());
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(file.data(), file.size());
+    }
+
+private:
+    std::vector<char> bytes_;
+};
+
+}  // namespace
+
+TEST(TestImporters, VoxScene) {
+    // a 3x4x5 box with a value per voxel and a sparse 2x2x2 model
+    std::vector<std::array<uint8_t, 4>> box, sparse{{0, 0, 0, 200}, {1, 1, 1, 201}};
+    for (uint8_t z = 0; z < 5; ++z) {
+        for (uint8_t y = 0; y < 4; ++y) {
+            for (uint8_t x = 0; x < 3; ++x) {
+                box.push_back({x, y, z, static_cast<uint8_t>(1 + x + 3 * y + 12 * z)});
+            }
+        }
+    }
+
+    VoxWriter writer;
+    writer.model({3, 4, 5}, box);
+    writer.model({2, 2, 2}, sparse);
+
+    auto path = (std::filesystem::temp_directory_path() / "spor_scene.vox").string();
+
+    // without a scene graph both models sit at the origin, the later one winning
+    writer.save(path);
+    vox::VDB vdb(nullptr);
+    EXPECT_EQ(vox::import_vox(vdb, path), glm::ivec3(0));
+    EXPECT_EQ(vdb.size(), vox::VDB::coord_t(3, 4, 5));
+    EXPECT_EQ(vdb.get_voxel({0, 0, 0}), 200);
+    EXPECT_EQ(vdb.get_voxel({1, 1, 1}), 201);
+    EXPECT_EQ(vdb.get_voxel({2, 3, 4}), 60);
+
+    // transform 0 -> group 1 -> transforms 2 and 4 -> shapes 3 and 5, translated by the root too
+    auto transform = [&](int32_t node, int32_t child, const std::string& translation) {
+        writer.chunk("nTRN", [&]() {
+            writer.i32(node);
+            writer.dict({});
+            writer.i32(child);
+            writer.i32(-1);
+            writer.i32(0);
+            writer.i32(1);
+            writer.dict({{"_t", translation}});
+        });
+    };
+    auto shape = [&](int32_t node, int32_t model) {
+        writer.chunk("nSHP", [&]() {
+            writer.i32(node);
+            writer.dict({});
+            writer.i32(1);
+            writer.i32(model);
+            writer.dict({});
+        });
+    };
+    transform(0, 1, "1 1 1");
+    writer.chunk("nGRP", [&]() {
+        writer.i32(1);
+        writer.dict({});
+        writer.i32(2);
+        writer.i32(2);
+        writer.i32(4);
+    });
+    transform(2, 3, "-10 0 4");
+    shape(3, 0);
+    transform(4, 5, "20 -3 0");
+    shape(5, 1);
+    writer.chunk("RGBA", [&]() {
+        for (int i = 0; i < 256; ++i) {
+            writer.i32(-1);
+        }
+    });
+    writer.save(path);
+
+    // models are centered on their translations: the box spans [-10, -7) x [-1, 3) x [3, 8) and
+    // the sparse model [20, 22) x [-3, -1) x [0, 2)
+    auto origin = vox::import_vox(vdb, path);
+    EXPECT_EQ(origin, glm::ivec3(-10, -3, 0));
+    EXPECT_EQ(vdb.size(), vox::VDB::coord_t(32, 6, 8));
+
+    size_t active = 0;
+    for (const auto& voxel : vdb.active_voxels()) {
+        (void)voxel;
+        ++active;
+    }
+    EXPECT_EQ(active, box.size() + sparse.size());
+
+    for (const auto& voxel : box) {
+        glm::ivec3 scene = glm::ivec3(-10, -1, 3) + glm::ivec3(voxel[0], voxel[1], voxel[2]);
+        EXPECT_EQ(vdb.get_voxel(vox::VDB::coord_t(scene - origin)), voxel[3]);
+    }
+    for (const auto& voxel : sparse) {
+        glm::ivec3 scene = glm::ivec3(20, -3, 0) + glm::ivec3(voxel[0], voxel[1], voxel[2]);
+        EXPECT_EQ(vdb.get_voxel(vox::VDB::coord_t(scene - origin)), voxel[3]);
+    }
+
+    // broken files
+    VoxWriter broken;
+    broken.model({2, 2, 2}, {{0, 0, 2, 1}});
+    broken.save(path);
+    EXPECT_THROW(vox::import_vox(vdb, path), std::runtime_error);
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "VOX \x96\0\0\0MAIN";
+    EXPECT_THROW(vox::import_vox(vdb, path), std::runtime_error);
+    EXPECT_THROW(vox::import_vox(vdb, path + ".missing"), std::runtime_error);
+
+    std::filesystem::remove(path);
+}
+
+namespace {
+
+// A closed UV sphere, the poles shared by their rings of triangles
+vox::TriangleMesh make_sphere(glm::vec3 center, float radius, uint32_t stacks, uint32_t slices) {
+    vox::TriangleMesh mesh;
+    mesh.positions.push_back(center + glm::vec3(0.f, 0.f, -radius));
+    for (uint32_t stack = 1; stack < stacks; ++stack) {
+        float theta = glm::pi<float>() * stack / stacks;
+        for (uint32_t slice = 0; slice < slices; ++slice) {
+            float phi = 2.f * glm::pi<float>() * slice / slices;
+            mesh.positions.push_back(center
+                                     + radius
+                                           * glm::vec3(std::sin(theta) * std::cos(phi),
+                                                       std::sin(theta) * std::sin(phi),
+                                                       -std::cos(theta)));
+        }
+    }
+    mesh.positions.push_back(center + glm::vec3(0.f, 0.f, radius));
+
+    auto ring = [&](uint32_t stack, uint32_t slice) {
+        return 1 + (stack - 1) * slices + slice % slices;
+    };
+    const uint32_t top = static_cast<uint32_t>(mesh.positions.size() - 1);
+    for (uint32_t slice = 0; slice < slices; ++slice) {
+        mesh.indices.insert(mesh.indices.end(), {0, ring(1, slice + 1), ring(1, slice)});
+        for (uint32_t stack = 1; stack + 1 < stacks; ++stack) {
+            mesh.indices.insert(mesh.indices.end(), {ring(stack, slice), ring(stack, slice + 1),
+                                                     ring(stack + 1, slice + 1)});
+            mesh.indices.insert(mesh.indices.end(), {ring(stack, slice),
+                                                     ring(stack + 1, slice + 1),
+                                                     ring(stack + 1, slice)});
+        }
+        mesh.indices.insert(mesh.indices.end(),
+                            {ring(stacks - 1, slice), ring(stacks - 1, slice + 1), top});
+    }
+    return mesh;
+}
+
+// The 12 triangles of the box [min, max]
+vox::TriangleMesh make_box(glm::vec3 min, glm::vec3 max) {
+    vox::TriangleMesh mesh;
+    for (uint32_t corner = 0; corner < 8; ++corner) {
+        mesh.positions.emplace_back(corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y,
+                                    corner & 4 ? max.z : min.z);
+    }
+    mesh.indices = {0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4,
+                    2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5};
+    return mesh;
+}
+
+std::vector<uint8_t> to_dense(const vox::VDB& vdb, vox::VDB::coord_t dims) {
+    std::vector<uint8_t> dense(static_cast<size_t>(dims.x) * dims.y * dims.z);
+    vdb.copy_to_dense(vox::VDB::coord_t(0), dims, dense.data());
+    return dense;
+}
+
+}  // namespace
+
+TEST(TestVoxelizer, Box) {
+    const vox::VDB::coord_t dims(20);
+    auto mesh = make_box(glm::vec3(4.f), glm::vec3(12.f));
+
+    // the closed voxel boxes touching a face count, so the faces cover two layers of voxels, and
+    // the diagonals of the faces pass through the centers of the columns
+    auto expected = [](vox::VDB::coord_t pos, bool solid) {
+        auto in = [](uint32_t c, uint32_t lo, uint32_t hi) { return c >= lo && c <= hi; };
+        if (!in(pos.x, 3, 12) || !in(pos.y, 3, 12) || !in(pos.z, 3, 12)) {
+            return false;
+        }
+        return solid || !in(pos.x, 5, 10) || !in(pos.y, 5, 10) || !in(pos.z, 5, 10);
+    };
+
+    for (bool solid : {false, true}) {
+        vox::VoxelizeOptions options;
+        options.value = 7;
+        options.solid = solid;
+
+        vox::VDB vdb(nullptr);
+        vox::voxelize_mesh(vdb, dims, mesh, options);
+
+        auto dense = to_dense(vdb, dims);
+        for (size_t i = 0; i < dense.size(); ++i) {
+            auto pos = vox::VDB::coord_t(i % dims.x, (i / dims.x) % dims.y, i / (dims.x * dims.y));
+            ASSERT_EQ(dense[i], expected(pos, solid) ? 7 : 0)
+                << "solid " << solid << " at " << pos.x << ", " << pos.y << ", " << pos.z;
+        }
+    }
+
+    vox::VDB vdb(nullptr);
+    auto broken = mesh;
+    broken.indices.push_back(8);
+    EXPECT_THROW(vox::voxelize_mesh(vdb, dims, broken), std::invalid_argument);
+    broken.indices.resize(broken.indices.size() + 2, 0);
+    EXPECT_THROW(vox::voxelize_mesh(vdb, dims, broken), std::invalid_argument);
+}
+
+TEST(TestVoxelizer, Sphere) {
+    const vox::VDB::coord_t dims(64);
+    const glm::vec3 center(32.3f, 31.7f, 30.2f);
+    constexpr float kRadius = 20.f;
+
+    // the facets lie at most 0.1 voxels inside of the sphere
+    auto mesh = make_sphere(center, kRadius, 24, 48);
+    constexpr float kFacetDepth = 0.2f;
+
+    for (bool solid : {false, true}) {
+        vox::VoxelizeOptions options;
+        options.solid = solid;
+
+        vox::VDB vdb(nullptr);
+        vox::voxelize_mesh(vdb, dims, mesh, options);
+        auto dense = to_dense(vdb, dims);
+
+        options.num_threads = 4;
+        vox::VDB parallel(nullptr);
+        vox::voxelize_mesh(parallel, dims, mesh, options);
+        EXPECT_EQ(to_dense(parallel, dims), dense);
+
+        // every point of every triangle is in an active voxel
+        for (size_t i = 0; i < mesh.num_triangles(); ++i) {
+            const auto& a = mesh.positions[mesh.indices[3 * i]];
+            const auto& b = mesh.positions[mesh.indices[3 * i + 1]];
+            const auto& c = mesh.positions[mesh.indices[3 * i + 2]];
+            for (int u = 0; u <= 8; ++u) {
+                for (int v = 0; u + v <= 8; ++v) {
+                    glm::vec3 point = a + (b - a) * (u / 8.f) + (c - a) * (v / 8.f);
+                    ASSERT_EQ(vdb.get_voxel(vox::VDB::coord_t(glm::floor(point))), 1);
+                }
+            }
+        }
+
+        // and the active voxels are the ones the surface passes through, or inside of it
+        for (size_t i = 0; i < dense.size(); ++i) {
+            auto pos = vox::VDB::coord_t(i % dims.x, (i / dims.x) % dims.y, i / (dims.x * dims.y));
+            glm::vec3 min(pos), max = min + 1.f;
+            float nearest = glm::distance(center, glm::clamp(center, min, max));
+            float furthest = 0.f;
+            for (int corner = 0; corner < 8; ++corner) {
+                glm::vec3 p(corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y,
+                            corner & 4 ? max.z : min.z);
+                furthest = std::max(furthest, glm::distance(center, p));
+            }
+
+            if (nearest > kRadius + 1e-3f) {
+                ASSERT_EQ(dense[i], 0);
+            } else if (furthest < kRadius - kFacetDepth) {
+                ASSERT_EQ(dense[i], solid ? 1 : 0);
+            }
+        }
+    }
+}
+
+TEST(TestVoxelizer, Benchmark) {
+    constexpr uint32_t kSize = 256;
+    auto mesh = make_sphere(glm::vec3(0.f), 1.f, 256, 512);
+    auto dims = mesh.fit_to(kSize);
+    EXPECT_EQ(dims, vox::VDB::coord_t(kSize));
+
+    for (bool solid : {false, true}) {
+        vox::VoxelizeOptions options;
+        options.solid = solid;
+        options.num_threads = 0;
+
+        vox::VDB vdb(nullptr);
+        double voxelize_ms = time_ms([&]() { vox::voxelize_mesh(vdb, dims, mesh, options); });
+        EXPECT_EQ(vdb.get_voxel(dims / 2u), solid ? 1 : 0);
+
+        bench_log() << mesh.num_triangles() << " triangles into " << kSize << "^3 "
+                    << (solid ? "solid" : "surface") << ": "
+                    << mesh.num_triangles() / voxelize_ms / 1e3 << " M triangles/s" << std::endl;
+    }
+}
+
+TEST(TestStats, Counts) {
+    if (!kDefaultNodeConfig) {
+        GTEST_SKIP() << "counts are worked out for 4^3 nodes";
+    }
+
+    // half of a 16^3 volume full, the leaves there turning into tiles, and one more voxel
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(16), [](vox::VDB::coord_t pos) -> uint8_t {
+        return pos.x < 8 ? 1 : pos == vox::VDB::coord_t(12, 0, 0) ? 2 : 0;
+    });
+    ASSERT_EQ(vdb.height(), 2);
+
+    auto stats = vdb.stats();
+    EXPECT_EQ(stats.height, 2);
+    EXPECT_EQ(stats.size, vox::VDB::coord_t(16));
+    ASSERT_EQ(stats.levels.size(), 3);
+
+    EXPECT_EQ(stats.levels[2].nodes, 1);
+    EXPECT_EQ(stats.levels[2].tiles, 0);
+    EXPECT_EQ(stats.levels[2].child_slots, 64);
+    EXPECT_EQ(stats.levels[2].empty_slots, 31);
+    EXPECT_EQ(stats.levels[2].node_bytes, sizeof(vox::SVNode));
+
+    EXPECT_EQ(stats.levels[1].nodes, 33);
+    EXPECT_EQ(stats.levels[1].tiles, 32);
+    EXPECT_EQ(stats.levels[1].child_slots, 64);
+    EXPECT_EQ(stats.levels[1].empty_slots, 63);
+    EXPECT_EQ(stats.levels[1].node_bytes, 33 * sizeof(vox::SVNode));
+    EXPECT_EQ(stats.levels[1].voxel_bytes, 1);
+    EXPECT_EQ(stats.levels[1].references, 33);
+
+    EXPECT_EQ(stats.nodes(), 34);
+    EXPECT_EQ(stats.tiles(), 32);
+    EXPECT_EQ(stats.active_voxels, 8 * 16 * 16 + 1);
+    EXPECT_EQ(stats.leaf_occupancy[1], 1);
+    EXPECT_EQ(std::accumulate(stats.leaf_occupancy.begin(), stats.leaf_occupancy.end(), 0ull),
+              1);
+    EXPECT_DOUBLE_EQ(stats.tile_ratio(), 32.0 / 34.0);
+    EXPECT_DOUBLE_EQ(stats.empty_ratio(), 94.0 / 128.0);
+    EXPECT_EQ(stats.host_bytes, 34 * sizeof(vox::SVNode) + 1);
+    EXPECT_EQ(stats.device_bytes, 0);
+
+    auto json = stats.to_json();
+    EXPECT_NE(json.find("\"active_voxels\": 2049"), std::string::npos);
+    EXPECT_NE(json.find("{\"level\": 1, \"nodes\": 33, \"tiles\": 32"), std::string::npos);
+    EXPECT_NE(json.find("\"leaf_occupancy\": [0, 1, 0"), std::string::npos);
+    EXPECT_EQ(json.front(), '{');
+    EXPECT_EQ(json.back(), '}');
+
+    vox::VDB empty(nullptr);
+    EXPECT_EQ(empty.stats().nodes(), 0);
+    EXPECT_EQ(empty.stats().tile_ratio(), 0.0);
+    EXPECT_EQ(empty.stats().to_json().front(), '{');
+}
+
+TEST(TestStats, MatchesIterators) {
+    vox::VDB vdb(nullptr);
+    vdb.build_from(vox::VDB::coord_t(96), [](vox::VDB::coord_t pos) -> uint8_t {
+        float dist = glm::distance(glm::vec3(pos), glm::vec3(48.f));
+        return dist < 40.f ? static_cast<uint8_t>(dist) % 3 + 1 : 0;
+    });
+
+    // iterators see shared nodes once per reference, so only a tree that isn't deduplicated
+    // stores what they visit
+    auto check = [](const vox::VDB& vdb, bool shared) {
+        auto stats = vdb.stats();
+        for (size_t level = 1; level <= vdb.height(); ++level) {
+            uint64_t nodes = 0, tiles = 0;
+            for (const auto& node : vdb.nodes(level)) {
+                ++nodes;
+                tiles += vox::detail::is_tile(node.node);
+            }
+            EXPECT_EQ(stats.levels[level].references, nodes);
+            if (!shared) {
+                EXPECT_EQ(stats.levels[level].nodes, nodes);
+                EXPECT_EQ(stats.levels[level].tiles, tiles);
+            }
+        }
+
+        uint64_t active = 0;
+        std::array<uint64_t, vox::detail::kLeafVoxels + 1> occupancy{};
+        for (const auto& voxel : vdb.active_voxels()) {
+            (void)voxel;
+            ++active;
+        }
+        for (const auto& leaf : vdb.leaves()) {
+            if (leaf.level == 1 && !vox::detail::is_tile(leaf.node)) {
+                ++occupancy[std::bitset<64>(leaf.node.child_mask).count()];
+            }
+        }
+        EXPECT_EQ(stats.active_voxels, active);
+        if (!shared) {
+            EXPECT_EQ(stats.leaf_occupancy, occupancy);
+        }
+        return stats;
+    };
+
+    auto bytes = check(vdb, false);
+    EXPECT_EQ(bytes.encoding, vox::VoxelEncoding::kBytes);
+
+    // the same topology, in fewer bytes
+    vdb.encode_voxels(vox::VoxelEncoding::kPalette);
+    auto palette = check(vdb, false);
+    EXPECT_EQ(palette.encoding, vox::VoxelEncoding::kPalette);
+    EXPECT_EQ(palette.nodes(), bytes.nodes());
+    EXPECT_LT(palette.levels[1].voxel_bytes, bytes.levels[1].voxel_bytes);
+    EXPECT_NE(palette.to_json().find("\"encoding\": \"palette\""), std::string::npos);
+
+    // shared arrays are held once and counted once, adding up to what the host arrays hold
+    vdb.deduplicate();
+    auto shared = check(vdb, true);
+    EXPECT_LT(shared.nodes(), palette.nodes());
+    EXPECT_EQ(shared.active_voxels, palette.active_voxels);
+
+    uint64_t held = 0;
+    for (const auto& level : shared.levels) {
+        held += level.node_bytes + level.voxel_bytes;
+    }
+    EXPECT_EQ(held, shared.host_bytes);
+}
+
+TEST(TestNodeConfig, Levels) {
+    using Config = vox::NodeConfig<2, 2, 1>;
+
+    static_assert(Config::kMaxChildren == 64);
+
+    EXPECT_EQ(Config::dim(1), 4);
+    EXPECT_EQ(Config::dim(2), 4);
+    EXPECT_EQ(Config::dim(3), 2);
+    EXPECT_EQ(Config::dim(7), 2);
+
+    EXPECT_EQ(Config::num_children(1), 64);
+    EXPECT_EQ(Config::num_children(3), 8);
+
+    EXPECT_EQ(Config::log2_extent(0), 0);
+    EXPECT_EQ(Config::log2_extent(1), 2);
+    EXPECT_EQ(Config::log2_extent(2), 4);
+    EXPECT_EQ(Config::log2_extent(4), 6);
+
+    static_assert(vox::NodeConfig<1>::kMaxChildren == 8);
+    static_assert(vox::NodeConfig<1>::log2_extent(5) == 5);
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
 
@@ -5,6 +5,7 @@
 #include "vkh/buffer_objects.h"
 #include "vkh/render_objects.h"
 #include "vkh/compute.h"
+#include "voxel/cpu_tracer.h"
 #include "voxel/vdb.h"
 
 namespace spor {
@@ -77,6 +78,11 @@ private:
 
     vk::DescriptorLayout::ptr full_desc_layout_;
     vk::DescriptorSet full_desc_;
+
+    // frames are traced on the host and uploaded when the device can't run sv_trace.comp
+    bool cpu_fallback_ = false;
+    vk::Buffer::ptr staging_;
+    std::unique_ptr<vk::PersistentMapping<uint8_t>> staging_mapping_;
 };
 
 }  // namespace spor
\ No newline at end of file
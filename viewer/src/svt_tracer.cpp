@@ -2,12 +2,15 @@
 
 #include <array>
 #include <cstddef>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
 
 #include "shaders/sv_trace.comp.inl"
 #include "tiny_obj_loader.h"
 #include "viewer/image_loader.h"
 #include "vkh/glm_decl.h"
+#include "voxel/voxelizer.h"
 
 namespace spor {
 
@@ -31,7 +34,24 @@ void SvtTracerScene::setup() {
     sampler_ = vk::Sampler::create(surface_device_);
 
     vdb_ = std::make_unique<vox::VDB>(surface_device_);
-    {
+
+    // SPOR_VDB_CACHE names a file the volume is loaded from, or saved to after building it
+    const char* cache_path = std::getenv("SPOR_VDB_CACHE");
+    if (cache_path && std::filesystem::exists(cache_path)) {
+        vdb_->load(cache_path);
+    } else if (const char* obj_path = std::getenv("SPOR_OBJ")) {
+        // SPOR_OBJ names a model voxelized into the volume in place of the sphere
+        auto mesh = vox::TriangleMesh::from_obj(obj_path);
+        auto dims = mesh.fit_to(256);
+
+        vox::VoxelizeOptions options;
+        options.solid = true;
+        options.num_threads = 0;  // use all cores
+        vox::voxelize_mesh(*vdb_, dims, mesh, options);
+        if (cache_path) {
+            vdb_->save(cache_path);
+        }
+    } else {
         constexpr size_t kRadius = 105.f;
         constexpr size_t kSize = 256;
 
@@ -46,10 +66,45 @@ void SvtTracerScene::setup() {
             }
         };
 
-        vdb_->build_from(vox::VDB::coord_t(kSize), sampler);
-        vdb_->move_to_device(cmd_pool_);
+        vox::BuildOptions options;
+        options.num_threads = 0;  // use all cores
+        options.classify_region = [center, kRadius](glm::uvec3 min, glm::uvec3 max) {
+            // distances to the closest and furthest voxel of the box decide its value range
+            auto nearest = glm::clamp(center, min, max - 1u);
+            auto furthest = glm::mix(min, max - 1u, glm::lessThanEqual(center * 2u, min + max - 1u));
+
+            int near_dist = static_cast<int>(glm::distance(glm::vec3(center), glm::vec3(nearest)));
+            int far_dist = static_cast<int>(glm::distance(glm::vec3(center), glm::vec3(furthest)));
+
+            if (near_dist > kRadius) {
+                return vox::Region{vox::Region::Kind::kEmpty};
+            } else if (near_dist == far_dist) {
+                return vox::Region{vox::Region::Kind::kUniform, static_cast<uint8_t>(near_dist + 1)};
+            }
+
+            return vox::Region{vox::Region::Kind::kMixed};
+        };
+
+        vdb_->build_from(vox::VDB::coord_t(kSize), sampler, options);
+        if (cache_path) {
+            vdb_->save(cache_path);
+        }
+    }
+
+    // sv_trace.comp reads the 64-bit child masks, SPOR_CPU_TRACER forces the host path for testing
+    cpu_fallback_ = !surface_device_->capabilities.device_features.shaderInt64
+                    || std::getenv("SPOR_CPU_TRACER") != nullptr;
+    if (cpu_fallback_) {
+        std::cout << "Tracing on the CPU" << std::endl;
+
+        staging_ = vk::Buffer::create(surface_device_, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                      swap_chain_->extent.width * swap_chain_->extent.height, 4);
+        staging_mapping_ = std::make_unique<vk::PersistentMapping<uint8_t>>(staging_);
+        return;
     }
 
+    vdb_->move_to_device(cmd_pool_);
+
     trace_func_ = vk::Kernel::create(
         surface_device_, shaders::sv_trace::comp,
         {vk::Kernel::ParamType::kUBO, vk::Kernel::ParamType::kSSBO, vk::Kernel::ParamType::kSSBO,
@@ -103,14 +158,29 @@ vk::Semaphore::ptr SvtTracerScene::render(uint32_t framebuffer_index,
         vk::transition_image(cmd_buffer, depth_buffer_->image_view(), VK_IMAGE_LAYOUT_UNDEFINED,
                              VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
-        size_t x_ts = swap_chain_->extent.width / 16 + (swap_chain_->extent.width % 16 > 0 ? 1 : 0);
-        size_t y_ts
-            = swap_chain_->extent.height / 16 + (swap_chain_->extent.height % 16 > 0 ? 1 : 0);
-
-        trace_func_->invoke(cmd_buffer, full_desc_, glm::u64vec3(x_ts, y_ts, 1));
-
-        vk::transition_image(cmd_buffer, draw_image_->image_view(), VK_IMAGE_LAYOUT_GENERAL,
-                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        if (cpu_fallback_) {
+            const auto& ubo = (*tracer_ubo_mapping_)[0];
+            vox::trace_image(*vdb_, vox::TracerCamera{ubo.inv_vp, ubo.inv_m, ubo.camera_pos},
+                             swap_chain_->extent.width, swap_chain_->extent.height,
+                             staging_mapping_->mapped_mem);
+
+            vk::transition_image(cmd_buffer, draw_image_->image_view(), VK_IMAGE_LAYOUT_GENERAL,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+            vk::copy_buffer_to_image(cmd_buffer, staging_, draw_image_->image_view());
+            vk::transition_image(cmd_buffer, draw_image_->image_view(),
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        } else {
+            size_t x_ts
+                = swap_chain_->extent.width / 16 + (swap_chain_->extent.width % 16 > 0 ? 1 : 0);
+            size_t y_ts
+                = swap_chain_->extent.height / 16 + (swap_chain_->extent.height % 16 > 0 ? 1 : 0);
+
+            trace_func_->invoke(cmd_buffer, full_desc_, glm::u64vec3(x_ts, y_ts, 1));
+
+            vk::transition_image(cmd_buffer, draw_image_->image_view(), VK_IMAGE_LAYOUT_GENERAL,
+                                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        }
         vk::transition_image(cmd_buffer, swap_chain_->image_view(framebuffer_index),
                              VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
@@ -72,6 +72,16 @@ Buffer::ptr create_and_fill_transfer_buffer(SurfaceDevice::ptr surface_device,
 CommandBuffer::ptr buffer_memcpy(SurfaceDevice::ptr device, CommandPool::ptr pool, Buffer::ptr src,
                                  Buffer::ptr dst, size_t size);
 
+struct BufferCopyRegions {
+    Buffer::ptr dst;
+    std::vector<VkBufferCopy> regions;
+};
+
+// Record one vkCmdCopyBuffer from `src` per destination, each with all of its regions
+CommandBuffer::ptr buffer_copy_regions(SurfaceDevice::ptr device, CommandPool::ptr pool,
+                                       Buffer::ptr src,
+                                       const std::vector<BufferCopyRegions>& copies);
+
 void submit_commands(CommandBuffer::ptr cmd_buffer, VkQueue queue, bool block = true);
 
 template <typename T> class PersistentMapping : public helpers::NonCopyable {
@@ -178,6 +188,10 @@ CommandBuffer::ptr transition_texture(SurfaceDevice::ptr device, CommandPool::pt
 CommandBuffer::ptr texture_memcpy(SurfaceDevice::ptr device, CommandPool::ptr pool, Buffer::ptr src,
                                   Texture::ptr dst);
 
+// Record a copy of the tightly packed pixels in `src` to the whole of `dst`, which has to be in
+// VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+void copy_buffer_to_image(CommandBuffer::ptr cmd, Buffer::ptr src, const helpers::ImageView& dst);
+
 class Sampler : public helpers::VulkanObject<Sampler> {
 public:
     ~Sampler();
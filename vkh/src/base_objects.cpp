@@ -127,6 +127,8 @@ SurfaceDevice::ptr SurfaceDevice::create(Instance::ptr inst, std::shared_ptr<Win
     }
 
     VkPhysicalDeviceFeatures features{};
+    // the voxel tracer reads 64-bit child masks, scenes fall back to the host without it
+    features.shaderInt64 = device_capabilities.device_features.shaderInt64;
 
     VkPhysicalDeviceVulkan13Features features_13{};
     features_13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
@@ -33,12 +33,13 @@ Buffer::ptr Buffer::create(SurfaceDevice::ptr surface_device, VkBufferUsageFlags
     VkMemoryPropertyFlags props;
     if ((usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) || (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT)) {
         props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    } else if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+        // before TRANSFER_SRC, storage buffers that are also copied from on the device stay local
+        props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     } else if (usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) {
         props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     } else if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
         props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    } else if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
-        props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     } else {
         props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     }
@@ -125,6 +126,29 @@ CommandBuffer::ptr buffer_memcpy(SurfaceDevice::ptr device, CommandPool::ptr poo
     return cmd_buffer;
 }
 
+CommandBuffer::ptr buffer_copy_regions(SurfaceDevice::ptr device, CommandPool::ptr pool,
+                                       Buffer::ptr src,
+                                       const std::vector<BufferCopyRegions>& copies) {
+    auto cmd_buffer = CommandBuffer::create(device, pool);
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(cmd_buffer->command_buffer, &begin_info);
+
+    for (const auto& copy : copies) {
+        if (!copy.regions.empty()) {
+            vkCmdCopyBuffer(cmd_buffer->command_buffer, src->buffer, copy.dst->buffer,
+                            static_cast<uint32_t>(copy.regions.size()), copy.regions.data());
+        }
+    }
+
+    vkEndCommandBuffer(cmd_buffer->command_buffer);
+
+    return cmd_buffer;
+}
+
 void submit_commands(CommandBuffer::ptr cmd_buffer, VkQueue queue, bool block) {
     VkSubmitInfo submit_info{};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -170,7 +194,9 @@ DrawImage::ptr DrawImage::create(SurfaceDevice::ptr surface_device, size_t width
 
     auto [image, memory] = helpers::create_image(
         surface_device->device, surface_device->physical_device, width, height, format,
-        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+                                    | VK_IMAGE_USAGE_TRANSFER_DST_BIT
+                                    | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     auto view
@@ -266,6 +292,24 @@ CommandBuffer::ptr texture_memcpy(SurfaceDevice::ptr device, CommandPool::ptr po
     return cmd_buffer;
 }
 
+void copy_buffer_to_image(CommandBuffer::ptr cmd, Buffer::ptr src, const helpers::ImageView& dst) {
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {static_cast<uint32_t>(dst.w), static_cast<uint32_t>(dst.h), 1};
+
+    vkCmdCopyBufferToImage(cmd->command_buffer, src->buffer, dst.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+}
+
 Sampler::~Sampler() { vkDestroySampler(*surface_device_, sampler, nullptr); }
 
 Sampler::ptr Sampler::create(SurfaceDevice::ptr surface_device, VkFilter filter,
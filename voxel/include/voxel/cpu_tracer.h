@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "voxel/vdb.h"
+
+namespace spor::vox {
+
+// The camera of a frame, the parts of the viewer's TracerUBO that sv_trace.comp reads
+struct TracerCamera {
+    glm::mat4 inv_vp;      // inverse of projection * view, the view without its translation
+    glm::mat4 inv_m;       // inverse of the volume's model matrix
+    glm::vec3 camera_pos;  // world space
+};
+
+// Pixels are traced in square tiles like the shader's workgroups, each tile by a single thread
+constexpr uint32_t kTracerTileSize = 16;
+
+// Render `vdb` on the host with the algorithm of res/shaders/sv_trace.comp: the same primary rays,
+// voxel DDA, step limit and shading, so the image matches what the shader writes up to float
+// rounding. Serves as a fallback where there is no GPU to run the shader on and as a reference to
+// check it against. `out` receives width * height RGBA8 pixels row by row, pixel (x, y) being the
+// one the shader writes to ivec2(x, y). Tiles are spread over `num_threads` threads, 0 picks the
+// hardware concurrency.
+void trace_image(const VDB& vdb, const TracerCamera& camera, uint32_t width, uint32_t height,
+                 uint8_t* out, size_t num_threads = 0);
+std::vector<uint8_t> trace_image(const VDB& vdb, const TracerCamera& camera, uint32_t width,
+                                 uint32_t height, size_t num_threads = 0);
+
+}  // namespace spor::vox
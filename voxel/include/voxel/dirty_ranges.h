@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace spor::vox {
+
+// A half-open range of indices into the node or voxel array
+struct IndexRange {
+    size_t begin;
+    size_t end;
+};
+
+// Sort and merge overlapping ranges, and ranges separated by at most `gap` indices
+inline void merge_ranges(std::vector<IndexRange>& ranges, size_t gap = 0) {
+    std::sort(ranges.begin(), ranges.end(),
+              [](const IndexRange& a, const IndexRange& b) { return a.begin < b.begin; });
+
+    size_t merged = 0;
+    for (const auto& range : ranges) {
+        if (range.begin >= range.end) {
+            continue;
+        }
+
+        if (merged > 0 && range.begin <= ranges[merged - 1].end + gap) {
+            ranges[merged - 1].end = std::max(ranges[merged - 1].end, range.end);
+        } else {
+            ranges[merged++] = range;
+        }
+    }
+    ranges.resize(merged);
+}
+
+// The parts of a host array that changed since it was last copied to the device
+class DirtyRanges {
+public:
+    void add(IndexRange range) {
+        if (!all_ && range.begin < range.end) {
+            ranges_.push_back(range);
+        }
+    }
+
+    void add(const std::vector<IndexRange>& ranges) {
+        for (const auto& range : ranges) {
+            add(range);
+        }
+    }
+
+    // The whole array changed, e.g. after a rebuild
+    void mark_all() {
+        all_ = true;
+        ranges_.clear();
+    }
+
+    bool all() const { return all_; }
+    bool empty() const { return !all_ && ranges_.empty(); }
+
+    // The dirty ranges of an array of `size` elements, clipped to it, sorted and merged across
+    // gaps of up to `gap` elements
+    std::vector<IndexRange> merged(size_t size, size_t gap = 0) const {
+        if (all_) {
+            return size > 0 ? std::vector<IndexRange>{{0, size}} : std::vector<IndexRange>{};
+        }
+
+        std::vector<IndexRange> ranges;
+        ranges.reserve(ranges_.size());
+        for (const auto& range : ranges_) {
+            ranges.push_back({range.begin, std::min(range.end, size)});
+        }
+        merge_ranges(ranges, gap);
+        return ranges;
+    }
+
+    void clear() {
+        all_ = false;
+        ranges_.clear();
+    }
+
+private:
+    bool all_{false};
+    std::vector<IndexRange> ranges_;
+};
+
+}  // namespace spor::vox
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "voxel/vdb.h"
+
+namespace spor::vox {
+
+// Layout of a raw dense volume file, samples stored x-major without padding, and how its samples
+// become voxel values
+struct RawVolumeFormat {
+    VDB::coord_t dims{0};
+    uint32_t bits{8};          // unsigned samples of 8 or 16 bits
+    bool big_endian{false};    // byte order of 16-bit samples
+    uint64_t header_bytes{0};  // skipped at the start of the file
+
+    // Samples below `threshold` are empty, the others are mapped linearly from [range_min,
+    // range_max] to [1, 255], clamped to that range first. The defaults keep 8-bit samples as they
+    // are.
+    uint32_t threshold{1};
+    uint32_t range_min{1};
+    uint32_t range_max{255};
+};
+
+// Build `vdb` from a raw volume file, read one slab at a time through VDB::build_from_dense so
+// that only a slab of it is ever held in memory. Throws std::runtime_error if the file can't be
+// read or is smaller than its dimensions, std::invalid_argument for an invalid format.
+void import_raw(VDB& vdb, const std::string& path, const RawVolumeFormat& format);
+
+// Build `vdb` from a MagicaVoxel .vox file. Voxel values are the palette indices. Models are
+// placed at the translations of the scene graph's transform nodes, centered like MagicaVoxel does,
+// rotations are not applied. Where models overlap, `options.duplicates` picks the value, so with
+// the default kLastWins the model placed later in the scene graph wins. The scene is shifted into
+// the positive octant, the position of voxel 0 in scene coordinates is returned. The file is read
+// chunk by chunk and the models' voxels turned straight into points for
+// VDB::build_from_points, so memory follows the number of voxels, not the volume they span.
+// Throws std::runtime_error if the file is not a valid .vox file.
+glm::ivec3 import_vox(VDB& vdb, const std::string& path, const BuildOptions& options = {});
+
+}  // namespace spor::vox
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace spor::vox {
+
+// How the active voxels of a leaf are stored, starting at the leaf's child_offset
+enum class VoxelEncoding : uint32_t {
+    kBytes = 0,  // one byte per active voxel
+    // A header byte holding the palette size n, the n palette entries, then one palette index per
+    // active voxel packed LSB first with palette_bits(n) bits each. n == 0 marks a leaf whose
+    // voxels are stored as plain bytes after the header, for leaves with too many distinct values.
+    kPalette = 1,
+};
+
+namespace palette {
+
+constexpr size_t kMaxSize = 16;
+
+// Bits per index for a palette of `size` entries, 0 when every voxel has the same value
+constexpr size_t index_bits(size_t size) {
+    return size <= 1 ? 0 : size <= 2 ? 1 : size <= 4 ? 2 : 4;
+}
+
+// Encoded size of a leaf holding `count` active voxels in the leaf at `data`
+inline size_t leaf_size(const uint8_t* data, size_t count) {
+    size_t size = data[0];
+    return size == 0 ? 1 + count : 1 + size + (count * index_bits(size) + 7) / 8;
+}
+
+// Append the encoding of `count` active voxels to `out`
+inline void encode_leaf(const uint8_t* voxels, size_t count, std::vector<uint8_t>& out) {
+    uint8_t entries[kMaxSize];
+    size_t size = 0;
+    for (size_t i = 0; i < count && size <= kMaxSize; ++i) {
+        size_t j = 0;
+        while (j < size && entries[j] != voxels[i]) {
+            ++j;
+        }
+        if (j == size && size++ < kMaxSize) {
+            entries[j] = voxels[i];
+        }
+    }
+
+    size_t bits = index_bits(size);
+    size_t packed = 1 + size + (count * bits + 7) / 8;
+    if (size > kMaxSize || packed >= 1 + count) {
+        out.push_back(0);
+        out.insert(out.end(), voxels, voxels + count);
+        return;
+    }
+
+    out.push_back(static_cast<uint8_t>(size));
+    out.insert(out.end(), entries, entries + size);
+
+    size_t begin = out.size();
+    out.resize(begin + (count * bits + 7) / 8, 0);
+    for (size_t i = 0; bits > 0 && i < count; ++i) {
+        size_t index = 0;
+        while (entries[index] != voxels[i]) {
+            ++index;
+        }
+        out[begin + i * bits / 8] |= static_cast<uint8_t>(index << (i * bits % 8));
+    }
+}
+
+// Value of the `index`th active voxel of a leaf whose ith byte is `byte(i)`, for leaves that are
+// not stored contiguously
+template <typename ByteAt> uint8_t decode_leaf_at(const ByteAt& byte, size_t index) {
+    size_t size = byte(0);
+    if (size == 0) {
+        return byte(1 + index);
+    }
+
+    size_t bits = index_bits(size);
+    if (bits == 0) {
+        return byte(1);
+    }
+
+    size_t packed = byte(1 + size + index * bits / 8);
+    return byte(1 + ((packed >> (index * bits % 8)) & ((1u << bits) - 1)));
+}
+
+// Value of the `index`th active voxel of the leaf at `data`
+inline uint8_t decode_leaf(const uint8_t* data, size_t index) {
+    return decode_leaf_at([data](size_t i) { return data[i]; }, index);
+}
+
+}  // namespace palette
+
+}  // namespace spor::vox
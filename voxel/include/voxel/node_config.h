@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Comma separated Log2Dims of the NodeConfig the VDB is built with, see NodeConfig. Set through the
+// SPOR_VDB_NODE_LOG2_DIMS CMake cache variable, which also compiles the matching shader variant.
+#ifndef SPOR_VDB_NODE_LOG2_DIMS
+#    define SPOR_VDB_NODE_LOG2_DIMS 2
+#endif
+
+namespace spor::vox {
+
+// Compile-time branching of a VDB tree. Log2Dims[i] is the log2 of the number of children along
+// each axis of the nodes at level i + 1, level 1 being the leaves. Levels above the last entry
+// repeat it, e.g. NodeConfig<2, 2, 1> has 4^3 leaves, 4^3 nodes above them and 2^3 nodes above
+// those. SVNode::child_mask has room for 64 children, so every entry has to be 1 or 2.
+template <uint32_t... Log2Dims> struct NodeConfig {
+    static_assert(sizeof...(Log2Dims) > 0, "NodeConfig needs at least one level");
+    static_assert(((Log2Dims >= 1 && Log2Dims <= 2) && ...),
+                  "SVNode::child_mask only has room for 2^3 or 4^3 children");
+
+    static constexpr std::array<uint32_t, sizeof...(Log2Dims)> kLog2Dims{Log2Dims...};
+
+    static constexpr size_t kMaxChildren = size_t(1) << (3 * std::max({Log2Dims...}));
+
+    static constexpr uint32_t log2_dim(size_t level) {
+        return kLog2Dims[std::min(level, kLog2Dims.size()) - 1];
+    }
+
+    // Children along each axis of a node at `level` (>= 1)
+    static constexpr uint32_t dim(size_t level) { return 1u << log2_dim(level); }
+
+    static constexpr size_t num_children(size_t level) {
+        return size_t(1) << (3 * log2_dim(level));
+    }
+
+    // Log2 of the voxels along each axis covered by a node at `level`, 0 for a single voxel
+    static constexpr uint32_t log2_extent(size_t level) {
+        uint32_t sum = 0;
+        for (size_t l = 1; l <= level; ++l) {
+            sum += log2_dim(l);
+        }
+        return sum;
+    }
+};
+
+using DefaultNodeConfig = NodeConfig<SPOR_VDB_NODE_LOG2_DIMS>;
+
+}  // namespace spor::vox
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "voxel/vdb.h"
+
+namespace spor::vox {
+
+// Residency counters of a PagedVDB, see PagedVDB::stats()
+struct PagingStats {
+    uint64_t hits{0};       // page lookups served from the cache
+    uint64_t misses{0};     // page lookups that read the page from the file
+    uint64_t evictions{0};  // pages dropped to stay within the budget
+    size_t resident_pages{0};
+    size_t resident_bytes{0};
+};
+
+// A read-only VDB too large to be held in memory, kept out of core in a file written by write().
+//
+// The tree is cut at a page level: the nodes above it stay resident, while each subtree rooted at
+// that level is a page, read from the file the first time a lookup, raycast or iteration needs
+// it. Pages stay cached, least recently used ones being evicted once the cached pages take more
+// than the byte budget. A page is held as a VDB of its own, so it is looked up and traced like
+// any other tree. All members are thread-safe: pages in use stay alive until their users are done
+// with them, even if the cache evicts them meanwhile.
+class PagedVDB {
+public:
+    using coord_t = VDB::coord_t;
+
+    // Write `vdb` to `path`, every subtree rooted at `page_level` (1 <= page_level < height) as a
+    // page. Tiles at or above the page level stay resident and take no page.
+    static void write(const VDB& vdb, const std::string& path, size_t page_level);
+
+    // Open a file written by write(). Throws std::runtime_error if it is not a valid file for this
+    // NodeConfig.
+    PagedVDB(const std::string& path, size_t budget_bytes);
+
+    PagedVDB(const PagedVDB&) = delete;
+    PagedVDB& operator=(const PagedVDB&) = delete;
+
+public:
+    // Same as VDB::get_voxel
+    uint8_t get_voxel(coord_t pos) const;
+
+    // Same as VDB::raycast. The ray is stepped through the page grid one page at a time and only
+    // the pages it crosses that are not empty or tiles are paged in and traced.
+    std::optional<RayHit> raycast(glm::vec3 origin, glm::vec3 dir,
+                                  float tmax = std::numeric_limits<float>::infinity()) const;
+
+    // Same as VDB::for_each_leaf, on the calling thread and paging in every page in turn
+    void for_each_leaf(const std::function<void(const NodeRef&)>& fn) const;
+
+    // Page in every page intersecting [min, max), e.g. the region a camera is about to enter. Only
+    // the most recently prefetched pages remain if they don't all fit the budget. Can be called
+    // from a background thread to warm the cache while the pages already resident are used.
+    void prefetch(coord_t min, coord_t max) const;
+
+    // Same for the pages intersecting the frustum of `mvp`, the matrix taking voxel space to clip
+    // space, e.g. projection * view * model. The pages nearest to the camera are the ones that
+    // remain if they don't all fit.
+    void prefetch(const glm::mat4& mvp) const;
+
+    PagingStats stats() const;
+    void reset_stats();
+
+    size_t height() const { return height_; }
+    coord_t size() const { return size_; }
+    size_t page_level() const { return page_level_; }
+    size_t budget_bytes() const { return budget_bytes_; }
+
+private:
+    // Where a subtree rooted at the page level lives. Tiles have no data in the file.
+    struct PageEntry {
+        SVNode root;
+        uint32_t padding{0};  // written to the file as is, so it must not be left uninitialized
+        uint64_t file_offset{0};
+        uint64_t node_count{0};
+        uint64_t voxel_bytes{0};
+    };
+    static_assert(sizeof(PageEntry) == 40, "PageEntry has unexpected padding");
+
+    // The page level node containing `pos`, nullptr if there is none because `pos` lies in empty
+    // space or a tile above the page level, whose value is then stored to `value`
+    const PageEntry* find_page(coord_t pos, uint8_t& value) const;
+
+    // Call fn(ref, entry) for the tiles above the page level and the page level nodes whose boxes
+    // pass `visit(min, max)`, which also prunes the resident levels. `entry` is the node's page,
+    // nullptr for tiles.
+    void for_each_node(const std::function<bool(coord_t min, coord_t max)>& visit,
+                       const std::function<void(const NodeRef&, const PageEntry*)>& fn) const;
+
+    // The tree of the page whose box starts at `page_min`, read from the file unless it is cached
+    std::shared_ptr<const VDB> acquire(const PageEntry& entry, coord_t page_min) const;
+
+    // Voxels the page's tree covers, clipped to the volume
+    coord_t page_size(coord_t page_min) const;
+
+    size_t height_{0};
+    coord_t size_{0};
+    VoxelEncoding encoding_{VoxelEncoding::kBytes};
+    size_t page_level_{0};
+    size_t budget_bytes_{0};
+
+    // Resident levels above the page level in the usual layout, except that the children of the
+    // nodes right above the page level index pages_
+    std::vector<SVNode> top_nodes_;
+    std::vector<PageEntry> pages_;
+
+    mutable std::mutex file_mutex_;
+    mutable std::ifstream file_;
+
+    // Cached pages by index in pages_, most recently used first
+    struct CachedPage {
+        size_t index;
+        std::shared_ptr<const VDB> tree;
+        size_t bytes;
+    };
+
+    mutable std::mutex cache_mutex_;
+    mutable std::list<CachedPage> lru_;
+    mutable std::unordered_map<size_t, std::list<CachedPage>::iterator> cached_;
+    mutable PagingStats stats_;
+};
+
+}  // namespace spor::vox
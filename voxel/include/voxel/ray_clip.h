@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+
+#include "vkh/glm_decl.h"
+
+namespace spor::vox::detail {
+
+// The normal of the face a ray with `dir` enters a box through on `axis`, 0 for -1
+inline glm::ivec3 face_normal(int axis, glm::vec3 dir) {
+    glm::ivec3 normal(0);
+    if (axis >= 0) {
+        normal[axis] = dir[axis] > 0.f ? -1 : 1;
+    }
+    return normal;
+}
+
+// The part of a ray inside the volume, entered at t_enter through the face on `axis`, -1 if the
+// ray starts inside
+struct RayClip {
+    float t_enter;
+    float t_exit;
+    int axis;
+};
+
+// Clip the ray up to `tmax` against the volume [0, size), nullopt if it misses it. Throws
+// std::invalid_argument for a zero direction.
+inline std::optional<RayClip> clip_ray(glm::vec3 origin, glm::vec3 dir, float tmax,
+                                       glm::uvec3 size) {
+    if (dir == glm::vec3(0.f)) {
+        throw std::invalid_argument("Ray direction must be non-zero");
+    }
+
+    RayClip clip{0.f, tmax, -1};
+    for (int axis = 0; axis < 3; ++axis) {
+        if (dir[axis] == 0.f) {
+            if (origin[axis] < 0.f || origin[axis] >= size[axis]) {
+                return std::nullopt;
+            }
+            continue;
+        }
+
+        float t_low = (0.f - origin[axis]) / dir[axis];
+        float t_high = (size[axis] - origin[axis]) / dir[axis];
+        if (t_low > t_high) {
+            std::swap(t_low, t_high);
+        }
+
+        if (t_low > clip.t_enter) {
+            clip.t_enter = t_low;
+            clip.axis = axis;
+        }
+        clip.t_exit = std::min(clip.t_exit, t_high);
+    }
+
+    if (clip.t_exit <= clip.t_enter) {
+        return std::nullopt;
+    }
+    return clip;
+}
+
+}  // namespace spor::vox::detail
@@ -0,0 +1,148 @@
+#pragma once
+
+// Iteration over the contents of a VDB, included at the end of vdb.h. The iterators walk the
+// child masks of the packed tree, so they visit only active nodes and voxels and never sample
+// empty space. Like VDB::Accessor, they are invalidated by any change to the tree.
+
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace spor::vox {
+
+// A node of a tree together with the box of voxels it covers, which starts at `min` and extends
+// detail::node_extent(level) along each axis
+struct NodeRef {
+    SVNode node;
+    size_t level;
+    VDB::coord_t min;
+};
+
+// Visits nodes of a tree in tree order, the order build_from generates them in. Only nodes down
+// to `stop_level` are entered and only those at it are visited, plus tiles above it if asked for.
+// Nodes below a tile do not exist and are never visited.
+class NodeIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = NodeRef;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const NodeRef*;
+    using reference = const NodeRef&;
+
+    NodeIterator() = default;  // the end
+    NodeIterator(const VDB& vdb, const NodeRef& root, size_t stop_level, bool tiles);
+
+    reference operator*() const { return current_; }
+    pointer operator->() const { return &current_; }
+
+    NodeIterator& operator++() {
+        advance();
+        return *this;
+    }
+
+    NodeIterator operator++(int) {
+        auto copy = *this;
+        advance();
+        return copy;
+    }
+
+    // a node is identified by its level and box, at the end vdb_ is reset
+    bool operator==(const NodeIterator& other) const {
+        if (vdb_ == nullptr || other.vdb_ == nullptr) {
+            return vdb_ == other.vdb_;
+        }
+        return current_.level == other.current_.level && current_.min == other.current_.min;
+    }
+    bool operator!=(const NodeIterator& other) const { return !(*this == other); }
+
+private:
+    // A node being entered, `remaining` are the child bits not visited yet and `next_offset` is
+    // where the first of them is stored
+    struct Frame {
+        NodeRef ref;
+        uint64_t remaining;
+        size_t next_offset;
+    };
+
+    bool visits(const NodeRef& ref) const {
+        return ref.level == stop_level_ || (tiles_ && detail::is_tile(ref.node));
+    }
+
+    void enter(const NodeRef& ref);
+    void advance();
+
+    const VDB* vdb_{nullptr};
+    size_t stop_level_{1};
+    bool tiles_{false};
+
+    std::vector<Frame> stack_;
+    NodeRef current_{};
+};
+
+// Visits every active voxel of a tree in tree order, tiles expanded into each of their voxels
+// inside the volume
+class VoxelIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = VoxelPoint;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const VoxelPoint*;
+    using reference = const VoxelPoint&;
+
+    VoxelIterator() = default;  // the end
+    explicit VoxelIterator(const VDB& vdb);
+
+    reference operator*() const { return current_; }
+    pointer operator->() const { return &current_; }
+
+    VoxelIterator& operator++() {
+        advance();
+        return *this;
+    }
+
+    VoxelIterator operator++(int) {
+        auto copy = *this;
+        advance();
+        return copy;
+    }
+
+    bool operator==(const VoxelIterator& other) const {
+        if (vdb_ == nullptr || other.vdb_ == nullptr) {
+            return vdb_ == other.vdb_;
+        }
+        return current_.pos == other.current_.pos;
+    }
+    bool operator!=(const VoxelIterator& other) const { return !(*this == other); }
+
+private:
+    // Move to the first voxel of the current leaf, or of the next leaf that has one
+    void enter_leaf();
+    void next_voxel();
+    void advance();
+
+    const VDB* vdb_{nullptr};
+    NodeIterator leaf_;
+
+    // within the current leaf: the voxel bits not visited yet, or for a tile the box of it inside
+    // the volume
+    uint64_t remaining_{0};
+    size_t index_{0};
+    VDB::coord_t tile_min_{0}, tile_max_{0};
+
+    VoxelPoint current_{};
+};
+
+template <typename Iterator> class IteratorRange {
+public:
+    IteratorRange(Iterator begin, Iterator end) : begin_(std::move(begin)), end_(std::move(end)) {}
+
+    Iterator begin() const { return begin_; }
+    Iterator end() const { return end_; }
+
+private:
+    Iterator begin_;
+    Iterator end_;
+};
+
+}  // namespace spor::vox
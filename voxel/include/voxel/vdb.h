@@ -1,14 +1,25 @@
 #pragma once
 
+#include <array>
 #include <functional>
+#include <limits>
+#include <optional>
+#include <string>
+#include <type_traits>
 #include <vector>
 
 #include "vkh/base_objects.h"
 #include "vkh/buffer_objects.h"
 #include "vkh/glm_decl.h"
+#include "voxel/dirty_ranges.h"
+#include "voxel/leaf_encoding.h"
+#include "voxel/node_config.h"
 
 namespace spor::vox {
 
+// A node of the tree. Its active children are stored contiguously from child_offset on, in
+// h_voxels_ for leaves and in h_nodes_ otherwise, one per set bit of child_mask. A leaf without any
+// active children is a tile: the whole node has the value stored in child_offset.
 #pragma pack(4)
 struct SVNode {
     uint32_t is_leaf : 1;
@@ -22,22 +33,212 @@ static_assert(sizeof(SVNode) == 12, "SVNode is not properly packed/aligned");
 struct VDBInfo {
     glm::uvec3 size;
     glm::u32 height;
+    glm::u32 encoding;  // VoxelEncoding
+    glm::u32 padding[3]{};  // std140 rounds the struct up to 16 bytes
 };
 #pragma pack()
-static_assert(sizeof(VDBInfo) == 16, "VDBInfo is not properly packed/aligned");
+static_assert(sizeof(VDBInfo) == 32, "VDBInfo is not properly packed/aligned");
+
+// What a sampler knows about a box of voxels before it is sampled
+struct Region {
+    enum class Kind {
+        kEmpty,    // every voxel is 0
+        kUniform,  // every voxel is `value`
+        kMixed,    // unknown, the voxels have to be sampled
+    };
+
+    Kind kind{Kind::kMixed};
+    uint8_t value{0};
+};
+
+// Classifies the voxels in [min, max)
+using RegionClassifier = std::function<Region(glm::uvec3 min, glm::uvec3 max)>;
+
+// How build_from_points combines points that share a coordinate
+enum class PointReduction {
+    kLastWins,  // the one that comes last in the input
+    kMax,       // the largest value
+};
+
+struct VoxelPoint {
+    glm::uvec3 pos;
+    uint8_t value;
+};
+
+struct BuildOptions {
+    // Worker threads used to generate the root's subtrees, 0 picks the hardware concurrency. The
+    // resulting layout does not depend on this, but the sampler must be safe to call concurrently.
+    size_t num_threads{1};
+
+    // Tree level whose nodes a brick sampler fills per call, 1 being a single leaf.
+    size_t brick_level{1};
+
+    // Optional. Queried for every node before its subtree is generated, empty and uniform nodes
+    // are then built without calling the sampler.
+    RegionClassifier classify_region;
+
+    // build_from_points only
+    PointReduction duplicates{PointReduction::kLastWins};
+};
+
+// The parts of the host arrays an edit wrote to, as sorted and disjoint ranges
+struct EditResult {
+    std::vector<IndexRange> nodes;
+    std::vector<IndexRange> voxels;
+};
+
+// The first active voxel along a ray, see VDB::raycast
+struct RayHit {
+    glm::uvec3 voxel;
+    uint8_t value;
+    glm::ivec3 normal;  // of the face the ray entered through, 0 if it starts inside the voxel
+    float t;            // ray parameter at which it enters the voxel
+};
+
+// Rays in structure-of-arrays layout, traced together by VDB::raycast. Only the lanes set in
+// `active` are traced.
+template <size_t N> struct alignas(64) RayPacket {
+    static_assert(N == 4 || N == 8 || N == 16, "Ray packets have 4, 8 or 16 lanes");
+    static constexpr size_t kLanes = N;
+
+    float origin_x[N]{}, origin_y[N]{}, origin_z[N]{};
+    float dir_x[N]{}, dir_y[N]{}, dir_z[N]{};
+    float tmax[N]{};
+    uint32_t active{0};
+
+    void set_ray(size_t lane, glm::vec3 origin, glm::vec3 dir,
+                 float ray_tmax = std::numeric_limits<float>::infinity()) {
+        origin_x[lane] = origin.x;
+        origin_y[lane] = origin.y;
+        origin_z[lane] = origin.z;
+        dir_x[lane] = dir.x;
+        dir_y[lane] = dir.y;
+        dir_z[lane] = dir.z;
+        tmax[lane] = ray_tmax;
+        active |= 1u << lane;
+    }
+};
+
+// Topology and memory of one level of a VDB, see VDB::stats(). Everything but `references` counts
+// what is stored, so a node shared by several parents after VDB::deduplicate() counts once.
+struct LevelStats {
+    uint64_t nodes{0};        // nodes stored at the level, tiles included
+    uint64_t tiles{0};        // nodes without children that hold a single value
+    uint64_t child_slots{0};  // children the level's other nodes have room for
+    uint64_t empty_slots{0};  // of those, the ones that are inactive
+    uint64_t node_bytes{0};   // of the nodes themselves
+    uint64_t voxel_bytes{0};  // of the leaves' voxel data, in the current encoding
+    uint64_t references{0};   // nodes as the tree's traversal sees them, once per parent
+};
+
+// Topology and memory of a VDB, see VDB::stats()
+struct VDBStats {
+    size_t height{0};
+    glm::uvec3 size{0};
+    VoxelEncoding encoding{VoxelEncoding::kBytes};
+
+    std::vector<LevelStats> levels;  // indexed by level, levels[0] is unused
+    uint64_t active_voxels{0};       // of the volume, tiles count as all of the voxels they cover
+
+    // Stored leaves by their number of active voxels, the popcount of child_mask. Tiles are not
+    // leaves here, they are counted in LevelStats::tiles.
+    std::array<uint64_t, DefaultNodeConfig::num_children(1) + 1> leaf_occupancy{};
+
+    uint64_t host_bytes{0};    // of the host arrays, parts no node references included
+    uint64_t device_bytes{0};  // of the device buffers, 0 before the first upload
+
+    uint64_t nodes() const;
+    uint64_t tiles() const;
+
+    // Tiles among all nodes, and inactive children among all child slots
+    double tile_ratio() const;
+    double empty_ratio() const;
+
+    // Everything above as a single JSON object, the levels as an array from level 1 up
+    std::string to_json() const;
+};
+
+struct NodeRef;
+class NodeIterator;
+class VoxelIterator;
+template <typename Iterator> class IteratorRange;
+using NodeRange = IteratorRange<NodeIterator>;
+using VoxelRange = IteratorRange<VoxelIterator>;
+
+// Reads the z-slab [z, z + depth) of a dense volume into `out`, dims.x * dims.y * depth voxels
+// x-major.
+using SlabReader = std::function<void(uint32_t z, uint32_t depth, uint8_t* out)>;
 
 class VDB {
 public:
     using coord_t = glm::uvec3;
+    using config_t = DefaultNodeConfig;
 
 public:
     VDB(vk::SurfaceDevice::ptr device);
 
 public:
-    void build_from(coord_t dims, const std::function<uint8_t(coord_t)>& sampler);
+    // Build a tree covering [0, dims). Only voxels inside it are sampled, the tree is padded to
+    // the extent of its root node but size() and the device info report `dims`.
+    void build_from(coord_t dims, const std::function<uint8_t(coord_t)>& sampler,
+                    const BuildOptions& options = {});
+
+    // Build from a sampler that fills a whole brick per call: `sampler(min, extent, out)` writes
+    // the extent.x * extent.y * extent.z voxels starting at `min` into `out`, x-major. Bricks on
+    // the border of the volume are clipped to it.
+    template <typename BrickSampler,
+              typename = std::enable_if_t<
+                  std::is_invocable_v<BrickSampler&, coord_t, coord_t, uint8_t*>>>
+    void build_from(coord_t dims, BrickSampler&& sampler, const BuildOptions& options = {});
 
+    // Build from a dense volume whose voxel (x, y, z) is data[x * strides.x + y * strides.y
+    // + z * strides.z]. Leaves are encoded straight from the array and their parents assembled
+    // bottom-up, one slab of leaves at a time.
+    void build_from_dense(const uint8_t* data, coord_t dims, glm::u64vec3 strides);
+    void build_from_dense(const uint8_t* data, coord_t dims);
+
+    // Same as build_from_dense, but the volume is pulled one leaf-deep z-slab at a time in
+    // increasing z, so only a single slab of it is ever held in memory.
+    void build_from_dense(coord_t dims, const SlabReader& read_slab);
+
+    // Build from a sparse list of voxels, everything else stays empty. Points are radix sorted in
+    // tree order on options.num_threads threads and the nodes emitted in one pass over them, so the
+    // cost scales with the number of points rather than the volume. The result is identical to
+    // build_from with a sampler returning the reduced point values. Every point must lie within
+    // `dims`, whose size is limited by the sort keys having to fit 64 bits: 2^20 voxels per axis
+    // with the default 4^3 nodes, 2^21 with 2^3 nodes. Throws std::invalid_argument, leaving the
+    // tree unchanged, if they don't.
+    void build_from_points(coord_t dims, const std::vector<VoxelPoint>& points,
+                           const BuildOptions& options = {});
+
+    // Turn the tree into a DAG: identical leaf voxel runs and sibling arrays are stored once and
+    // shared by every node referencing them. The node format does not change, so lookups and the
+    // device traversal work as before. Can be called again after a rebuild, sharing is preserved.
+    void deduplicate();
+
+    // Re-encode the voxels of every leaf, see VoxelEncoding. Builds always start out as kBytes.
+    void encode_voxels(VoxelEncoding encoding);
+    VoxelEncoding voxel_encoding() const { return encoding_; }
+
+    // Write the tree to `path`: a versioned header followed by the node and voxel arrays exactly
+    // as they are held in memory, each starting on a page boundary.
+    void save(const std::string& path) const;
+
+    // Replace the tree with one written by save(). The file is memory mapped and each array copied
+    // out of it whole, nothing is rebuilt, so loading is bound by I/O. Throws std::runtime_error
+    // and leaves the tree unchanged if the file is not a valid VDB file of this version and
+    // NodeConfig.
+    void load(const std::string& path);
+
+    // Upload the whole tree, recreating the device buffers
     void move_to_device(vk::CommandPool::ptr cmd_pool);
 
+    // Upload only what changed since the last upload, e.g. after edits: the dirty ranges of the
+    // host arrays are packed into one staging buffer and copied with a single command buffer.
+    // Device buffers grow geometrically when the host arrays outgrow them, keeping their contents.
+    // Returns true if any buffer was recreated, in which case descriptors have to be rebound.
+    bool sync_to_device(vk::CommandPool::ptr cmd_pool);
+
     vk::Buffer::ptr info_buffer() { return d_info_; }
     vk::Buffer::ptr node_buffer() { return d_nodes_; }
     vk::Buffer::ptr voxel_buffer() { return d_voxels_; }
@@ -45,26 +246,157 @@ public:
 public:
     uint8_t get_voxel(coord_t pos) const;
 
+    // Look up `count` voxels at once, out[i] being the voxel at positions[i]. Queries are walked
+    // down the tree several at a time so that their memory accesses overlap, and consecutive
+    // queries in the same leaf share a single walk, so coherent batches are cheapest. Positions
+    // outside of the volume read as `outside` instead of throwing, the number of them is returned.
+    size_t get_voxels(const coord_t* positions, size_t count, uint8_t* out,
+                      uint8_t outside = 0) const;
+    std::vector<uint8_t> get_voxels(const std::vector<coord_t>& positions) const;
+
+    // Copy the voxels in [min, max) into the dense array `out`, voxel (x, y, z) going to
+    // out[(x - min.x) * strides.x + (y - min.y) * strides.y + (z - min.z) * strides.z], the
+    // layout build_from_dense reads. Parts of the box outside of the volume read as 0. The box is
+    // cleared in bulk and the tree traversed once, skipping nodes outside of the box, filling tiles
+    // and scattering leaves straight into it. With num_threads > 1 (0 picks the hardware
+    // concurrency) the clearing and the subtrees intersecting the box are shared out.
+    void copy_to_dense(coord_t min, coord_t max, uint8_t* out, glm::u64vec3 strides,
+                       size_t num_threads = 1) const;
+    void copy_to_dense(coord_t min, coord_t max, uint8_t* out, size_t num_threads = 1) const;
+
+    // Speeds up spatially coherent lookups by remembering the path to the last voxel it looked up,
+    // every node on it with the box of voxels it covers. A lookup restarts from the deepest of
+    // those nodes that contains the new position instead of from the root, so neighbours in the
+    // same leaf cost a single step. It reads the tree it was made for and is invalidated by any
+    // change to it. Not thread-safe, use one per thread.
+    class Accessor {
+    public:
+        explicit Accessor(const VDB& vdb);
+
+        // Same as VDB::get_voxel
+        uint8_t get_voxel(coord_t pos);
+
+    private:
+        const VDB& vdb_;
+
+        // The cached path, indexed by level and valid from cached_level_ up to the root. A node's
+        // key is the position of its box in units of its extent, pos >> shifts_[level].
+        size_t cached_level_;
+        std::vector<SVNode> nodes_;
+        std::vector<coord_t> keys_;
+        std::vector<uint32_t> shifts_;
+    };
+
+    // Active nodes at `level` with the boxes they cover, in tree order. The root is the only node
+    // at height(), tiles at `level` are included.
+    NodeRange nodes(size_t level) const;
+
+    // Every node without children: the leaves, and the tiles at any level
+    NodeRange leaves() const;
+
+    // Every active voxel with its position, in tree order. Tiles are expanded into each of their
+    // voxels, so this costs what the voxels do rather than what the volume does.
+    VoxelRange active_voxels() const;
+
+    // Call fn(const NodeRef&) for every node leaves() visits, on `num_threads` threads (0 picks the
+    // hardware concurrency) that share out the subtrees of the root's children. `fn` must be safe
+    // to call concurrently, the order of the calls is unspecified.
+    void for_each_leaf(const std::function<void(const NodeRef&)>& fn, size_t num_threads = 0) const;
+
+    // Find the first active voxel along origin + t * dir for t in [0, tmax]. Positions are in
+    // voxel space, the space the viewer's inv_m maps into: voxel (x, y, z) is the unit cube at
+    // (x, y, z) and the volume spans [0, size()). The traversal is a DDA over the cells of one node
+    // at a time, descending only into active children, so empty space is skipped a whole node at a
+    // time.
+    std::optional<RayHit> raycast(glm::vec3 origin, glm::vec3 dir,
+                                  float tmax = std::numeric_limits<float>::infinity()) const;
+
+    // Same for a ray in world space, `inv_m` being the inverse of the volume's model matrix. t is
+    // the parameter of the world-space ray, a distance if `dir` is normalized.
+    std::optional<RayHit> raycast(const glm::mat4& inv_m, glm::vec3 origin, glm::vec3 dir,
+                                  float tmax = std::numeric_limits<float>::infinity()) const;
+
+    // Trace the active lanes of `packet` together, writing lane i's hit to hits[i] and returning
+    // the mask of lanes that hit something. Each lane gives the hit raycast() would, up to rounding
+    // for rays passing within float precision of a voxel's edge. Lanes heading into the same
+    // octant share the walk down the tree: every node is fetched once for all of them and its
+    // children are slab tested against all lanes at once, in an order that is front to back for
+    // the whole octant. Other lanes, and lanes left alone in a node, are traced one at a time, so
+    // incoherent packets cost about as much as single rays.
+    template <size_t N> uint32_t raycast(const RayPacket<N>& packet, RayHit* hits) const;
+
+    // Edits rewrite only the paths down to the voxels they touch. Nodes and leaves keep their
+    // arrays when their children still fit, and otherwise get new ones appended, leaving the old
+    // ones unreferenced until the next rebuild or deduplicate(). Regions an edit makes uniform
+    // collapse into tiles. Writing 0 erases.
+    EditResult set_voxel(coord_t pos, uint8_t value);
+
+    // Set every voxel in [min, max), clipped to the volume
+    EditResult fill_box(coord_t min, coord_t max, uint8_t value);
+
+    // Set every voxel whose position lies within `radius` of `center`, clipped to the volume
+    EditResult fill_sphere(glm::vec3 center, float radius, uint8_t value);
+
+    // Set every listed voxel, later edits of the same voxel win. Throws std::invalid_argument
+    // before changing anything if a voxel lies outside the volume.
+    EditResult apply_edits(const std::vector<VoxelPoint>& edits);
+
+    // Count the nodes, voxels and bytes of the tree in one walk over its stored nodes, shared
+    // arrays of a deduplicated tree being visited once. The per-level bytes then add up to
+    // host_bytes, less what no node references until the next rebuild or deduplicate().
+    VDBStats stats() const;
+
 public:
-    size_t height() { return height_; }
-    coord_t size() { return size_; }
+    size_t height() const { return height_; }
+    coord_t size() const { return size_; }
 
 private:
     friend class TestInspector;
+    friend class VersionedVDB;
+    friend class PagedVDB;
+    friend class NodeIterator;
+    friend class VoxelIterator;
+
+    // Reset the host tree for a build of `dims`, leaving a placeholder root
+    void begin_build(coord_t dims);
+
+    // Whether every child array of `nodes` lies within `nodes` or `voxels`, so that walking them
+    // can't read out of bounds. Checked for arrays read from files.
+    static bool child_arrays_valid(const std::vector<SVNode>& nodes,
+                                   const std::vector<uint8_t>& voxels, VoxelEncoding encoding);
+
+    // Bytes of h_voxels_ used by a leaf in the current encoding
+    size_t leaf_data_size(const SVNode& leaf) const;
+
+    // Rewrite the tree where `brush` paints it, see vdb_edit.cpp
+    template <typename Brush> EditResult edit(const Brush& brush);
+
+    // Mark everything for upload by the next sync_to_device()
+    void mark_all_dirty();
 
     vk::SurfaceDevice::ptr device_;
 
     size_t height_{0};
     coord_t size_{0};
+    VoxelEncoding encoding_{VoxelEncoding::kBytes};
+    bool shared_{false};  // arrays may be referenced by several nodes, see deduplicate()
 
     // host
     std::vector<SVNode> h_nodes_;
     std::vector<uint8_t> h_voxels_;
 
+    // changed since the last upload
+    bool dirty_info_{true};
+    DirtyRanges dirty_nodes_;
+    DirtyRanges dirty_voxels_;
+
     // device
     vk::Buffer::ptr d_info_;
     vk::Buffer::ptr d_nodes_;
     vk::Buffer::ptr d_voxels_;
 };
 
-}  // namespace spor::vox
\ No newline at end of file
+}  // namespace spor::vox
+
+#include "voxel/vdb_build.inl"
+#include "voxel/tree_iterators.h"
\ No newline at end of file
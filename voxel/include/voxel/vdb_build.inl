@@ -0,0 +1,363 @@
+#pragma once
+
+// Tree construction templates shared by the VDB::build_from overloads. Included at the end of
+// vdb.h so that samplers passed as template arguments can be inlined into the leaf loops.
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+namespace spor::vox {
+
+namespace detail {
+
+using Config = VDB::config_t;
+
+// Voxels in a leaf node
+constexpr size_t kLeafVoxels = Config::num_children(1);
+
+inline VDB::coord_t pos_from_index(size_t index, VDB::coord_t size) {
+    return VDB::coord_t(index % size.x, (index / size.x) % size.y, index / (size.x * size.y));
+}
+
+inline size_t pos_to_index(VDB::coord_t pos, VDB::coord_t size) {
+    return pos.x + pos.y * size.x + pos.z * size.x * size.y;
+}
+
+// Children along each axis of a node at `level`
+constexpr VDB::coord_t node_dim(size_t level) { return VDB::coord_t(Config::dim(level)); }
+
+// Voxels along each axis covered by a node at `level`
+constexpr VDB::coord_t node_extent(size_t level) {
+    return VDB::coord_t(1u << Config::log2_extent(level));
+}
+
+// Index of the child of a node at `level` that contains `pos`
+inline size_t child_index(VDB::coord_t pos, size_t level) {
+    auto local = (pos >> Config::log2_extent(level - 1)) & (Config::dim(level) - 1);
+    return pos_to_index(local, node_dim(level));
+}
+
+// Key whose order is the order build_from visits voxels in: the child index at every level,
+// root first, 3 * log2_dim bits each. Nodes at `level` are identified by key >> tree_key_shift.
+inline uint64_t tree_key(VDB::coord_t pos, size_t height) {
+    uint64_t key = 0;
+    for (size_t level = 1; level <= height; ++level) {
+        key |= static_cast<uint64_t>(child_index(pos, level))
+               << (3 * Config::log2_extent(level - 1));
+    }
+    return key;
+}
+
+inline size_t tree_key_shift(size_t level) { return 3 * Config::log2_extent(level); }
+
+// Height of the smallest tree whose root covers every axis of `dims`, the one builds make
+inline size_t tree_height(VDB::coord_t dims) {
+    uint32_t max_dim = std::max({dims.x, dims.y, dims.z});
+    size_t level = 1;
+    while ((size_t(1) << Config::log2_extent(level)) < max_dim) {
+        ++level;
+    }
+    return level;
+}
+
+// `num_threads`, or the hardware concurrency for 0
+size_t resolve_num_threads(size_t num_threads);
+
+// Call fn(item, thread) for every item of [0, num_items), handed out one at a time to at most
+// `num_threads` threads (0 picks the hardware concurrency), the calling thread being thread 0.
+// The first exception a call throws stops the remaining items and is rethrown once all threads
+// have finished.
+void parallel_for(size_t num_items, size_t num_threads,
+                  const std::function<void(size_t item, size_t thread)>& fn);
+
+// Per-build state shared by the generation functions
+struct BuildContext {
+    VDB::coord_t dims;  // voxels outside of [0, dims) are never sampled and stay empty
+    const RegionClassifier* classify{nullptr};
+};
+
+// Number of set bits. A child's offset among its active siblings is the popcount of the mask bits
+// below its own.
+inline uint32_t popcount(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<uint32_t>(__builtin_popcountll(mask));
+#else
+    return static_cast<uint32_t>(std::bitset<64>(mask).count());
+#endif
+}
+
+// Index of the lowest set bit, `mask` must not be 0
+inline uint32_t lowest_bit(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<uint32_t>(__builtin_ctzll(mask));
+#else
+    return popcount((mask & (~mask + 1)) - 1);
+#endif
+}
+
+// A tile stands in for a whole node of one value, see VDB
+inline bool is_tile(const SVNode& node) { return node.is_leaf && node.child_mask == 0; }
+
+inline SVNode make_tile(uint8_t value) { return SVNode{1, value, 0}; }
+
+// Whether a node has to be stored as a child, empty nodes never are
+inline bool is_active(const SVNode& node) { return node.child_mask != 0 || is_tile(node); }
+
+// True when a leaf with these voxels is uniform and can be stored as a tile instead
+inline bool uniform_leaf(const uint8_t* voxels, uint64_t mask) {
+    constexpr uint64_t kFull = kLeafVoxels == 64 ? ~0ull : (1ull << kLeafVoxels) - 1;
+    return mask == kFull && std::memcmp(voxels, voxels + 1, kLeafVoxels - 1) == 0;
+}
+
+// True when `children` are all the children of a node at `level` and they are tiles of the same
+// value, in which case the node collapses into a tile of that value itself.
+inline bool uniform_tiles(const std::vector<SVNode>& children, size_t level) {
+    return children.size() == Config::num_children(level) && is_tile(children.front())
+           && std::all_of(children.begin(), children.end(), [&](const SVNode& child) {
+                  return is_tile(child) && child.child_offset == children.front().child_offset;
+              });
+}
+
+inline bool outside(VDB::coord_t min, const BuildContext& ctx) {
+    return min.x >= ctx.dims.x || min.y >= ctx.dims.y || min.z >= ctx.dims.z;
+}
+
+// Extent of the part of the box at `min` with size `extent` that lies within the volume
+inline VDB::coord_t clamp_extent(VDB::coord_t min, VDB::coord_t extent, const BuildContext& ctx) {
+    return glm::min(extent, ctx.dims - glm::min(min, ctx.dims));
+}
+
+// Bit i of the result is set when voxels[i] is non-zero, for the first `count` voxels.
+uint64_t active_mask(const uint8_t* voxels, size_t count);
+
+// Move the voxels whose bit is set in `mask` to the front of `voxels`, keeping their order, and
+// return how many there are. Works in place.
+size_t compress_active(uint8_t* voxels, size_t count, uint64_t mask);
+
+// Build a leaf from the voxels written by `fill_leaf(min, out)`, x-major. Uniform leaves become
+// tiles.
+template <typename LeafFn>
+SVNode generate_leaf(std::vector<uint8_t>& voxel_data, VDB::coord_t min, LeafFn&& fill_leaf) {
+    SVNode node{0, 0, 0};
+    node.is_leaf = true;
+    node.child_offset = voxel_data.size();
+
+    std::array<uint8_t, kLeafVoxels> voxels;
+    fill_leaf(min, voxels.data());
+
+    node.child_mask = active_mask(voxels.data(), kLeafVoxels);
+    if (node.child_mask == 0) {
+        return SVNode{0, 0, 0};  // empty, and not to be mistaken for a tile
+    } else if (uniform_leaf(voxels.data(), node.child_mask)) {
+        return make_tile(voxels[0]);
+    }
+
+    auto num_active = compress_active(voxels.data(), kLeafVoxels, node.child_mask);
+    voxel_data.insert(voxel_data.end(), voxels.begin(), voxels.begin() + num_active);
+
+    return node;
+}
+
+template <typename LeafFn>
+SVNode generate_tree(std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data, size_t level,
+                     VDB::coord_t min, LeafFn&& fill_leaf, const BuildContext& ctx);
+
+// If the node at `level` lies outside the volume, or the classifier knows it to be empty or
+// uniform, build it into `node` without sampling and return true. Returns false when the node has
+// to be sampled.
+inline bool generate_known_region(std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data,
+                                  size_t level, VDB::coord_t min, const BuildContext& ctx,
+                                  SVNode& node) {
+    if (outside(min, ctx)) {
+        node = SVNode{0, 0, 0};
+        return true;
+    }
+
+    if (!ctx.classify || !*ctx.classify) {
+        return false;
+    }
+
+    auto extent = clamp_extent(min, node_extent(level), ctx);
+    auto region = (*ctx.classify)(min, min + extent);
+    if (region.kind == Region::Kind::kEmpty
+        || (region.kind == Region::Kind::kUniform && region.value == 0)) {
+        node = SVNode{0, 0, 0};
+        return true;
+    } else if (region.kind == Region::Kind::kUniform) {
+        if (extent == node_extent(level)) {
+            node = make_tile(region.value);
+            return true;
+        }
+
+        auto fill_leaf = [&](VDB::coord_t leaf_min, uint8_t* out) {
+            auto leaf_extent = clamp_extent(leaf_min, node_extent(1), ctx);
+            if (leaf_extent == node_extent(1)) {
+                std::memset(out, region.value, kLeafVoxels);
+                return;
+            }
+
+            std::memset(out, 0, kLeafVoxels);
+            for (size_t z = 0; z < leaf_extent.z; ++z) {
+                for (size_t y = 0; y < leaf_extent.y; ++y) {
+                    std::memset(out + pos_to_index(VDB::coord_t(0, y, z), node_extent(1)),
+                                region.value, leaf_extent.x);
+                }
+            }
+        };
+
+        BuildContext unclassified{ctx.dims};
+        node = generate_tree(nodes, voxel_data, level, min, fill_leaf, unclassified);
+        return true;
+    }
+
+    return false;
+}
+
+// Build an internal node at `level` whose children are returned by `generate_child(level, min)`,
+// unless their contents are already known. The active children are appended to `nodes` after
+// everything their generation appended, or the node becomes a tile if they are uniform tiles.
+template <typename ChildFn>
+SVNode generate_internal(std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data,
+                         size_t level, VDB::coord_t min, const BuildContext& ctx,
+                         ChildFn&& generate_child) {
+    SVNode node{0, 0, 0};
+    node.is_leaf = false;
+
+    std::vector<SVNode> children;
+    children.reserve(Config::num_children(level));
+    for (size_t i = 0; i < Config::num_children(level); ++i) {
+        auto child_local_pos = pos_from_index(i, node_dim(level));
+        auto child_min = min + child_local_pos * node_extent(level - 1);
+
+        SVNode child;
+        if (!generate_known_region(nodes, voxel_data, level - 1, child_min, ctx, child)) {
+            child = generate_child(level - 1, child_min);
+        }
+
+        if (is_active(child)) {
+            node.child_mask |= 1ull << i;
+
+            children.push_back(child);
+        }
+    }
+
+    if (uniform_tiles(children, level)) {
+        return children.front();
+    }
+
+    node.child_offset = nodes.size();
+    nodes.insert(nodes.end(), children.begin(), children.end());
+
+    return node;
+}
+
+// Build a tree and return the root node, which will be at the requested level. The number of
+// children per node at each level comes from VDB::config_t.
+template <typename LeafFn>
+SVNode generate_tree(std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data, size_t level,
+                     VDB::coord_t min, LeafFn&& fill_leaf, const BuildContext& ctx) {
+    if (level == 1) {  // level 0 contains voxels, so level 1 nodes are leaf nodes
+        return generate_leaf(voxel_data, min, fill_leaf);
+    }
+
+    return generate_internal(nodes, voxel_data, level, min, ctx,
+                             [&](size_t child_level, VDB::coord_t child_min) {
+                                 return generate_tree(nodes, voxel_data, child_level, child_min,
+                                                      fill_leaf, ctx);
+                             });
+}
+
+// Copy the voxels of the leaf at `leaf_min` out of a brick of size `extent` at `brick_min`.
+// Voxels outside the volume are left empty.
+inline void copy_leaf_from_brick(const uint8_t* brick, VDB::coord_t brick_min, VDB::coord_t extent,
+                                 VDB::coord_t leaf_min, uint8_t* out, const BuildContext& ctx) {
+    auto local = leaf_min - brick_min;
+    auto leaf_extent = clamp_extent(leaf_min, node_extent(1), ctx);
+    if (leaf_extent != node_extent(1)) {
+        std::memset(out, 0, kLeafVoxels);
+    }
+
+    for (size_t z = 0; z < leaf_extent.z; ++z) {
+        for (size_t y = 0; y < leaf_extent.y; ++y) {
+            std::memcpy(out + pos_to_index(VDB::coord_t(0, y, z), node_extent(1)),
+                        brick + pos_to_index(local + VDB::coord_t(0, y, z), extent),
+                        leaf_extent.x);
+        }
+    }
+}
+
+// Same as generate_tree, but voxels come from `sampler(min, extent, out)` one node at
+// `brick_level` at a time. Bricks are clipped to the volume, and `brick` is scratch space for
+// the ones that are not a whole leaf. Regions are only classified above `brick_level`, there is
+// nothing left to skip once a brick is sampled.
+template <typename BrickSampler>
+SVNode generate_brick_tree(std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data,
+                           size_t level, VDB::coord_t min, size_t brick_level,
+                           BrickSampler& sampler, std::vector<uint8_t>& brick,
+                           const BuildContext& ctx) {
+    if (level > brick_level) {
+        return generate_internal(nodes, voxel_data, level, min, ctx,
+                                 [&](size_t child_level, VDB::coord_t child_min) {
+                                     return generate_brick_tree(nodes, voxel_data, child_level,
+                                                                child_min, brick_level, sampler,
+                                                                brick, ctx);
+                                 });
+    }
+
+    auto extent = clamp_extent(min, node_extent(level), ctx);
+    if (level == 1 && extent == node_extent(1)) {
+        return generate_leaf(voxel_data, min, [&](VDB::coord_t leaf_min, uint8_t* out) {
+            sampler(leaf_min, node_extent(1), out);
+        });
+    }
+
+    brick.resize(static_cast<size_t>(extent.x) * extent.y * extent.z);
+    sampler(min, extent, brick.data());
+
+    BuildContext unclassified{ctx.dims};
+    auto fill_leaf = [&](VDB::coord_t leaf_min, uint8_t* out) {
+        copy_leaf_from_brick(brick.data(), min, extent, leaf_min, out, ctx);
+    };
+
+    return generate_tree(nodes, voxel_data, level, min, fill_leaf, unclassified);
+}
+
+// Builds the subtree at `level` whose box starts at `min` into `nodes` and `voxel_data`,
+// returning its root
+using SubtreeFn = std::function<SVNode(std::vector<SVNode>& nodes,
+                                       std::vector<uint8_t>& voxel_data, size_t level,
+                                       VDB::coord_t min)>;
+
+// Build the whole tree below the root at `level` from `generate_subtree`, in parallel if
+// requested and worthwhile. Defined in vdb.cpp, which keeps the threads out of this header.
+SVNode generate_root(std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data, size_t level,
+                     size_t num_threads, const BuildContext& ctx,
+                     const SubtreeFn& generate_subtree);
+
+}  // namespace detail
+
+template <typename BrickSampler, typename>
+void VDB::build_from(coord_t dims, BrickSampler&& sampler, const BuildOptions& options) {
+    begin_build(dims);
+
+    size_t brick_level = std::clamp<size_t>(options.brick_level, 1, height_);
+    detail::BuildContext ctx{dims, &options.classify_region};
+
+    auto generate_subtree = [&](std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data,
+                                size_t level, coord_t min) {
+        std::vector<uint8_t> brick;
+        return detail::generate_brick_tree(nodes, voxel_data, level, min,
+                                           std::min(brick_level, level), sampler, brick, ctx);
+    };
+
+    auto root = detail::generate_root(h_nodes_, h_voxels_, height_,
+                                      detail::resolve_num_threads(options.num_threads), ctx,
+                                      generate_subtree);
+    h_nodes_[0] = root;
+}
+
+}  // namespace spor::vox
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "voxel/vdb.h"
+
+namespace spor::vox {
+
+// A VDB that can be read from any number of threads while one thread at a time modifies it.
+//
+// Every modification publishes a new immutable version of the tree. Versions store the node and
+// voxel arrays in fixed-size pages shared between versions, so publishing only copies the pages
+// the modification dirtied. Readers pin the current version without taking a lock and keep seeing
+// it, unchanged, until they let go of it; a version is reclaimed by the next publish once no reader
+// pins it anymore, and pages once no version references them.
+class VersionedVDB {
+public:
+    using coord_t = VDB::coord_t;
+
+    static constexpr size_t kNodePageSize = 4096;    // nodes
+    static constexpr size_t kVoxelPageSize = 16384;  // bytes
+
+    class Snapshot {
+    public:
+        // Same as VDB::get_voxel, on this version of the tree
+        uint8_t get_voxel(coord_t pos) const;
+
+        uint64_t version() const { return version_; }
+        size_t height() const { return height_; }
+        coord_t size() const { return size_; }
+
+    private:
+        friend class VersionedVDB;
+
+        template <typename T> using Page = std::shared_ptr<const std::vector<T>>;
+
+        const SVNode& node(size_t index) const {
+            return (*nodes_[index / kNodePageSize])[index % kNodePageSize];
+        }
+
+        uint8_t voxel(size_t index) const {
+            return (*voxels_[index / kVoxelPageSize])[index % kVoxelPageSize];
+        }
+
+        uint64_t version_{0};
+        size_t height_{0};
+        coord_t size_{0};
+        VoxelEncoding encoding_{VoxelEncoding::kBytes};
+
+        std::vector<Page<SVNode>> nodes_;
+        std::vector<Page<uint8_t>> voxels_;
+    };
+
+    // A reader's pin on one version. Movable, the version stays alive until it is destroyed.
+    class ReadGuard {
+    public:
+        ReadGuard(ReadGuard&& other) noexcept;
+        ReadGuard& operator=(ReadGuard&& other) noexcept;
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+        ~ReadGuard();
+
+        const Snapshot& operator*() const { return *snapshot_; }
+        const Snapshot* operator->() const { return snapshot_; }
+
+    private:
+        friend class VersionedVDB;
+
+        struct Slot;
+        ReadGuard(Slot* slot, const Snapshot* snapshot) : slot_(slot), snapshot_(snapshot) {}
+
+        void release();
+
+        Slot* slot_;
+        const Snapshot* snapshot_;
+    };
+
+public:
+    // Takes over `tree` as version 0. At most `max_readers` guards can be held at the same time.
+    explicit VersionedVDB(VDB tree, size_t max_readers = 64);
+
+    VersionedVDB(const VersionedVDB&) = delete;
+    VersionedVDB& operator=(const VersionedVDB&) = delete;
+
+    // No guards may outlive the VersionedVDB
+    ~VersionedVDB();
+
+public:
+    // Pin the latest version. Lock-free, throws std::runtime_error if max_readers guards are held.
+    ReadGuard read() const;
+
+    // Run `modify(VDB&)` on the writer's copy of the tree and publish the result as a new version,
+    // returning its number. Writers are serialized, readers are never blocked. Anything VDB allows
+    // can be done in `modify`, edits, rebuilds, deduplicate() or encode_voxels(), except moving the
+    // tree to the device. Pages are copied by the host ranges the modification dirtied, so edits
+    // publish cheaply and rebuilds copy everything.
+    template <typename Modify> uint64_t write(Modify&& modify) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        modify(tree_);
+        return publish();
+    }
+
+    uint64_t version() const;
+
+    // Versions not reclaimed yet because readers still pin them, the latest included
+    size_t retained_versions() const;
+
+private:
+    // Build the next version from `tree_`'s dirty ranges and make it the latest, then reclaim the
+    // versions no reader pins. Called with write_mutex_ held.
+    uint64_t publish();
+
+    VDB tree_;
+
+    std::unique_ptr<ReadGuard::Slot[]> slots_;
+    size_t num_slots_;
+
+    std::atomic<const Snapshot*> latest_;
+
+    mutable std::mutex write_mutex_;
+    std::vector<std::unique_ptr<Snapshot>> versions_;  // oldest first, the latest last
+};
+
+}  // namespace spor::vox
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "voxel/vdb.h"
+
+namespace spor::vox {
+
+// An indexed triangle mesh, three indices per triangle
+struct TriangleMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+
+    size_t num_triangles() const { return indices.size() / 3; }
+
+    // Load every shape of an OBJ file, polygons triangulated. Throws std::runtime_error if it
+    // can't be read.
+    static TriangleMesh from_obj(const std::string& path);
+
+    // Scale and move the mesh uniformly so that it starts at 0 and its longest side spans
+    // `resolution` voxels, returning the dimensions of the volume it then fills.
+    VDB::coord_t fit_to(uint32_t resolution);
+};
+
+struct VoxelizeOptions {
+    uint8_t value{1};  // of every voxel the mesh covers
+
+    // Also fill the interior. The mesh has to be closed, a voxel is inside when a ray through its
+    // center along z crosses the mesh an odd number of times below it.
+    bool solid{false};
+
+    // Threads used to bin the triangles and to build the tree, 0 picks the hardware concurrency
+    size_t num_threads{1};
+};
+
+// Build `vdb` covering [0, dims) from the voxels `mesh` overlaps, positions being in voxel space
+// where voxel (x, y, z) is the unit cube at (x, y, z). Triangles are first binned into the leaves
+// they overlap, then each leaf with triangles is filled by exact triangle/box overlap tests of its
+// voxels. Leaves without triangles are never sampled: the build skips them, or with `solid` fills
+// them whole, so there is no dense intermediate and memory follows the surface, not the volume.
+void voxelize_mesh(VDB& vdb, VDB::coord_t dims, const TriangleMesh& mesh,
+                   const VoxelizeOptions& options = {});
+
+}  // namespace spor::vox
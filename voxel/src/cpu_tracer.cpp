@@ -0,0 +1,145 @@
+#include "voxel/cpu_tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace spor::vox {
+
+namespace {
+
+// sv_trace.comp's MAX_RAY_STEPS
+constexpr int kMaxRaySteps = 512;
+
+float sign(float v) { return v > 0.f ? 1.f : v < 0.f ? -1.f : 0.f; }
+
+// One invocation of sv_trace.comp, statement for statement. Returns RGBA in [0, 1].
+glm::vec4 trace_pixel(VDB::Accessor& accessor, VDB::coord_t size, const TracerCamera& camera,
+                      uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    // get_primary_ray
+    float u = (x + 0.5f) / width * 2.f - 1.f;
+    float v = (y + 0.5f) / height * 2.f - 1.f;
+    glm::vec4 far = camera.inv_vp * glm::vec4(u, v, 1.f, 1.f);
+    glm::vec3 ray_dir(far.x / far.w, far.y / far.w, far.z / far.w);
+    float dir_length
+        = std::sqrt(ray_dir.x * ray_dir.x + ray_dir.y * ray_dir.y + ray_dir.z * ray_dir.z);
+    ray_dir /= dir_length;
+    glm::vec4 pos = camera.inv_m * glm::vec4(camera.camera_pos, 1.f);
+    glm::vec3 ray_pos(pos.x, pos.y, pos.z);
+
+    // clip the ray against the volume
+    float t_enter = -std::numeric_limits<float>::infinity();
+    float t_exit = std::numeric_limits<float>::infinity();
+    for (int axis = 0; axis < 3; ++axis) {
+        float t_min = (0.f - ray_pos[axis]) / ray_dir[axis];
+        float t_max = (static_cast<float>(size[axis]) - ray_pos[axis]) / ray_dir[axis];
+        t_enter = std::max(t_enter, std::min(t_min, t_max));
+        t_exit = std::min(t_exit, std::max(t_min, t_max));
+    }
+
+    if (t_exit < std::max(t_enter, 0.f)) {
+        return glm::vec4(0.f);
+    }
+
+    ray_pos += ray_dir * std::max(t_enter - 1.f, 0.f);
+
+    glm::ivec3 world_pos, ray_step;
+    glm::vec3 delta_dist, side_dist;
+    float ray_length
+        = std::sqrt(ray_dir.x * ray_dir.x + ray_dir.y * ray_dir.y + ray_dir.z * ray_dir.z);
+    for (int axis = 0; axis < 3; ++axis) {
+        float dir_sign = sign(ray_dir[axis]);
+        world_pos[axis] = static_cast<int>(std::floor(ray_pos[axis]));
+        delta_dist[axis] = std::abs(ray_length / ray_dir[axis]);
+        ray_step[axis] = static_cast<int>(dir_sign);
+        side_dist[axis] = (dir_sign * (world_pos[axis] - ray_pos[axis]) + dir_sign * 0.5f + 0.5f)
+                          * delta_dist[axis];
+    }
+
+    constexpr float kShade[3] = {0.5f, 0.7f, 0.9f};
+    glm::vec4 final_color(0.f);
+    bool entered = false;
+    for (int i = 0; i < kMaxRaySteps; ++i) {
+        bool mask[3] = {
+            side_dist.x <= std::min(side_dist.y, side_dist.z),
+            side_dist.y <= std::min(side_dist.z, side_dist.x),
+            side_dist.z <= std::min(side_dist.x, side_dist.y),
+        };
+        for (int axis = 0; axis < 3; ++axis) {
+            if (mask[axis]) {
+                side_dist[axis] += delta_dist[axis];
+                world_pos[axis] += ray_step[axis];
+            }
+        }
+
+        if (world_pos.x >= 0 && world_pos.y >= 0 && world_pos.z >= 0
+            && world_pos.x < static_cast<int>(size.x) && world_pos.y < static_cast<int>(size.y)
+            && world_pos.z < static_cast<int>(size.z)) {
+            entered = true;
+
+            // mix(final_color, vec4(0.7), 0.005)
+            final_color = final_color * (1.f - 0.005f) + glm::vec4(0.7f * 0.005f);
+
+            if (accessor.get_voxel(VDB::coord_t(world_pos)) > 0) {
+                float shade = 0.f;
+                for (int axis = 0; axis < 3; ++axis) {
+                    shade += mask[axis] ? kShade[axis] : 0.f;
+                }
+                final_color = glm::vec4(shade, shade, shade, 1.f);
+                break;
+            }
+        } else if (entered) {
+            break;
+        }
+    }
+
+    return final_color;
+}
+
+// A float channel to UNORM8, as storing it to an rgba8 image does
+uint8_t to_unorm8(float c) {
+    return static_cast<uint8_t>(std::lround(std::clamp(c, 0.f, 1.f) * 255.f));
+}
+
+}  // namespace
+
+void trace_image(const VDB& vdb, const TracerCamera& camera, uint32_t width, uint32_t height,
+                 uint8_t* out, size_t num_threads) {
+    if (vdb.height() == 0) {
+        throw std::runtime_error("VDB is empty");
+    }
+
+    const uint32_t tiles_x = (width + kTracerTileSize - 1) / kTracerTileSize;
+    const uint32_t tiles_y = (height + kTracerTileSize - 1) / kTracerTileSize;
+    const size_t num_tiles = static_cast<size_t>(tiles_x) * tiles_y;
+
+    // an accessor per thread, so that its cache carries over from tile to tile
+    num_threads
+        = std::min(detail::resolve_num_threads(num_threads), std::max<size_t>(num_tiles, 1));
+    std::vector<VDB::Accessor> accessors(num_threads, VDB::Accessor(vdb));
+    const VDB::coord_t size = vdb.size();
+
+    detail::parallel_for(num_tiles, num_threads, [&](size_t tile, size_t thread) {
+        uint32_t x0 = static_cast<uint32_t>(tile % tiles_x) * kTracerTileSize;
+        uint32_t y0 = static_cast<uint32_t>(tile / tiles_x) * kTracerTileSize;
+        for (uint32_t y = y0; y < std::min(y0 + kTracerTileSize, height); ++y) {
+            for (uint32_t x = x0; x < std::min(x0 + kTracerTileSize, width); ++x) {
+                glm::vec4 color
+                    = trace_pixel(accessors[thread], size, camera, x, y, width, height);
+                uint8_t* pixel = out + (static_cast<size_t>(y) * width + x) * 4;
+                for (int c = 0; c < 4; ++c) {
+                    pixel[c] = to_unorm8(color[c]);
+                }
+            }
+        }
+    });
+}
+
+std::vector<uint8_t> trace_image(const VDB& vdb, const TracerCamera& camera, uint32_t width,
+                                 uint32_t height, size_t num_threads) {
+    std::vector<uint8_t> image(static_cast<size_t>(width) * height * 4);
+    trace_image(vdb, camera, width, height, image.data(), num_threads);
+    return image;
+}
+
+}  // namespace spor::vox
@@ -0,0 +1,316 @@
+#include "voxel/importers.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+namespace spor::vox {
+
+namespace {
+
+// Reads the little-endian fields of a .vox file, throwing on anything short or malformed
+class VoxReader {
+public:
+    explicit VoxReader(const std::string& path) : file_(path, std::ios::binary) {
+        if (!file_) {
+            throw std::runtime_error("Failed to open .vox file " + path);
+        }
+    }
+
+    void read(void* out, size_t bytes) {
+        if (!file_.read(static_cast<char*>(out), static_cast<std::streamsize>(bytes))) {
+            throw std::runtime_error(".vox file is truncated");
+        }
+    }
+
+    int32_t read_i32() {
+        uint8_t bytes[4];
+        read(bytes, sizeof(bytes));
+        return static_cast<int32_t>(bytes[0] | bytes[1] << 8 | bytes[2] << 16
+                                    | static_cast<uint32_t>(bytes[3]) << 24);
+    }
+
+    // A count or size, which has to be non-negative and fit in what is left of `end`
+    uint32_t read_size(uint64_t end, size_t element_size = 1) {
+        int32_t size = read_i32();
+        if (size < 0 || static_cast<uint64_t>(size) * element_size > end - position()) {
+            throw std::runtime_error(".vox file is corrupt");
+        }
+        return static_cast<uint32_t>(size);
+    }
+
+    std::string read_string(uint64_t end) {
+        std::string string(read_size(end), '\0');
+        read(string.data(), string.size());
+        return string;
+    }
+
+    std::map<std::string, std::string> read_dict(uint64_t end) {
+        std::map<std::string, std::string> dict;
+        for (uint32_t pairs = read_size(end); pairs > 0; --pairs) {
+            auto key = read_string(end);
+            dict[key] = read_string(end);
+        }
+        return dict;
+    }
+
+    uint64_t position() { return static_cast<uint64_t>(file_.tellg()); }
+
+    void seek(uint64_t position) {
+        if (!file_.seekg(static_cast<std::streamoff>(position))) {
+            throw std::runtime_error(".vox file is truncated");
+        }
+    }
+
+private:
+    std::ifstream file_;
+};
+
+struct VoxModel {
+    glm::ivec3 size;
+    uint64_t voxels_offset;  // of the XYZI records
+    uint32_t num_voxels;
+};
+
+// The scene graph's nodes, by id
+struct VoxScene {
+    struct Transform {
+        int32_t child;
+        glm::ivec3 translation;
+    };
+
+    std::map<int32_t, Transform> transforms;
+    std::map<int32_t, std::vector<int32_t>> groups;
+    std::map<int32_t, std::vector<int32_t>> shapes;  // model ids
+};
+
+struct VoxPlacement {
+    size_t model;
+    glm::ivec3 min;  // scene position of the model's voxel 0
+};
+
+// Collect the placements below `node`, whose parents translate it by `translation`
+void place_models(const VoxScene& scene, int32_t node, glm::ivec3 translation, size_t depth,
+                  const std::vector<VoxModel>& models, std::vector<VoxPlacement>& placements) {
+    // a valid graph is a tree, so it can't be deeper than it has nodes
+    if (depth > scene.transforms.size() + scene.groups.size() + scene.shapes.size()) {
+        throw std::runtime_error(".vox scene graph has a cycle");
+    }
+
+    if (auto it = scene.transforms.find(node); it != scene.transforms.end()) {
+        place_models(scene, it->second.child, translation + it->second.translation, depth + 1,
+                     models, placements);
+    } else if (auto it = scene.groups.find(node); it != scene.groups.end()) {
+        for (auto child : it->second) {
+            place_models(scene, child, translation, depth + 1, models, placements);
+        }
+    } else if (auto it = scene.shapes.find(node); it != scene.shapes.end()) {
+        for (auto model : it->second) {
+            if (model < 0 || static_cast<size_t>(model) >= models.size()) {
+                throw std::runtime_error(".vox file is corrupt");
+            }
+            // MagicaVoxel centers a model on its translation, rounding down
+            placements.push_back(VoxPlacement{static_cast<size_t>(model),
+                                              translation - models[model].size / 2});
+        }
+    } else {
+        throw std::runtime_error(".vox scene graph references a missing node");
+    }
+}
+
+}  // namespace
+
+void import_raw(VDB& vdb, const std::string& path, const RawVolumeFormat& format) {
+    if (format.bits != 8 && format.bits != 16) {
+        throw std::invalid_argument("Raw volumes have 8 or 16 bits per sample");
+    }
+    if (format.range_max <= format.range_min) {
+        throw std::invalid_argument("Raw volume value range is empty");
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open raw volume file " + path);
+    }
+
+    const uint64_t sample_bytes = format.bits / 8;
+    const uint64_t slice_samples = static_cast<uint64_t>(format.dims.x) * format.dims.y;
+    file.seekg(0, std::ios::end);
+    if (static_cast<uint64_t>(file.tellg())
+        < format.header_bytes + slice_samples * format.dims.z * sample_bytes) {
+        throw std::runtime_error("Raw volume file is smaller than its dimensions");
+    }
+
+    // every sample value mapped once up front
+    std::vector<uint8_t> values(size_t(1) << format.bits);
+    const double scale = 254.0 / (format.range_max - format.range_min);
+    for (uint32_t sample = format.threshold; sample < values.size(); ++sample) {
+        uint32_t clamped = std::clamp(sample, format.range_min, format.range_max);
+        values[sample]
+            = static_cast<uint8_t>(1 + std::lround((clamped - format.range_min) * scale));
+    }
+
+    std::vector<uint8_t> samples;
+    vdb.build_from_dense(format.dims, [&](uint32_t z, uint32_t depth, uint8_t* out) {
+        size_t count = slice_samples * depth;
+        samples.resize(count * sample_bytes);
+        file.seekg(static_cast<std::streamoff>(format.header_bytes
+                                               + slice_samples * z * sample_bytes));
+        if (!file.read(reinterpret_cast<char*>(samples.data()),
+                       static_cast<std::streamsize>(samples.size()))) {
+            throw std::runtime_error("Failed to read raw volume file " + path);
+        }
+
+        if (format.bits == 8) {
+            for (size_t i = 0; i < count; ++i) {
+                out[i] = values[samples[i]];
+            }
+            return;
+        }
+
+        const size_t high = format.big_endian ? 0 : 1;
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = values[samples[2 * i + high] << 8 | samples[2 * i + (1 - high)]];
+        }
+    });
+}
+
+glm::ivec3 import_vox(VDB& vdb, const std::string& path, const BuildOptions& options) {
+    VoxReader reader(path);
+
+    char magic[4];
+    reader.read(magic, sizeof(magic));
+    if (std::string(magic, sizeof(magic)) != "VOX ") {
+        throw std::runtime_error("Not a .vox file: " + path);
+    }
+    reader.read_i32();  // version
+
+    char id[4];
+    reader.read(id, sizeof(id));
+    if (std::string(id, sizeof(id)) != "MAIN") {
+        throw std::runtime_error(".vox file is corrupt");
+    }
+    uint64_t main_content = static_cast<uint32_t>(reader.read_i32());
+    uint64_t main_children = static_cast<uint32_t>(reader.read_i32());
+    uint64_t main_end = reader.position() + main_content + main_children;
+
+    // the models and scene graph, voxels are only located for now
+    std::vector<VoxModel> models;
+    VoxScene scene;
+    std::optional<glm::ivec3> size;
+    for (uint64_t chunk = reader.position() + main_content; chunk < main_end;) {
+        reader.seek(chunk);
+        reader.read(id, sizeof(id));
+        uint64_t content = static_cast<uint32_t>(reader.read_i32());
+        uint64_t children = static_cast<uint32_t>(reader.read_i32());
+        uint64_t begin = reader.position(), end = begin + content;
+        if (end + children > main_end) {
+            throw std::runtime_error(".vox file is truncated");
+        }
+
+        std::string name(id, sizeof(id));
+        if (name == "SIZE") {
+            size = glm::ivec3(0);
+            for (int axis = 0; axis < 3; ++axis) {
+                (*size)[axis] = reader.read_i32();
+            }
+            if (glm::any(glm::lessThan(*size, glm::ivec3(1)))) {
+                throw std::runtime_error(".vox file is corrupt");
+            }
+        } else if (name == "XYZI") {
+            if (!size) {
+                throw std::runtime_error(".vox model has no SIZE");
+            }
+            uint32_t num_voxels = reader.read_size(end, 4);
+            models.push_back(VoxModel{*size, reader.position(), num_voxels});
+            size.reset();
+        } else if (name == "nTRN") {
+            int32_t node = reader.read_i32();
+            reader.read_dict(end);
+            VoxScene::Transform transform{reader.read_i32(), glm::ivec3(0)};
+            reader.read_i32();  // reserved
+            reader.read_i32();  // layer
+            if (reader.read_size(end) > 0) {
+                auto frame = reader.read_dict(end);
+                if (auto t = frame.find("_t"); t != frame.end()) {
+                    std::istringstream(t->second) >> transform.translation.x
+                        >> transform.translation.y >> transform.translation.z;
+                }
+            }
+            scene.transforms[node] = transform;
+        } else if (name == "nGRP") {
+            int32_t node = reader.read_i32();
+            reader.read_dict(end);
+            auto& group = scene.groups[node];
+            group.resize(reader.read_size(end, 4));
+            for (auto& child : group) {
+                child = reader.read_i32();
+            }
+        } else if (name == "nSHP") {
+            int32_t node = reader.read_i32();
+            reader.read_dict(end);
+            auto& shape_models = scene.shapes[node];
+            for (uint32_t count = reader.read_size(end, 4); count > 0; --count) {
+                shape_models.push_back(reader.read_i32());
+                reader.read_dict(end);
+            }
+        }
+
+        if (reader.position() > end) {
+            throw std::runtime_error(".vox file is corrupt");
+        }
+        chunk = end + children;
+    }
+
+    // without a scene graph every model sits at the origin
+    std::vector<VoxPlacement> placements;
+    if (scene.transforms.empty()) {
+        for (size_t model = 0; model < models.size(); ++model) {
+            placements.push_back(VoxPlacement{model, glm::ivec3(0)});
+        }
+    } else {
+        place_models(scene, 0, glm::ivec3(0), 0, models, placements);
+    }
+
+    if (placements.empty()) {
+        throw std::runtime_error(".vox file has no models");
+    }
+    glm::ivec3 scene_min(std::numeric_limits<int>::max());
+    glm::ivec3 scene_max(std::numeric_limits<int>::min());
+    for (const auto& placement : placements) {
+        scene_min = glm::min(scene_min, placement.min);
+        scene_max = glm::max(scene_max, placement.min + models[placement.model].size);
+    }
+
+    // stream every placed model's XYZI records, 4 bytes each, into points
+    std::vector<VoxelPoint> points;
+    std::vector<std::array<uint8_t, 4>> records;
+    constexpr size_t kBlockVoxels = 1 << 16;
+    for (const auto& placement : placements) {
+        const auto& model = models[placement.model];
+        glm::ivec3 offset = placement.min - scene_min;
+
+        reader.seek(model.voxels_offset);
+        for (size_t done = 0; done < model.num_voxels; done += records.size()) {
+            records.resize(std::min<size_t>(kBlockVoxels, model.num_voxels - done));
+            reader.read(records.data(), records.size() * 4);
+            for (const auto& record : records) {
+                glm::ivec3 local(record[0], record[1], record[2]);
+                if (glm::any(glm::greaterThanEqual(local, model.size))) {
+                    throw std::runtime_error(".vox model has voxels outside of its SIZE");
+                }
+                points.push_back(VoxelPoint{VDB::coord_t(offset + local), record[3]});
+            }
+        }
+    }
+
+    vdb.build_from_points(VDB::coord_t(scene_max - scene_min), points, options);
+    return scene_min;
+}
+
+}  // namespace spor::vox
@@ -0,0 +1,45 @@
+#include <fstream>
+#include <stdexcept>
+
+#include "tiny_obj_loader.h"
+#include "voxel/voxelizer.h"
+
+namespace spor::vox {
+
+TriangleMesh TriangleMesh::from_obj(const std::string& path) {
+    tinyobj::attrib_t attributes;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string err_msg;
+
+    std::ifstream obj_in(path);
+    if (!obj_in) {
+        throw std::runtime_error("Failed to open OBJ file " + path);
+    }
+
+    if (!tinyobj::LoadObj(&attributes, &shapes, &materials, &err_msg, &obj_in)) {
+        throw std::runtime_error("Failed to load OBJ file " + path + ": " + err_msg);
+    }
+
+    // positions only, so vertices are shared between shapes as the file lists them
+    TriangleMesh mesh;
+    mesh.positions.reserve(attributes.vertices.size() / 3);
+    for (size_t i = 0; i + 2 < attributes.vertices.size(); i += 3) {
+        mesh.positions.emplace_back(attributes.vertices[i], attributes.vertices[i + 1],
+                                    attributes.vertices[i + 2]);
+    }
+
+    for (const auto& shape : shapes) {
+        for (const auto& mesh_index : shape.mesh.indices) {
+            if (mesh_index.vertex_index < 0
+                || static_cast<size_t>(mesh_index.vertex_index) >= mesh.positions.size()) {
+                throw std::runtime_error("OBJ file " + path + " references a missing vertex");
+            }
+            mesh.indices.push_back(static_cast<uint32_t>(mesh_index.vertex_index));
+        }
+    }
+
+    return mesh;
+}
+
+}  // namespace spor::vox
@@ -0,0 +1,577 @@
+#include "voxel/paged_vdb.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "voxel/ray_clip.h"
+
+namespace spor::vox {
+
+namespace {
+
+constexpr char kMagic[8] = {'S', 'P', 'O', 'R', 'P', 'A', 'G', 'E'};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kByteOrder = 0x01020304;
+
+constexpr size_t kMaxLevels = 32;
+
+// Followed by the pages' data, then the resident nodes and the page table at the given offsets
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // kByteOrder as written by the host that saved the file
+
+    uint64_t top_offset;
+    uint64_t top_count;
+    uint64_t pages_offset;
+    uint64_t page_count;
+
+    uint32_t node_size;  // sizeof(SVNode)
+    uint32_t height;
+    uint32_t size[3];
+    uint32_t encoding;  // VoxelEncoding
+    uint32_t page_level;
+    uint32_t padding{0};
+
+    uint8_t log2_dims[kMaxLevels];  // NodeConfig::log2_dim of levels 1 to height
+};
+static_assert(sizeof(FileHeader) == 112, "FileHeader has unexpected padding");
+
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+
+// Cache bookkeeping for a page's tree
+size_t page_bytes(const VDB& tree, uint64_t node_count, uint64_t voxel_bytes) {
+    return sizeof(tree) + node_count * sizeof(SVNode) + voxel_bytes;
+}
+
+}  // namespace
+
+void PagedVDB::write(const VDB& vdb, const std::string& path, size_t page_level) {
+    if (vdb.h_nodes_.empty()) {
+        throw std::runtime_error("VDB is empty");
+    }
+    if (page_level < 1 || page_level >= vdb.height_ || vdb.height_ > kMaxLevels) {
+        throw std::invalid_argument("Page level must lie between the leaves and the root");
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Failed to open paged VDB file " + path);
+    }
+
+    FileHeader header{};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Copy the subtree below nodes[index], a node at `level`, into nodes and voxels. Its children
+    // are appended as one array each, so the copy is packed like a build even if `vdb` is a DAG.
+    std::vector<SVNode> nodes;
+    std::vector<uint8_t> voxels;
+    std::function<void(size_t, size_t)> copy_subtree = [&](size_t index, size_t level) {
+        SVNode node = nodes[index];
+        if (detail::is_tile(node)) {
+            return;
+        }
+
+        if (node.is_leaf) {
+            size_t size = vdb.leaf_data_size(node);
+            nodes[index].child_offset = static_cast<uint32_t>(voxels.size());
+            voxels.insert(voxels.end(), vdb.h_voxels_.begin() + node.child_offset,
+                          vdb.h_voxels_.begin() + node.child_offset + size);
+            return;
+        }
+
+        size_t count = detail::popcount(node.child_mask);
+        size_t first = nodes.size();
+        nodes[index].child_offset = static_cast<uint32_t>(first);
+        nodes.insert(nodes.end(), vdb.h_nodes_.begin() + node.child_offset,
+                     vdb.h_nodes_.begin() + node.child_offset + count);
+        for (size_t i = 0; i < count; ++i) {
+            copy_subtree(first + i, level - 1);
+        }
+    };
+
+    // Append a page for `root`, writing its subtree to the file unless it is a tile
+    std::vector<PageEntry> pages;
+    auto write_page = [&](const SVNode& root) {
+        PageEntry entry;
+        entry.root = root;
+        if (!detail::is_tile(root)) {
+            nodes.assign(1, root);
+            voxels.clear();
+            copy_subtree(0, page_level);
+
+            entry.root = nodes.front();
+            entry.file_offset = static_cast<uint64_t>(file.tellp());
+            entry.node_count = nodes.size();
+            entry.voxel_bytes = voxels.size();
+            file.write(reinterpret_cast<const char*>(nodes.data()),
+                       static_cast<std::streamsize>(nodes.size() * sizeof(SVNode)));
+            file.write(reinterpret_cast<const char*>(voxels.data()),
+                       static_cast<std::streamsize>(voxels.size()));
+        }
+        pages.push_back(entry);
+    };
+
+    // Copy the resident levels the same way, the children of nodes right above the page level
+    // becoming pages
+    std::vector<SVNode> top{vdb.h_nodes_.front()};
+    std::function<void(size_t, size_t)> copy_top = [&](size_t index, size_t level) {
+        SVNode node = top[index];
+        if (detail::is_tile(node)) {
+            return;
+        }
+
+        size_t count = detail::popcount(node.child_mask);
+        if (level == page_level + 1) {
+            top[index].child_offset = static_cast<uint32_t>(pages.size());
+            for (size_t i = 0; i < count; ++i) {
+                write_page(vdb.h_nodes_[node.child_offset + i]);
+            }
+            return;
+        }
+
+        size_t first = top.size();
+        top[index].child_offset = static_cast<uint32_t>(first);
+        top.insert(top.end(), vdb.h_nodes_.begin() + node.child_offset,
+                   vdb.h_nodes_.begin() + node.child_offset + count);
+        for (size_t i = 0; i < count; ++i) {
+            copy_top(first + i, level - 1);
+        }
+    };
+    copy_top(0, vdb.height_);
+
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byte_order = kByteOrder;
+    header.node_size = sizeof(SVNode);
+    header.height = static_cast<uint32_t>(vdb.height_);
+    header.size[0] = vdb.size_.x;
+    header.size[1] = vdb.size_.y;
+    header.size[2] = vdb.size_.z;
+    header.encoding = static_cast<uint32_t>(vdb.encoding_);
+    header.page_level = static_cast<uint32_t>(page_level);
+    for (size_t level = 1; level <= vdb.height_; ++level) {
+        header.log2_dims[level - 1] = static_cast<uint8_t>(VDB::config_t::log2_dim(level));
+    }
+
+    header.top_offset = static_cast<uint64_t>(file.tellp());
+    header.top_count = top.size();
+    file.write(reinterpret_cast<const char*>(top.data()),
+               static_cast<std::streamsize>(top.size() * sizeof(SVNode)));
+    header.pages_offset = static_cast<uint64_t>(file.tellp());
+    header.page_count = pages.size();
+    file.write(reinterpret_cast<const char*>(pages.data()),
+               static_cast<std::streamsize>(pages.size() * sizeof(PageEntry)));
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!file.flush()) {
+        throw std::runtime_error("Failed to write paged VDB file " + path);
+    }
+}
+
+PagedVDB::PagedVDB(const std::string& path, size_t budget_bytes)
+    : budget_bytes_(budget_bytes), file_(path, std::ios::binary) {
+    if (!file_) {
+        throw std::runtime_error("Failed to open paged VDB file " + path);
+    }
+
+    file_.seekg(0, std::ios::end);
+    uint64_t file_size = static_cast<uint64_t>(file_.tellg());
+    file_.seekg(0);
+
+    FileHeader header;
+    if (file_size < sizeof(header) || !file_.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        throw std::runtime_error("Not a paged VDB file: " + path);
+    }
+    if (header.version != kVersion) {
+        throw std::runtime_error("Unsupported paged VDB file version "
+                                 + std::to_string(header.version));
+    }
+    if (header.byte_order != kByteOrder || header.node_size != sizeof(SVNode)) {
+        throw std::runtime_error("Paged VDB file was written by an incompatible host");
+    }
+    if (header.height > kMaxLevels || header.page_level < 1 || header.page_level >= header.height
+        || header.encoding > static_cast<uint32_t>(VoxelEncoding::kPalette)) {
+        throw std::runtime_error("Paged VDB file is corrupt");
+    }
+    for (size_t level = 1; level <= header.height; ++level) {
+        if (header.log2_dims[level - 1] != VDB::config_t::log2_dim(level)) {
+            throw std::runtime_error(
+                "Paged VDB file was written with a different node configuration");
+        }
+    }
+
+    // the checks are ordered so that nothing overflows
+    if (header.top_offset > file_size || header.top_count == 0
+        || header.top_count > (file_size - header.top_offset) / sizeof(SVNode)
+        || header.pages_offset > file_size
+        || header.page_count > (file_size - header.pages_offset) / sizeof(PageEntry)) {
+        throw std::runtime_error("Paged VDB file is truncated");
+    }
+
+    top_nodes_.resize(header.top_count);
+    pages_.resize(header.page_count);
+    file_.seekg(static_cast<std::streamoff>(header.top_offset));
+    file_.read(reinterpret_cast<char*>(top_nodes_.data()),
+               static_cast<std::streamsize>(top_nodes_.size() * sizeof(SVNode)));
+    file_.seekg(static_cast<std::streamoff>(header.pages_offset));
+    file_.read(reinterpret_cast<char*>(pages_.data()),
+               static_cast<std::streamsize>(pages_.size() * sizeof(PageEntry)));
+    if (!file_) {
+        throw std::runtime_error("Failed to read paged VDB file " + path);
+    }
+
+    height_ = header.height;
+    size_ = coord_t(header.size[0], header.size[1], header.size[2]);
+    encoding_ = static_cast<VoxelEncoding>(header.encoding);
+    page_level_ = header.page_level;
+
+    // child arrays of the resident nodes have to lie within top_nodes_ or pages_, and pages
+    // within the file. The pages' own arrays are checked as they are read.
+    std::function<bool(const SVNode&, size_t)> valid = [&](const SVNode& node, size_t level) {
+        if (detail::is_tile(node)) {
+            return true;
+        }
+
+        size_t count = detail::popcount(node.child_mask);
+        if (node.is_leaf) {
+            return false;
+        }
+        if (level == page_level_ + 1) {
+            if (node.child_offset + count > pages_.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                const auto& page = pages_[node.child_offset + i];
+                if (page.file_offset > file_size
+                    || page.node_count > (file_size - page.file_offset) / sizeof(SVNode)
+                    || page.voxel_bytes
+                           > file_size - page.file_offset - page.node_count * sizeof(SVNode)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        if (node.child_offset + count > top_nodes_.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (!valid(top_nodes_[node.child_offset + i], level - 1)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (!valid(top_nodes_.front(), height_)) {
+        throw std::runtime_error("Paged VDB file is corrupt");
+    }
+}
+
+const PagedVDB::PageEntry* PagedVDB::find_page(coord_t pos, uint8_t& value) const {
+    SVNode current = top_nodes_.front();
+    for (size_t level = height_; level > page_level_; --level) {
+        if (detail::is_tile(current)) {
+            value = static_cast<uint8_t>(current.child_offset);
+            return nullptr;
+        }
+
+        uint64_t bit = 1ull << detail::child_index(pos, level);
+        if (!(current.child_mask & bit)) {
+            value = 0;
+            return nullptr;
+        }
+
+        size_t offset = current.child_offset + detail::popcount(current.child_mask & (bit - 1));
+        if (level == page_level_ + 1) {
+            const auto& entry = pages_[offset];
+            if (detail::is_tile(entry.root)) {
+                value = static_cast<uint8_t>(entry.root.child_offset);
+                return nullptr;
+            }
+            return &entry;
+        }
+        current = top_nodes_[offset];
+    }
+
+    throw std::runtime_error("Something went wrong while traversing node tree");
+}
+
+void PagedVDB::for_each_node(
+    const std::function<bool(coord_t min, coord_t max)>& visit,
+    const std::function<void(const NodeRef&, const PageEntry*)>& fn) const {
+    std::function<void(const SVNode&, size_t, coord_t)> walk = [&](const SVNode& node,
+                                                                   size_t level, coord_t min) {
+        if (!visit(min, min + detail::node_extent(level))) {
+            return;
+        }
+        if (detail::is_tile(node)) {
+            fn(NodeRef{node, level, min}, nullptr);
+            return;
+        }
+
+        const auto child_extent = detail::node_extent(level - 1);
+        const auto dim = detail::node_dim(level);
+        size_t offset = node.child_offset;
+        for (uint64_t mask = node.child_mask; mask != 0; mask &= mask - 1, ++offset) {
+            coord_t child_min = min + detail::pos_from_index(detail::lowest_bit(mask), dim)
+                                          * child_extent;
+            if (level - 1 > page_level_) {
+                walk(top_nodes_[offset], level - 1, child_min);
+                continue;
+            }
+
+            const auto& entry = pages_[offset];
+            if (visit(child_min, child_min + child_extent)) {
+                fn(NodeRef{entry.root, page_level_, child_min},
+                   detail::is_tile(entry.root) ? nullptr : &entry);
+            }
+        }
+    };
+    walk(top_nodes_.front(), height_, coord_t(0));
+}
+
+PagedVDB::coord_t PagedVDB::page_size(coord_t page_min) const {
+    return glm::min(detail::node_extent(page_level_), size_ - page_min);
+}
+
+std::shared_ptr<const VDB> PagedVDB::acquire(const PageEntry& entry, coord_t page_min) const {
+    const size_t index = &entry - pages_.data();
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        if (auto it = cached_.find(index); it != cached_.end()) {
+            ++stats_.hits;
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->tree;
+        }
+        ++stats_.misses;
+    }
+
+    // read without holding the cache, so that resident pages stay available meanwhile
+    auto tree = std::make_shared<VDB>(nullptr);
+    tree->h_nodes_.resize(entry.node_count);
+    tree->h_voxels_.resize(entry.voxel_bytes);
+    {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        file_.seekg(static_cast<std::streamoff>(entry.file_offset));
+        file_.read(reinterpret_cast<char*>(tree->h_nodes_.data()),
+                   static_cast<std::streamsize>(entry.node_count * sizeof(SVNode)));
+        file_.read(reinterpret_cast<char*>(tree->h_voxels_.data()),
+                   static_cast<std::streamsize>(entry.voxel_bytes));
+        if (!file_) {
+            file_.clear();
+            throw std::runtime_error("Failed to read a page of the paged VDB file");
+        }
+    }
+    if (tree->h_nodes_.empty()
+        || !VDB::child_arrays_valid(tree->h_nodes_, tree->h_voxels_, encoding_)) {
+        throw std::runtime_error("Paged VDB file is corrupt");
+    }
+    tree->height_ = page_level_;
+    tree->size_ = page_size(page_min);
+    tree->encoding_ = encoding_;
+
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if (auto it = cached_.find(index); it != cached_.end()) {
+        // another thread read it meanwhile
+        return it->second->tree;
+    }
+
+    size_t bytes = page_bytes(*tree, entry.node_count, entry.voxel_bytes);
+    while (!lru_.empty() && stats_.resident_bytes + bytes > budget_bytes_) {
+        stats_.resident_bytes -= lru_.back().bytes;
+        --stats_.resident_pages;
+        ++stats_.evictions;
+        cached_.erase(lru_.back().index);
+        lru_.pop_back();
+    }
+
+    lru_.push_front(CachedPage{index, tree, bytes});
+    cached_[index] = lru_.begin();
+    stats_.resident_bytes += bytes;
+    ++stats_.resident_pages;
+    return tree;
+}
+
+uint8_t PagedVDB::get_voxel(coord_t pos) const {
+    if (pos.x >= size_.x || pos.y >= size_.y || pos.z >= size_.z) {
+        throw std::invalid_argument("Voxel pos is out of bounds");
+    }
+
+    uint8_t value = 0;
+    const auto* entry = find_page(pos, value);
+    if (entry == nullptr) {
+        return value;
+    }
+
+    const uint32_t shift = detail::Config::log2_extent(page_level_);
+    coord_t page_min = (pos >> shift) << shift;
+    return acquire(*entry, page_min)->get_voxel(pos - page_min);
+}
+
+std::optional<RayHit> PagedVDB::raycast(glm::vec3 origin, glm::vec3 dir, float tmax) const {
+    // clip the ray against the volume, remembering the face it enters through
+    auto clip = detail::clip_ray(origin, dir, tmax, size_);
+    if (!clip) {
+        return std::nullopt;
+    }
+
+    glm::ivec3 step;
+    glm::vec3 inv_dir;
+    for (int axis = 0; axis < 3; ++axis) {
+        step[axis] = dir[axis] > 0.f ? 1 : dir[axis] < 0.f ? -1 : 0;
+        inv_dir[axis] = step[axis] != 0 ? 1.f / dir[axis] : kInfinity;
+    }
+
+    // a DDA over the grid of pages, computing each crossing from the face so that it can't drift
+    const int extent = static_cast<int>(detail::node_extent(page_level_).x);
+    const glm::ivec3 grid = (glm::ivec3(size_) + extent - 1) / extent;
+    auto crossing = [&](glm::ivec3 cell, int axis) {
+        if (step[axis] == 0) {
+            return kInfinity;
+        }
+        return ((cell[axis] + (step[axis] > 0)) * extent - origin[axis]) * inv_dir[axis];
+    };
+
+    glm::vec3 entry = origin + dir * clip->t_enter;
+    glm::ivec3 cell;
+    glm::vec3 t_next;
+    for (int axis = 0; axis < 3; ++axis) {
+        cell[axis] = std::clamp(static_cast<int>(std::floor(entry[axis] / extent)), 0,
+                                grid[axis] - 1);
+        t_next[axis] = crossing(cell, axis);
+    }
+
+    float t = clip->t_enter;
+    glm::ivec3 normal = detail::face_normal(clip->axis, dir);
+    while (t < clip->t_exit) {
+        coord_t page_min(cell * extent);
+        uint8_t value = 0;
+        if (const auto* page = find_page(page_min, value)) {
+            auto tree = acquire(*page, page_min);
+            auto hit = tree->raycast(origin - glm::vec3(page_min), dir, tmax);
+            if (hit) {
+                hit->voxel += page_min;
+                return hit;
+            }
+        } else if (value != 0) {
+            // the voxel the ray enters the tile at
+            glm::ivec3 voxel = glm::ivec3(glm::floor(origin + dir * t));
+            voxel = glm::clamp(voxel, glm::ivec3(page_min),
+                               glm::ivec3(page_min + page_size(page_min)) - 1);
+            return RayHit{coord_t(voxel), value, normal, t};
+        }
+
+        float t_cell_exit = std::min({t_next.x, t_next.y, t_next.z});
+        int crossed = -1;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (t_next[axis] == t_cell_exit) {
+                cell[axis] += step[axis];
+                t_next[axis] = crossing(cell, axis);
+                crossed = crossed < 0 ? axis : crossed;
+            }
+        }
+        if (glm::any(glm::lessThan(cell, glm::ivec3(0)))
+            || glm::any(glm::greaterThanEqual(cell, grid))) {
+            break;
+        }
+
+        t = t_cell_exit;
+        normal = detail::face_normal(crossed, dir);
+    }
+
+    return std::nullopt;
+}
+
+void PagedVDB::for_each_leaf(const std::function<void(const NodeRef&)>& fn) const {
+    auto all = [](coord_t, coord_t) { return true; };
+    for_each_node(all, [&](const NodeRef& ref, const PageEntry* entry) {
+        if (entry == nullptr) {
+            fn(ref);
+            return;
+        }
+
+        auto tree = acquire(*entry, ref.min);
+        for (auto leaf : tree->leaves()) {
+            leaf.min += ref.min;
+            fn(leaf);
+        }
+    });
+}
+
+void PagedVDB::prefetch(coord_t min, coord_t max) const {
+    auto intersects = [&](coord_t node_min, coord_t node_max) {
+        return glm::all(glm::lessThan(node_min, max)) && glm::all(glm::lessThan(min, node_max));
+    };
+    for_each_node(intersects, [&](const NodeRef& ref, const PageEntry* entry) {
+        if (entry != nullptr) {
+            acquire(*entry, ref.min);
+        }
+    });
+}
+
+void PagedVDB::prefetch(const glm::mat4& mvp) const {
+    // the frustum's planes in voxel space, inside where dot(plane, (p, 1)) >= 0, with Vulkan's
+    // depth range of [0, 1]
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+    }
+    const glm::vec4 planes[6] = {rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1],
+                                 rows[3] - rows[1], rows[2],           rows[3] - rows[2]};
+
+    auto intersects = [&](coord_t node_min, coord_t node_max) {
+        for (const auto& plane : planes) {
+            // the box corner furthest along the plane's normal
+            glm::vec3 corner;
+            for (int axis = 0; axis < 3; ++axis) {
+                corner[axis] = static_cast<float>(plane[axis] >= 0.f ? node_max[axis]
+                                                                     : node_min[axis]);
+            }
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.f) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // by the clip space w of their centers, their depth along the view direction
+    struct Visible {
+        float depth;
+        coord_t min;
+        const PageEntry* entry;
+    };
+    std::vector<Visible> visible;
+    const glm::vec3 half_extent = glm::vec3(detail::node_extent(page_level_)) / 2.f;
+    for_each_node(intersects, [&](const NodeRef& ref, const PageEntry* entry) {
+        if (entry != nullptr) {
+            glm::vec4 center(glm::vec3(ref.min) + half_extent, 1.f);
+            visible.push_back(Visible{(mvp * center).w, ref.min, entry});
+        }
+    });
+
+    // furthest first, so that the nearest pages are the most recently used ones
+    std::sort(visible.begin(), visible.end(),
+              [](const Visible& a, const Visible& b) { return a.depth > b.depth; });
+    for (const auto& page : visible) {
+        acquire(*page.entry, page.min);
+    }
+}
+
+PagingStats PagedVDB::stats() const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    return stats_;
+}
+
+void PagedVDB::reset_stats() {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    stats_.hits = 0;
+    stats_.misses = 0;
+    stats_.evictions = 0;
+}
+
+}  // namespace spor::vox
@@ -0,0 +1,160 @@
+#include "voxel/vdb.h"
+
+#include <stdexcept>
+
+namespace spor::vox {
+
+NodeIterator::NodeIterator(const VDB& vdb, const NodeRef& root, size_t stop_level, bool tiles)
+    : vdb_(&vdb), stop_level_(stop_level), tiles_(tiles) {
+    if (!detail::is_active(root.node)) {
+        vdb_ = nullptr;
+    } else if (visits(root)) {
+        current_ = root;
+    } else {
+        enter(root);
+        advance();
+    }
+}
+
+void NodeIterator::enter(const NodeRef& ref) {
+    // tiles have no children, a tile above stop_level_ is skipped unless tiles_ is set
+    if (!detail::is_tile(ref.node)) {
+        stack_.push_back({ref, ref.node.child_mask, ref.node.child_offset});
+    }
+}
+
+void NodeIterator::advance() {
+    while (!stack_.empty()) {
+        auto& top = stack_.back();
+        if (top.remaining == 0) {
+            stack_.pop_back();
+            continue;
+        }
+
+        // children are stored in the order of their bits, so the next one follows the last
+        auto index = detail::lowest_bit(top.remaining);
+        top.remaining &= top.remaining - 1;
+
+        size_t level = top.ref.level - 1;
+        NodeRef child{vdb_->h_nodes_[top.next_offset++], level,
+                      top.ref.min
+                          + detail::pos_from_index(index, detail::node_dim(top.ref.level))
+                                * detail::node_extent(level)};
+        if (visits(child)) {
+            current_ = child;
+            return;
+        }
+        enter(child);
+    }
+
+    vdb_ = nullptr;
+}
+
+VoxelIterator::VoxelIterator(const VDB& vdb) : vdb_(&vdb), leaf_(vdb.leaves().begin()) {
+    enter_leaf();
+}
+
+void VoxelIterator::enter_leaf() {
+    for (; leaf_ != NodeIterator(); ++leaf_) {
+        const auto& leaf = *leaf_;
+        if (detail::is_tile(leaf.node)) {
+            tile_min_ = leaf.min;
+            tile_max_ = glm::min(leaf.min + detail::node_extent(leaf.level), vdb_->size_);
+            if (glm::all(glm::lessThan(tile_min_, tile_max_))) {
+                current_ = {tile_min_, static_cast<uint8_t>(leaf.node.child_offset)};
+                return;
+            }
+        } else if (leaf.node.child_mask != 0) {
+            remaining_ = leaf.node.child_mask;
+            index_ = 0;
+            next_voxel();
+            return;
+        }
+    }
+
+    vdb_ = nullptr;
+}
+
+void VoxelIterator::next_voxel() {
+    const SVNode& leaf = leaf_->node;
+    auto bit = detail::lowest_bit(remaining_);
+    remaining_ &= remaining_ - 1;
+
+    current_.pos = leaf_->min + detail::pos_from_index(bit, detail::node_dim(1));
+    current_.value = vdb_->encoding_ == VoxelEncoding::kPalette
+                         ? palette::decode_leaf(vdb_->h_voxels_.data() + leaf.child_offset, index_)
+                         : vdb_->h_voxels_[leaf.child_offset + index_];
+    ++index_;
+}
+
+void VoxelIterator::advance() {
+    if (detail::is_tile(leaf_->node)) {
+        // x-major through the part of the tile inside the volume
+        auto& pos = current_.pos;
+        if (++pos.x < tile_max_.x) {
+            return;
+        }
+        pos.x = tile_min_.x;
+        if (++pos.y < tile_max_.y) {
+            return;
+        }
+        pos.y = tile_min_.y;
+        if (++pos.z < tile_max_.z) {
+            return;
+        }
+    } else if (remaining_ != 0) {
+        next_voxel();
+        return;
+    }
+
+    ++leaf_;
+    enter_leaf();
+}
+
+NodeRange VDB::nodes(size_t level) const {
+    if (h_nodes_.empty()) {
+        throw std::runtime_error("VDB is empty");
+    }
+    if (level < 1 || level > height_) {
+        throw std::invalid_argument("Level is outside of the tree");
+    }
+
+    NodeRef root{h_nodes_.front(), height_, coord_t(0)};
+    return {NodeIterator(*this, root, level, false), NodeIterator()};
+}
+
+NodeRange VDB::leaves() const {
+    if (h_nodes_.empty()) {
+        throw std::runtime_error("VDB is empty");
+    }
+
+    NodeRef root{h_nodes_.front(), height_, coord_t(0)};
+    return {NodeIterator(*this, root, 1, true), NodeIterator()};
+}
+
+VoxelRange VDB::active_voxels() const { return {VoxelIterator(*this), VoxelIterator()}; }
+
+void VDB::for_each_leaf(const std::function<void(const NodeRef&)>& fn, size_t num_threads) const {
+    num_threads = detail::resolve_num_threads(num_threads);
+    if (num_threads == 1 || height_ < 2) {
+        for (const auto& leaf : leaves()) {
+            fn(leaf);
+        }
+        return;
+    }
+
+    // the root's active children, tiles included, are the units of work
+    std::vector<NodeRef> subtrees;
+    NodeRef root{h_nodes_.front(), height_, coord_t(0)};
+    for (NodeIterator it(*this, root, height_ - 1, true); it != NodeIterator(); ++it) {
+        subtrees.push_back(*it);
+    }
+
+    detail::parallel_for(subtrees.size(), num_threads, [&](size_t i, size_t) {
+        for (NodeIterator it(*this, subtrees[i], 1, true); it != NodeIterator(); ++it) {
+            fn(*it);
+        }
+    });
+}
+
+}  // namespace spor::vox
@@ -2,143 +2,1024 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <bitset>
-#include <cmath>
+#include <cstring>
+#include <exception>
 #include <iostream>
+#include <map>
 #include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#    define SPOR_VOX_HAS_SSE2
+#    include <emmintrin.h>
+#endif
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#    define SPOR_VOX_HAS_SSSE3
+#    include <tmmintrin.h>
+#endif
 
 namespace spor::vox {
 
 namespace {
 
-VDB::coord_t pos_from_index(size_t index, VDB::coord_t size) {
-    return VDB::coord_t(index % size.x, (index / size.x) % size.y, index / (size.x * size.y));
-}
+// Assembles a tree bottom-up from z-slices of leaves. Each level keeps a band of node slices as
+// deep as one of its parents; once a band is full (or the volume ends) the parents are built from
+// it and passed on as one slice of the level above, so memory stays bounded by a single band per
+// level.
+class SlabBuilder {
+public:
+    SlabBuilder(VDB::coord_t dims, size_t height, std::vector<SVNode>& nodes,
+                std::vector<uint8_t>& voxel_data)
+        : dims_(dims),
+          height_(height),
+          nodes_(nodes),
+          voxel_data_(voxel_data),
+          grid_(height + 1),
+          bands_(height + 1),
+          band_slices_(height + 1, 0) {
+        for (size_t level = 1; level <= height_; ++level) {
+            auto extent = detail::node_extent(level);
+            grid_[level] = (dims_ + extent - 1u) / extent;
+            if (level < height_) {
+                bands_[level].resize(static_cast<size_t>(grid_[level].x) * grid_[level].y
+                                     * Config::dim(level + 1));
+            }
+        }
+    }
+
+    // Depth of the slab the next add_slab call consumes
+    uint32_t next_slab_depth() const {
+        return std::min(detail::node_extent(1).z, dims_.z - next_slab_z());
+    }
+
+    uint32_t next_slab_z() const { return leaf_slices_ * detail::node_extent(1).z; }
+
+    bool done() const { return leaf_slices_ == grid_[1].z; }
+
+    // Build the next slice of leaves from a slab of next_slab_depth() voxels along z, whose voxel
+    // (x, y, z) is slab[x * strides.x + y * strides.y + z * strides.z].
+    void add_slab(const uint8_t* slab, glm::u64vec3 strides) {
+        const auto leaf_extent = detail::node_extent(1);
+        const uint32_t depth = next_slab_depth();
+
+        auto fill_leaf = [&](VDB::coord_t leaf_min, uint8_t* out) {
+            auto extent = glm::min(leaf_extent, dims_ - leaf_min);
+            extent.z = depth;
+            if (extent != leaf_extent) {
+                std::memset(out, 0, detail::kLeafVoxels);
+            }
+
+            for (size_t z = 0; z < extent.z; ++z) {
+                for (size_t y = 0; y < extent.y; ++y) {
+                    auto* dst = out + detail::pos_to_index(VDB::coord_t(0, y, z), leaf_extent);
+                    const auto* src = slab + leaf_min.x * strides.x + (leaf_min.y + y) * strides.y
+                                      + z * strides.z;
+                    if (strides.x == 1) {
+                        std::memcpy(dst, src, extent.x);
+                    } else {
+                        for (size_t x = 0; x < extent.x; ++x) {
+                            dst[x] = src[x * strides.x];
+                        }
+                    }
+                }
+            }
+        };
+
+        for (uint32_t y = 0; y < grid_[1].y; ++y) {
+            for (uint32_t x = 0; x < grid_[1].x; ++x) {
+                // only x and y of leaf_min are used, the slab starts at the leaf's z
+                auto leaf_min = VDB::coord_t(x, y, 0) * leaf_extent;
+                place(1, x, y, detail::generate_leaf(voxel_data_, leaf_min, fill_leaf));
+            }
+        }
+
+        ++leaf_slices_;
+        complete_slice(1);
+    }
+
+    // Build the parents of every partially filled band and return the root.
+    SVNode finish() {
+        for (size_t level = 1; level < height_; ++level) {
+            if (band_slices_[level] > 0) {
+                assemble(level);
+            }
+        }
+
+        return root_;
+    }
+
+private:
+    using Config = detail::Config;
+
+    void place(size_t level, uint32_t x, uint32_t y, const SVNode& node) {
+        if (level == height_) {
+            root_ = node;
+            return;
+        }
+
+        auto& grid = grid_[level];
+        bands_[level][(static_cast<size_t>(band_slices_[level]) * grid.y + y) * grid.x + x] = node;
+    }
+
+    void complete_slice(size_t level) {
+        if (level < height_ && ++band_slices_[level] == Config::dim(level + 1)) {
+            assemble(level);
+        }
+    }
+
+    // Build a slice of nodes at level + 1 from the band at `level`
+    void assemble(size_t level) {
+        const uint32_t dim = Config::dim(level + 1);
+        const auto& grid = grid_[level];
+        const auto& band = bands_[level];
+
+        for (uint32_t py = 0; py < grid_[level + 1].y; ++py) {
+            for (uint32_t px = 0; px < grid_[level + 1].x; ++px) {
+                SVNode node{0, 0, 0};
+                node.is_leaf = false;
+                children_.clear();
+
+                for (uint32_t z = 0; z < band_slices_[level]; ++z) {
+                    for (uint32_t cy = 0; cy < dim; ++cy) {
+                        for (uint32_t cx = 0; cx < dim; ++cx) {
+                            uint32_t x = px * dim + cx, y = py * dim + cy;
+                            if (x >= grid.x || y >= grid.y) {
+                                continue;
+                            }
+
+                            const auto& child
+                                = band[(static_cast<size_t>(z) * grid.y + y) * grid.x + x];
+                            if (detail::is_active(child)) {
+                                node.child_mask |= 1ull << (cx + (cy + z * dim) * dim);
+                                children_.push_back(child);
+                            }
+                        }
+                    }
+                }
+
+                if (detail::uniform_tiles(children_, level + 1)) {
+                    place(level + 1, px, py, children_.front());
+                    continue;
+                }
+
+                node.child_offset = nodes_.size();
+                nodes_.insert(nodes_.end(), children_.begin(), children_.end());
+                place(level + 1, px, py, node);
+            }
+        }
+
+        band_slices_[level] = 0;
+        complete_slice(level + 1);
+    }
+
+    VDB::coord_t dims_;
+    size_t height_;
+    std::vector<SVNode>& nodes_;
+    std::vector<uint8_t>& voxel_data_;
+
+    std::vector<VDB::coord_t> grid_;          // nodes along each axis, per level
+    std::vector<std::vector<SVNode>> bands_;  // [z][y][x] pending nodes, per level
+    std::vector<uint32_t> band_slices_;       // slices filled in each band
+    std::vector<SVNode> children_;            // scratch for assemble
+    uint32_t leaf_slices_{0};
 
-size_t pos_to_index(VDB::coord_t pos, VDB::coord_t size) {
-    return pos.x + pos.y * size.x + pos.z * size.x * size.y;
+    SVNode root_{0, 0, 0};
+};
+
+struct KeyedVoxel {
+    uint64_t key;
+    uint8_t value;
+};
+
+// Run fn(chunk, begin, end) over `num_threads` contiguous chunks of [0, count), one per thread
+template <typename Fn> void for_each_chunk(size_t num_threads, size_t count, Fn&& fn) {
+    auto chunk_begin = [&](size_t chunk) { return count * chunk / num_threads; };
+    detail::parallel_for(num_threads, num_threads, [&](size_t chunk, size_t) {
+        fn(chunk, chunk_begin(chunk), chunk_begin(chunk + 1));
+    });
 }
 
-VDB::coord_t node_size_at_level(size_t level, VDB::coord_t base_size) {
-    if (level == 0) {
-        return VDB::coord_t(1);
-    } else {
-        return base_size * node_size_at_level(level - 1, base_size);
+// Stable LSD radix sort on the low `key_bits` bits of the keys, one byte per pass
+void radix_sort(std::vector<KeyedVoxel>& items, size_t key_bits, size_t num_threads) {
+    constexpr size_t kMinItemsPerThread = 1 << 16;
+    num_threads = std::clamp<size_t>(items.size() / kMinItemsPerThread, 1, num_threads);
+
+    std::vector<KeyedVoxel> scratch(items.size());
+    std::vector<std::array<size_t, 256>> offsets(num_threads);
+
+    for (size_t shift = 0; shift < key_bits; shift += 8) {
+        for_each_chunk(num_threads, items.size(), [&](size_t t, size_t begin, size_t end) {
+            offsets[t].fill(0);
+            for (size_t i = begin; i < end; ++i) {
+                ++offsets[t][(items[i].key >> shift) & 0xFF];
+            }
+        });
+
+        // digit-major, then thread order, which keeps equal keys in input order
+        size_t total = 0;
+        bool single_digit = false;
+        for (size_t digit = 0; digit < 256; ++digit) {
+            size_t digit_count = 0;
+            for (size_t t = 0; t < num_threads; ++t) {
+                size_t count = offsets[t][digit];
+                offsets[t][digit] = total;
+                total += count;
+                digit_count += count;
+            }
+            single_digit |= digit_count == items.size();
+        }
+
+        if (single_digit) {
+            continue;  // the pass would not move anything
+        }
+
+        for_each_chunk(num_threads, items.size(), [&](size_t t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                scratch[offsets[t][(items[i].key >> shift) & 0xFF]++] = items[i];
+            }
+        });
+        items.swap(scratch);
     }
 }
 
-template <size_t N> void pack_left(std::array<uint8_t, N>& data, uint64_t mask) {
-    for (size_t i = 0, j = 0; i < N && mask != 0; ++i) {
-        data[j] = data[i];
-        j += mask & 1;
-        mask >>= 1;
+
+// Stores ranges of a vector once: a range appended at its end is looked up among the previously
+// interned ones and dropped again if it is a duplicate.
+template <typename T> class RangeInterner {
+public:
+    explicit RangeInterner(std::vector<T>& data)
+        : data_(data), ranges_(0, Hash{data}, Equal{data}) {}
+
+    // Intern [begin, data.size()) and return the offset it is stored at
+    size_t intern(size_t begin) {
+        Range range{begin, data_.size() - begin};
+        auto [it, inserted] = ranges_.insert(range);
+        if (!inserted) {
+            data_.resize(begin);
+        }
+        return it->offset;
+    }
+
+private:
+    struct Range {
+        size_t offset;
+        size_t count;
+    };
+
+    static std::string_view bytes(const std::vector<T>& data, const Range& range) {
+        return std::string_view(reinterpret_cast<const char*>(data.data() + range.offset),
+                                range.count * sizeof(T));
+    }
+
+    struct Hash {
+        const std::vector<T>& data;
+        size_t operator()(const Range& range) const {
+            return std::hash<std::string_view>()(bytes(data, range));
+        }
+    };
+
+    struct Equal {
+        const std::vector<T>& data;
+        bool operator()(const Range& a, const Range& b) const {
+            return bytes(data, a) == bytes(data, b);
+        }
+    };
+
+    std::vector<T>& data_;
+    std::unordered_set<Range, Hash, Equal> ranges_;
+};
+
+// Writes subtrees into a dense box, see VDB::copy_to_dense
+class DenseWriter {
+public:
+    DenseWriter(VDB::coord_t min, VDB::coord_t max, uint8_t* out, glm::u64vec3 strides,
+                const std::vector<SVNode>& nodes, const std::vector<uint8_t>& voxels,
+                VoxelEncoding encoding)
+        : min_(min),
+          max_(max),
+          out_(out),
+          strides_(strides),
+          nodes_(nodes),
+          voxels_(voxels),
+          encoding_(encoding) {
+        for (size_t i = 0; i < detail::kLeafVoxels; ++i) {
+            glm::u64vec3 local(detail::pos_from_index(i, detail::node_dim(1)));
+            leaf_offsets_[i] = local.x * strides_.x + local.y * strides_.y + local.z * strides_.z;
+        }
+    }
+
+    // Set the voxels in [lo, hi), which lies within the box, to `value`
+    void fill(VDB::coord_t lo, VDB::coord_t hi, uint8_t value) const {
+        for (uint32_t z = lo.z; z < hi.z; ++z) {
+            for (uint32_t y = lo.y; y < hi.y; ++y) {
+                uint8_t* row = at({lo.x, y, z});
+                if (strides_.x == 1) {
+                    std::memset(row, value, hi.x - lo.x);
+                } else {
+                    for (uint32_t x = 0; x < hi.x - lo.x; ++x) {
+                        row[x * strides_.x] = value;
+                    }
+                }
+            }
+        }
+    }
+
+    // Write the active voxels of the node at `level` whose box starts at `node_min`, the empty
+    // ones are expected to be cleared already
+    void write(const SVNode& node, size_t level, VDB::coord_t node_min) const {
+        auto lo = glm::max(node_min, min_);
+        auto hi = glm::min(node_min + detail::node_extent(level), max_);
+        if (glm::any(glm::greaterThanEqual(lo, hi))) {
+            return;
+        }
+
+        if (detail::is_tile(node)) {
+            fill(lo, hi, static_cast<uint8_t>(node.child_offset));
+            return;
+        }
+
+        if (level == 1) {
+            const uint8_t* data = voxels_.data() + node.child_offset;
+            size_t index = 0;
+
+            // a leaf inside the box is scattered without clipping
+            if (lo == node_min && hi == node_min + detail::node_extent(1)) {
+                uint8_t* base = at(node_min);
+                for (uint64_t remaining = node.child_mask; remaining; remaining &= remaining - 1) {
+                    base[leaf_offsets_[detail::lowest_bit(remaining)]]
+                        = encoding_ == VoxelEncoding::kPalette ? palette::decode_leaf(data, index)
+                                                               : data[index];
+                    ++index;
+                }
+                return;
+            }
+
+            for (uint64_t remaining = node.child_mask; remaining; remaining &= remaining - 1) {
+                auto pos = node_min
+                           + detail::pos_from_index(detail::lowest_bit(remaining),
+                                                    detail::node_dim(1));
+                uint8_t value = encoding_ == VoxelEncoding::kPalette
+                                    ? palette::decode_leaf(data, index)
+                                    : data[index];
+                ++index;
+                if (glm::all(glm::greaterThanEqual(pos, lo)) && glm::all(glm::lessThan(pos, hi))) {
+                    *at(pos) = value;
+                }
+            }
+            return;
+        }
+
+        size_t offset = node.child_offset;
+        for (uint64_t remaining = node.child_mask; remaining; remaining &= remaining - 1) {
+            auto child_min = node_min
+                             + detail::pos_from_index(detail::lowest_bit(remaining),
+                                                      detail::node_dim(level))
+                                   * detail::node_extent(level - 1);
+            write(nodes_[offset++], level - 1, child_min);
+        }
+    }
+
+private:
+    uint8_t* at(VDB::coord_t pos) const {
+        glm::u64vec3 local(pos - min_);
+        return out_ + local.x * strides_.x + local.y * strides_.y + local.z * strides_.z;
+    }
+
+    VDB::coord_t min_, max_;
+    uint8_t* out_;
+    glm::u64vec3 strides_;
+
+    const std::vector<SVNode>& nodes_;
+    const std::vector<uint8_t>& voxels_;
+    VoxelEncoding encoding_;
+
+    // where each voxel of a leaf goes relative to the leaf's first one
+    std::array<size_t, detail::kLeafVoxels> leaf_offsets_;
+};
+
+// Dirty ranges at most this many bytes apart are uploaded as one region, copying a few clean bytes
+// along is cheaper than another region
+constexpr size_t kRegionGapBytes = 256;
+
+// Make sure `buffer` holds at least `count` elements. It is recreated with at least twice its
+// capacity so that a growing tree is reallocated only a logarithmic number of times, and the old
+// contents are copied over on the device unless all of them are about to be uploaded anyway.
+bool reserve_device_buffer(vk::SurfaceDevice::ptr device, vk::CommandPool::ptr cmd_pool,
+                           vk::Buffer::ptr& buffer, size_t count, size_t element_size,
+                           DirtyRanges& dirty) {
+    if (buffer && buffer->element_count >= count) {
+        return false;
+    }
+
+    size_t capacity = buffer ? std::max(count, 2 * buffer->element_count) : count;
+    auto grown = vk::create_storage_buffer(device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, capacity,
+                                           element_size);
+
+    if (!buffer) {
+        dirty.mark_all();
+    } else if (!dirty.all()) {
+        auto copy_cmd = vk::buffer_memcpy(device, cmd_pool, buffer, grown, buffer->size());
+        vk::submit_commands(copy_cmd, device->queues.graphics.queue);
     }
+
+    buffer = grown;
+    return true;
 }
 
-// Build a tree and return the root node, which will be at the requested level.
-// As it's based on SVNode, we hardcode 4^3=64 children per node.
-SVNode generate_tree(std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data, size_t level,
-                     VDB::coord_t min, const std::function<uint8_t(VDB::coord_t)>& sampler) {
-    constexpr size_t kNumChildren = sizeof(decltype(SVNode::child_mask)) * 8;
-    constexpr VDB::coord_t kSize(4);
+}  // namespace
 
-    SVNode node{0, 0, 0};
+namespace detail {
+
+size_t resolve_num_threads(size_t num_threads) {
+    return num_threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : num_threads;
+}
+
+void parallel_for(size_t num_items, size_t num_threads,
+                  const std::function<void(size_t item, size_t thread)>& fn) {
+    num_threads = std::min(resolve_num_threads(num_threads), std::max<size_t>(num_items, 1));
 
-    if (level == 1) {  // level 0 contains voxels, so level 1 nodes are leaf nodes
-        node.is_leaf = true;
-        node.child_offset = voxel_data.size();
+    std::atomic<size_t> next_item{0};
+    std::exception_ptr error;
+    std::atomic_flag error_set = ATOMIC_FLAG_INIT;
 
-        std::array<uint8_t, kNumChildren> voxels;
-        for (size_t i = 0; i < kNumChildren; ++i) {
-            uint8_t voxel = sampler(min + pos_from_index(i, kSize));
-            if (voxel != 0) {
-                node.child_mask |= 1ull << i;
-                voxels[i] = voxel;
+    auto worker = [&](size_t thread) {
+        try {
+            for (size_t item = next_item++; item < num_items; item = next_item++) {
+                fn(item, thread);
             }
+        } catch (...) {
+            if (!error_set.test_and_set()) {
+                error = std::current_exception();
+            }
+            next_item = num_items;  // stop the other workers early
         }
+    };
 
-        pack_left(voxels, node.child_mask);
-        voxel_data.insert(voxel_data.end(), voxels.begin(),
-                          voxels.begin() + std::bitset<kNumChildren>(node.child_mask).count());
+    std::vector<std::thread> workers;
+    for (size_t thread = 1; thread < num_threads; ++thread) {
+        workers.emplace_back(worker, thread);
+    }
+    worker(0);
+    for (auto& thread : workers) {
+        thread.join();
+    }
 
-        return node;
-    } else {
-        node.is_leaf = false;
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
 
-        std::vector<SVNode> children;
-        children.reserve(kNumChildren);
-        for (size_t i = 0; i < kNumChildren; ++i) {
-            auto child_local_pos = pos_from_index(i, kSize);
-            auto child = generate_tree(nodes, voxel_data, level - 1,
-                                       min + child_local_pos * node_size_at_level(level - 1, kSize),
-                                       sampler);
+uint64_t active_mask(const uint8_t* voxels, size_t count) {
+    uint64_t mask = 0;
+    size_t i = 0;
+#ifdef SPOR_VOX_HAS_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(voxels + i));
+        uint32_t zeros = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero)));
+        mask |= static_cast<uint64_t>(~zeros & 0xFFFFu) << i;
+    }
+#endif
+    for (; i < count; ++i) {
+        mask |= static_cast<uint64_t>(voxels[i] != 0) << i;
+    }
+    return mask;
+}
 
-            if (child.child_mask != 0) {
-                node.child_mask |= 1ull << i;
+#ifdef SPOR_VOX_HAS_SSSE3
+// Shuffle that moves the bytes selected by an 8 bit mask to the front, in order
+struct CompressTable {
+    uint8_t shuffles[256][8];
 
-                children.push_back(child);
+    constexpr CompressTable() : shuffles() {
+        for (size_t bits = 0; bits < 256; ++bits) {
+            size_t j = 0;
+            for (size_t i = 0; i < 8; ++i) {
+                if (bits & (size_t(1) << i)) {
+                    shuffles[bits][j++] = static_cast<uint8_t>(i);
+                }
+            }
+            for (; j < 8; ++j) {
+                shuffles[bits][j] = 0x80;  // zeroed by pshufb
             }
         }
+    }
+};
 
-        node.child_offset = nodes.size();
-        nodes.insert(nodes.end(), children.begin(), children.end());
+constexpr CompressTable kCompressTable{};
+#endif
+
+// Move the voxels whose bit is set in `mask` to the front of `voxels`, keeping their order, and
+// return how many there are. Works in place: every store lands on bytes that were already read.
+size_t compress_active(uint8_t* voxels, size_t count, uint64_t mask) {
+    size_t i = 0, j = 0;
+#ifdef SPOR_VOX_HAS_SSSE3
+    for (; i + 8 <= count; i += 8) {
+        auto bits = static_cast<uint8_t>(mask >> i);
+        __m128i chunk = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(voxels + i));
+        __m128i shuffle
+            = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(kCompressTable.shuffles[bits]));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(voxels + j), _mm_shuffle_epi8(chunk, shuffle));
+        j += std::bitset<8>(bits).count();
+    }
+#endif
+    for (; i < count; ++i) {
+        voxels[j] = voxels[i];
+        j += (mask >> i) & 1;
     }
+    return j;
+}
 
-    return node;
+namespace {
+
+// Shift the offsets of a node generated into standalone buffers so that it stays valid once those
+// buffers are appended after `node_base` nodes and `voxel_base` voxels.
+void relocate(SVNode& node, size_t node_base, size_t voxel_base) {
+    if (is_tile(node)) {
+        return;
+    }
+    node.child_offset += node.is_leaf ? voxel_base : node_base;
 }
 
-double log_n(double n, double val) { return std::log(val) / std::log(n); }
+// Build the root at `level` with its children generated on `num_threads` threads by
+// `generate_subtree(nodes, voxel_data, level, min)`. Each subtree is built into its own buffers and
+// they are merged in child order afterwards, which yields exactly the layout of a serial build.
+SVNode generate_tree_parallel(std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data,
+                              size_t level, size_t num_threads, const BuildContext& ctx,
+                              const SubtreeFn& generate_subtree) {
+    struct Subtree {
+        SVNode root;
+        std::vector<SVNode> nodes;
+        std::vector<uint8_t> voxels;
+    };
+
+    const size_t num_children = Config::num_children(level);
+
+    std::vector<Subtree> subtrees(num_children);
+    parallel_for(num_children, num_threads, [&](size_t i, size_t) {
+        auto& subtree = subtrees[i];
+        auto min = pos_from_index(i, node_dim(level)) * node_extent(level - 1);
+        if (!generate_known_region(subtree.nodes, subtree.voxels, level - 1, min, ctx,
+                                   subtree.root)) {
+            subtree.root = generate_subtree(subtree.nodes, subtree.voxels, level - 1, min);
+        }
+    });
+
+    SVNode node{0, 0, 0};
+
+    std::vector<SVNode> children;
+    children.reserve(num_children);
+    for (size_t i = 0; i < num_children; ++i) {
+        auto& subtree = subtrees[i];
+
+        size_t node_base = nodes.size();
+        size_t voxel_base = voxel_data.size();
+        for (auto& child : subtree.nodes) {
+            relocate(child, node_base, voxel_base);
+        }
+        relocate(subtree.root, node_base, voxel_base);
+
+        nodes.insert(nodes.end(), subtree.nodes.begin(), subtree.nodes.end());
+        voxel_data.insert(voxel_data.end(), subtree.voxels.begin(), subtree.voxels.end());
+
+        if (is_active(subtree.root)) {
+            node.child_mask |= 1ull << i;
+
+            children.push_back(subtree.root);
+        }
+
+        subtree = {};  // release the merged buffers early
+    }
+
+    if (uniform_tiles(children, level)) {
+        return children.front();
+    }
+
+    node.child_offset = nodes.size();
+    nodes.insert(nodes.end(), children.begin(), children.end());
+
+    return node;
+}
 
 }  // namespace
 
+SVNode generate_root(std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data, size_t level,
+                     size_t num_threads, const BuildContext& ctx,
+                     const SubtreeFn& generate_subtree) {
+    SVNode root;
+    if (generate_known_region(nodes, voxel_data, level, VDB::coord_t(0), ctx, root)) {
+        return root;
+    }
+
+    if (num_threads > 1 && level > 1) {
+        return generate_tree_parallel(nodes, voxel_data, level, num_threads, ctx,
+                                      generate_subtree);
+    }
+
+    return generate_subtree(nodes, voxel_data, level, VDB::coord_t(0));
+}
+
+
+}  // namespace detail
+
 VDB::VDB(vk::SurfaceDevice::ptr device) : device_(device) {}
 
-void VDB::build_from(coord_t dims, const std::function<uint8_t(coord_t)>& sampler) {
+void VDB::begin_build(coord_t dims) {
+    if (dims.x == 0 || dims.y == 0 || dims.z == 0) {
+        throw std::invalid_argument("VDB dimensions must be non-zero");
+    }
+
     h_nodes_.clear();
     h_voxels_.clear();
 
-    constexpr size_t kNumChildren = sizeof(decltype(SVNode::child_mask)) * 8;
-    constexpr coord_t kSize(4);
-
-    size_t max_dim = std::max({dims.x, dims.y, dims.z});
-    size_t level = std::ceil(log_n(kSize.x, max_dim));
+    // the part of the tree outside of `dims` stays empty
+    height_ = detail::tree_height(dims);
+    size_ = dims;
+    encoding_ = VoxelEncoding::kBytes;
+    shared_ = false;
+    mark_all_dirty();
 
     h_nodes_.emplace_back();
-    auto root = generate_tree(h_nodes_, h_voxels_, level, coord_t(0), sampler);
+}
+
+void VDB::build_from(coord_t dims, const std::function<uint8_t(coord_t)>& sampler,
+                     const BuildOptions& options) {
+    begin_build(dims);
+
+    detail::BuildContext ctx{dims, &options.classify_region};
+
+    auto fill_leaf = [&](coord_t leaf_min, uint8_t* out) {
+        auto extent = detail::clamp_extent(leaf_min, detail::node_extent(1), ctx);
+        for (size_t i = 0; i < detail::kLeafVoxels; ++i) {
+            auto local = detail::pos_from_index(i, detail::node_extent(1));
+            bool inside = local.x < extent.x && local.y < extent.y && local.z < extent.z;
+            out[i] = inside ? sampler(leaf_min + local) : 0;
+        }
+    };
+
+    auto generate_subtree = [&](std::vector<SVNode>& nodes, std::vector<uint8_t>& voxel_data,
+                                size_t level, coord_t min) {
+        return detail::generate_tree(nodes, voxel_data, level, min, fill_leaf, ctx);
+    };
+
+    auto root = detail::generate_root(h_nodes_, h_voxels_, height_,
+                                      detail::resolve_num_threads(options.num_threads), ctx,
+                                      generate_subtree);
     h_nodes_[0] = root;
+}
+
+void VDB::build_from_dense(const uint8_t* data, coord_t dims, glm::u64vec3 strides) {
+    begin_build(dims);
+
+    SlabBuilder builder(dims, height_, h_nodes_, h_voxels_);
+    while (!builder.done()) {
+        builder.add_slab(data + builder.next_slab_z() * strides.z, strides);
+    }
+
+    h_nodes_[0] = builder.finish();
+}
+
+void VDB::build_from_dense(const uint8_t* data, coord_t dims) {
+    build_from_dense(data, dims, glm::u64vec3(1, dims.x, static_cast<uint64_t>(dims.x) * dims.y));
+}
+
+void VDB::build_from_dense(coord_t dims, const SlabReader& read_slab) {
+    begin_build(dims);
+
+    glm::u64vec3 strides(1, dims.x, static_cast<uint64_t>(dims.x) * dims.y);
+    std::vector<uint8_t> slab(strides.z * detail::node_extent(1).z);
 
-    height_ = level;
-    size_ = node_size_at_level(height_, kSize);
+    SlabBuilder builder(dims, height_, h_nodes_, h_voxels_);
+    while (!builder.done()) {
+        read_slab(builder.next_slab_z(), builder.next_slab_depth(), slab.data());
+        builder.add_slab(slab.data(), strides);
+    }
+
+    h_nodes_[0] = builder.finish();
+}
+
+void VDB::build_from_points(coord_t dims, const std::vector<VoxelPoint>& points,
+                            const BuildOptions& options) {
+    // the points are checked and keyed before the tree is reset, so a rejected call leaves it as
+    // it was
+    const size_t height = detail::tree_height(dims);
+    if (detail::tree_key_shift(height) > 64) {
+        throw std::invalid_argument("VDB dimensions are too large to build from points");
+    }
+
+    std::vector<KeyedVoxel> items(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        const auto& point = points[i];
+        if (point.pos.x >= dims.x || point.pos.y >= dims.y || point.pos.z >= dims.z) {
+            throw std::invalid_argument("Point is out of bounds");
+        }
+        items[i] = KeyedVoxel{detail::tree_key(point.pos, height), point.value};
+    }
+
+    begin_build(dims);
+
+    radix_sort(items, detail::tree_key_shift(height_),
+               detail::resolve_num_threads(options.num_threads));
+
+    // reduce runs of equal keys, dropping the voxels that end up empty afterwards
+    size_t unique = 0;
+    for (size_t i = 0; i < items.size();) {
+        auto reduced = items[i];
+        for (++i; i < items.size() && items[i].key == reduced.key; ++i) {
+            reduced.value = options.duplicates == PointReduction::kMax
+                                ? std::max(reduced.value, items[i].value)
+                                : items[i].value;
+        }
+        if (reduced.value != 0) {
+            items[unique++] = reduced;
+        }
+    }
+    items.resize(unique);
+
+    // The nodes on the path to the current voxel are kept open, with their children pending. A node
+    // is closed once a voxel outside of it comes up: its children are appended, and it is added to
+    // its parent, which is the same order generate_internal appends in. Uniform nodes are turned
+    // into tiles on closing, like generate_leaf and generate_internal do.
+    struct OpenNode {
+        bool open{false};
+        uint64_t key{0};
+        SVNode node{0, 0, 0};
+        std::vector<SVNode> children;
+    };
+    std::vector<OpenNode> path(height_ + 1);
+
+    auto open = [&](size_t level, uint64_t key) {
+        auto& current = path[level];
+        current.open = true;
+        current.key = key;
+        current.node = SVNode{0, 0, 0};
+        current.node.is_leaf = level == 1;
+        current.node.child_offset = level == 1 ? h_voxels_.size() : 0;
+    };
+
+    auto close = [&](size_t level) {
+        auto& current = path[level];
+        if (level == 1) {
+            auto* voxels = h_voxels_.data() + current.node.child_offset;
+            if (current.node.child_mask == 0) {
+                current.node = SVNode{0, 0, 0};  // an empty root, see generate_leaf
+            } else if (detail::uniform_leaf(voxels, current.node.child_mask)) {
+                current.node = detail::make_tile(voxels[0]);
+                h_voxels_.resize(h_voxels_.size() - detail::kLeafVoxels);
+            }
+        } else if (detail::uniform_tiles(current.children, level)) {
+            current.node = current.children.front();
+            current.children.clear();
+        } else {
+            current.node.child_offset = h_nodes_.size();
+            h_nodes_.insert(h_nodes_.end(), current.children.begin(), current.children.end());
+            current.children.clear();
+        }
+        current.open = false;
+
+        if (level == height_) {
+            h_nodes_[0] = current.node;
+        } else {
+            auto index_bits = 3 * detail::Config::log2_dim(level + 1);
+            auto index = current.key & ((uint64_t(1) << index_bits) - 1);
+            auto& parent = path[level + 1];
+            parent.node.child_mask |= 1ull << index;
+            parent.children.push_back(current.node);
+        }
+    };
+
+    open(height_, 0);
+    for (const auto& item : items) {
+        // the highest level whose open node does not contain this voxel, every level below it
+        // changes too
+        size_t changed = 0;
+        for (size_t level = height_ - 1; level >= 1; --level) {
+            auto key = item.key >> detail::tree_key_shift(level);
+            if (!path[level].open || path[level].key != key) {
+                changed = level;
+                break;
+            }
+        }
+
+        for (size_t level = 1; level <= changed; ++level) {
+            if (path[level].open) {
+                close(level);
+            }
+        }
+        for (size_t level = changed; level >= 1; --level) {
+            open(level, item.key >> detail::tree_key_shift(level));
+        }
+
+        auto& leaf = path[1].node;
+        auto index = item.key & ((uint64_t(1) << detail::tree_key_shift(1)) - 1);
+        leaf.child_mask |= 1ull << index;
+        h_voxels_.push_back(item.value);
+    }
+
+    for (size_t level = 1; level <= height_; ++level) {
+        if (path[level].open) {
+            close(level);
+        }
+    }
+}
+
+void VDB::deduplicate() {
+    if (h_nodes_.empty()) {
+        return;
+    }
+
+    std::vector<SVNode> nodes(1);
+    std::vector<uint8_t> voxels;
+    RangeInterner<SVNode> node_arrays(nodes);
+    RangeInterner<uint8_t> voxel_runs(voxels);
+
+    // already shared arrays are only visited once. Empty arrays are not tracked, their offset may
+    // coincide with the start of another array.
+    std::unordered_map<uint32_t, uint32_t> moved_nodes, moved_voxels;
+
+    // Children are rebuilt before the array referencing them, which keeps the layout post-order.
+    std::function<SVNode(SVNode)> rebuild = [&](SVNode node) {
+        if (detail::is_tile(node)) {
+            return node;
+        }
+
+        size_t count
+            = node.is_leaf ? leaf_data_size(node) : std::bitset<64>(node.child_mask).count();
+        auto& moved = node.is_leaf ? moved_voxels : moved_nodes;
+        if (auto it = moved.find(node.child_offset); count > 0 && it != moved.end()) {
+            node.child_offset = it->second;
+            return node;
+        }
+
+        size_t begin;
+        if (node.is_leaf) {
+            begin = voxels.size();
+            voxels.insert(voxels.end(), h_voxels_.begin() + node.child_offset,
+                          h_voxels_.begin() + node.child_offset + count);
+            begin = voxel_runs.intern(begin);
+        } else {
+            std::vector<SVNode> children(count);
+            for (size_t i = 0; i < count; ++i) {
+                children[i] = rebuild(h_nodes_[node.child_offset + i]);
+            }
+
+            begin = nodes.size();
+            nodes.insert(nodes.end(), children.begin(), children.end());
+            begin = node_arrays.intern(begin);
+        }
+
+        if (count > 0) {
+            moved[node.child_offset] = static_cast<uint32_t>(begin);
+        }
+        node.child_offset = begin;
+        return node;
+    };
+
+    nodes[0] = rebuild(h_nodes_[0]);
+
+    h_nodes_ = std::move(nodes);
+    h_voxels_ = std::move(voxels);
+    shared_ = true;
+    mark_all_dirty();
+}
+
+size_t VDB::leaf_data_size(const SVNode& leaf) const {
+    size_t count = std::bitset<64>(leaf.child_mask).count();
+    if (encoding_ == VoxelEncoding::kPalette) {
+        return palette::leaf_size(h_voxels_.data() + leaf.child_offset, count);
+    }
+    return count;
+}
+
+void VDB::encode_voxels(VoxelEncoding encoding) {
+    if (encoding == encoding_ || h_nodes_.empty()) {
+        return;
+    }
+
+    // Every run as (offset, active voxels), in voxel order. Runs are shared after deduplicate(),
+    // palette runs even by leaves with different numbers of voxels.
+    using Run = std::pair<uint32_t, uint32_t>;
+    auto run_of = [](const SVNode& leaf) {
+        auto count = std::bitset<64>(leaf.child_mask).count();
+        return Run(leaf.child_offset, static_cast<uint32_t>(count));
+    };
+
+    std::map<Run, uint32_t> moved;
+    for (const auto& node : h_nodes_) {
+        if (node.is_leaf && !detail::is_tile(node)) {
+            moved.emplace(run_of(node), 0);
+        }
+    }
+
+    std::vector<uint8_t> voxels;
+    std::array<uint8_t, detail::kLeafVoxels> decoded;
+    for (auto& [run, new_offset] : moved) {
+        auto [offset, count] = run;
+        const uint8_t* data = h_voxels_.data() + offset;
+        if (encoding_ == VoxelEncoding::kPalette) {
+            for (size_t i = 0; i < count; ++i) {
+                decoded[i] = palette::decode_leaf(data, i);
+            }
+            data = decoded.data();
+        }
+
+        new_offset = static_cast<uint32_t>(voxels.size());
+        if (encoding == VoxelEncoding::kPalette) {
+            palette::encode_leaf(data, count, voxels);
+        } else {
+            voxels.insert(voxels.end(), data, data + count);
+        }
+    }
+
+    for (auto& node : h_nodes_) {
+        if (node.is_leaf && !detail::is_tile(node)) {
+            node.child_offset = moved[run_of(node)];
+        }
+    }
+
+    h_voxels_ = std::move(voxels);
+    encoding_ = encoding;
+    mark_all_dirty();
 }
 
 void VDB::move_to_device(vk::CommandPool::ptr cmd_pool) {
-    d_info_ = vk::create_storage_buffer(device_, 0, 1, sizeof(VDBInfo));
-    d_nodes_ = vk::create_storage_buffer(device_, 0, h_nodes_.size(), sizeof(SVNode));
-    d_voxels_ = vk::create_storage_buffer(device_, 0, h_voxels_.size(), sizeof(uint8_t));
+    d_info_.reset();
+    d_nodes_.reset();
+    d_voxels_.reset();
 
-    {
-        VDBInfo info{size_, static_cast<glm::u32>(height_)};
+    sync_to_device(cmd_pool);
+}
 
-        auto transfer_buf = vk::create_and_fill_transfer_buffer(
-            device_, reinterpret_cast<unsigned char*>(&info), sizeof(VDBInfo));
-        auto transfer_cmd
-            = vk::buffer_memcpy(device_, cmd_pool, transfer_buf, d_info_, d_info_->size());
-        vk::submit_commands(transfer_cmd, device_->queues.graphics.queue);
+bool VDB::sync_to_device(vk::CommandPool::ptr cmd_pool) {
+    if (h_nodes_.empty()) {
+        throw std::runtime_error("VDB is empty");
     }
 
-    {
-        auto transfer_buf = vk::create_and_fill_transfer_buffer(device_, h_nodes_);
-        auto transfer_cmd
-            = vk::buffer_memcpy(device_, cmd_pool, transfer_buf, d_nodes_, d_nodes_->size());
-        vk::submit_commands(transfer_cmd, device_->queues.graphics.queue);
+    bool recreated = false;
+    if (!d_info_) {
+        d_info_ = vk::create_storage_buffer(device_, 0, 1, sizeof(VDBInfo));
+        dirty_info_ = true;
+        recreated = true;
+    }
+
+    recreated |= reserve_device_buffer(device_, cmd_pool, d_nodes_, h_nodes_.size(),
+                                       sizeof(SVNode), dirty_nodes_);
+    // the shader reads whole words, and a tree of tiles only has no voxels but still needs a buffer
+    recreated |= reserve_device_buffer(device_, cmd_pool, d_voxels_,
+                                       std::max<size_t>((h_voxels_.size() + 3) / 4 * 4, 4),
+                                       sizeof(uint8_t), dirty_voxels_);
+
+    // every dirty range becomes one region, all of them staged back to back in a single buffer
+    std::vector<unsigned char> staging;
+    std::vector<vk::BufferCopyRegions> copies;
+    auto stage = [&](vk::Buffer::ptr dst, const void* data, size_t element_size,
+                     const std::vector<IndexRange>& ranges) {
+        vk::BufferCopyRegions copy{dst, {}};
+        for (const auto& range : ranges) {
+            VkBufferCopy region{staging.size(), range.begin * element_size,
+                                (range.end - range.begin) * element_size};
+            auto* begin = static_cast<const unsigned char*>(data) + region.dstOffset;
+            staging.insert(staging.end(), begin, begin + region.size);
+            copy.regions.push_back(region);
+        }
+
+        if (!copy.regions.empty()) {
+            copies.push_back(std::move(copy));
+        }
+    };
+
+    VDBInfo info{size_, static_cast<glm::u32>(height_), static_cast<glm::u32>(encoding_)};
+    if (dirty_info_) {
+        stage(d_info_, &info, sizeof(VDBInfo), {{0, 1}});
     }
+    stage(d_nodes_, h_nodes_.data(), sizeof(SVNode),
+          dirty_nodes_.merged(h_nodes_.size(), kRegionGapBytes / sizeof(SVNode)));
+    stage(d_voxels_, h_voxels_.data(), sizeof(uint8_t),
+          dirty_voxels_.merged(h_voxels_.size(), kRegionGapBytes));
 
-    {
-        auto transfer_buf = vk::create_and_fill_transfer_buffer(device_, h_voxels_);
-        auto transfer_cmd
-            = vk::buffer_memcpy(device_, cmd_pool, transfer_buf, d_voxels_, d_voxels_->size());
+    if (!copies.empty()) {
+        auto transfer_buf = vk::create_and_fill_transfer_buffer(device_, staging);
+        auto transfer_cmd = vk::buffer_copy_regions(device_, cmd_pool, transfer_buf, copies);
         vk::submit_commands(transfer_cmd, device_->queues.graphics.queue);
     }
+
+    dirty_info_ = false;
+    dirty_nodes_.clear();
+    dirty_voxels_.clear();
+
+    return recreated;
+}
+
+void VDB::mark_all_dirty() {
+    dirty_info_ = true;
+    dirty_nodes_.mark_all();
+    dirty_voxels_.mark_all();
 }
 
 uint8_t VDB::get_voxel(coord_t pos) const {
@@ -150,14 +1031,10 @@ uint8_t VDB::get_voxel(coord_t pos) const {
         throw std::runtime_error("VDB is empty");
     }
 
-    constexpr size_t kNumChildren = sizeof(decltype(SVNode::child_mask)) * 8;
-    constexpr coord_t kSize(4);
-
     SVNode current = h_nodes_.front();
     size_t current_level = height_;
-    coord_t current_min(0);
 
-    using MaskCounter = std::bitset<kNumChildren>;
+    using MaskCounter = std::bitset<sizeof(decltype(SVNode::child_mask)) * 8>;
     auto get_child_local_offset = [](const SVNode& node, size_t index) {
         // select only children mask bits *below* the one we're after
         uint64_t children_up_to_mask = (1ull << index) - 1;
@@ -167,8 +1044,12 @@ uint8_t VDB::get_voxel(coord_t pos) const {
     };
 
     while (current_level >= 1) {
-        auto pos_in_node = (pos - current_min) / node_size_at_level(current_level - 1, kSize);
-        auto index = pos_to_index(pos_in_node, kSize);
+        if (detail::is_tile(current)) {
+            return current.child_offset;
+        }
+
+        // nodes are aligned to their extent, so the child is picked by the bits of `pos` alone
+        auto index = detail::child_index(pos, current_level);
 
         bool child_active = current.child_mask & (1ull << index);
         if (!child_active) {
@@ -178,15 +1059,246 @@ uint8_t VDB::get_voxel(coord_t pos) const {
         auto child_index = current.child_offset + get_child_local_offset(current, index);
 
         if (current_level == 1) {
+            if (encoding_ == VoxelEncoding::kPalette) {
+                return palette::decode_leaf(h_voxels_.data() + current.child_offset,
+                                            child_index - current.child_offset);
+            }
             return h_voxels_[child_index];
         } else {
             current = h_nodes_[child_index];
             --current_level;
-            current_min += pos_in_node * node_size_at_level(current_level, kSize);
         }
     }
 
     throw std::runtime_error("Something went wrong while traversing node tree");
 }
 
-}  // namespace spor::vox
\ No newline at end of file
+size_t VDB::get_voxels(const coord_t* positions, size_t count, uint8_t* out,
+                       uint8_t outside) const {
+    if (h_nodes_.empty()) {
+        throw std::runtime_error("VDB is empty");
+    }
+
+    // per level, where the child index sits in a position
+    std::array<uint32_t, 64> shifts{}, dim_bits{};
+    for (size_t level = 1; level <= height_; ++level) {
+        shifts[level] = detail::Config::log2_extent(level - 1);
+        dim_bits[level] = detail::Config::log2_dim(level);
+    }
+    const uint32_t leaf_shift = detail::Config::log2_extent(1);
+
+    // detail::child_index with the shift looked up rather than summed
+    auto child_bit = [&](uint32_t x, uint32_t y, uint32_t z, size_t level) {
+        uint32_t shift = shifts[level], bits = dim_bits[level], mask = (1u << bits) - 1;
+        return 1ull << (((x >> shift) & mask) | ((y >> shift) & mask) << bits
+                        | ((z >> shift) & mask) << 2 * bits);
+    };
+
+    auto same_leaf = [&](coord_t a, coord_t b) {
+        return ((a.x ^ b.x) | (a.y ^ b.y) | (a.z ^ b.z)) >> leaf_shift == 0;
+    };
+
+    // Queries are walked kLanes at a time, one level for all lanes before the next. The lanes are
+    // independent, so their node loads overlap instead of waiting on each other. A query in the
+    // same leaf as the one before it takes that one's leaf instead of walking.
+    constexpr size_t kLanes = 8;
+    size_t num_outside = 0;
+    SVNode last_leaf{0, 0, 0};
+    coord_t last_pos{~0u};
+    for (size_t first = 0; first < count; first += kLanes) {
+        size_t lanes = std::min(kLanes, count - first);
+
+        SVNode nodes[kLanes];
+        bool inside[kLanes], walk[kLanes];
+        uint32_t x[kLanes], y[kLanes], z[kLanes];
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            auto pos = positions[first + lane];
+            x[lane] = pos.x;
+            y[lane] = pos.y;
+            z[lane] = pos.z;
+            inside[lane] = pos.x < size_.x && pos.y < size_.y && pos.z < size_.z;
+
+            auto previous = lane > 0 ? positions[first + lane - 1] : last_pos;
+            bool previous_inside = lane > 0 ? inside[lane - 1] : last_pos.x != ~0u;
+            walk[lane] = inside[lane] && !(previous_inside && same_leaf(pos, previous));
+            nodes[lane] = h_nodes_.front();
+        }
+
+        // down to the leaves, lanes that hit a tile or an empty node stay there
+        for (size_t level = height_; level > 1; --level) {
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                const SVNode node = nodes[lane];
+                if (!walk[lane] || node.is_leaf) {
+                    continue;
+                }
+
+                uint64_t bit = child_bit(x[lane], y[lane], z[lane], level);
+                nodes[lane] = node.child_mask & bit
+                                  ? h_nodes_[node.child_offset
+                                             + detail::popcount(node.child_mask & (bit - 1))]
+                                  : SVNode{0, 0, 0};
+            }
+        }
+
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            auto& value = out[first + lane];
+            if (!inside[lane]) {
+                value = outside;
+                ++num_outside;
+                continue;
+            }
+
+            const SVNode leaf = walk[lane] ? nodes[lane] : lane > 0 ? nodes[lane - 1] : last_leaf;
+            nodes[lane] = leaf;
+            if (detail::is_tile(leaf)) {
+                value = static_cast<uint8_t>(leaf.child_offset);
+                continue;
+            }
+
+            uint64_t bit = child_bit(x[lane], y[lane], z[lane], 1);
+            auto local = detail::popcount(leaf.child_mask & (bit - 1));
+            if (!(leaf.child_mask & bit)) {
+                value = 0;
+            } else if (encoding_ == VoxelEncoding::kPalette) {
+                value = palette::decode_leaf(h_voxels_.data() + leaf.child_offset, local);
+            } else {
+                value = h_voxels_[leaf.child_offset + local];
+            }
+        }
+
+        last_leaf = nodes[lanes - 1];
+        last_pos = inside[lanes - 1] ? positions[first + lanes - 1] : coord_t(~0u);
+    }
+
+    return num_outside;
+}
+
+std::vector<uint8_t> VDB::get_voxels(const std::vector<coord_t>& positions) const {
+    std::vector<uint8_t> values(positions.size());
+    get_voxels(positions.data(), positions.size(), values.data());
+    return values;
+}
+
+void VDB::copy_to_dense(coord_t min, coord_t max, uint8_t* out, glm::u64vec3 strides,
+                        size_t num_threads) const {
+    if (h_nodes_.empty()) {
+        throw std::runtime_error("VDB is empty");
+    }
+    if (glm::any(glm::greaterThanEqual(min, max))) {
+        return;
+    }
+
+    DenseWriter writer(min, max, out, strides, h_nodes_, h_voxels_, encoding_);
+    num_threads = std::min<size_t>(detail::resolve_num_threads(num_threads), max.z - min.z);
+    if (num_threads == 1) {
+        writer.fill(min, max, 0);
+        writer.write(h_nodes_.front(), height_, coord_t(0));
+        return;
+    }
+
+    // split the tree until there are a few subtrees per thread, tiles and leaves stay whole
+    std::vector<NodeRef> subtrees{{h_nodes_.front(), height_, coord_t(0)}};
+    while (subtrees.size() < 4 * num_threads) {
+        std::vector<NodeRef> children;
+        for (const auto& subtree : subtrees) {
+            auto lo = glm::max(subtree.min, min);
+            auto hi = glm::min(subtree.min + detail::node_extent(subtree.level), max);
+            if (glm::any(glm::greaterThanEqual(lo, hi))) {
+                continue;
+            }
+
+            if (subtree.level == 1 || detail::is_tile(subtree.node)) {
+                children.push_back(subtree);
+                continue;
+            }
+
+            for (const auto& child : NodeRange(
+                     NodeIterator(*this, subtree, subtree.level - 1, true), NodeIterator())) {
+                children.push_back(child);
+            }
+        }
+
+        bool split = children.size() > subtrees.size();
+        subtrees = std::move(children);
+        if (!split) {
+            break;
+        }
+    }
+
+    for_each_chunk(num_threads, max.z - min.z, [&](size_t, size_t begin, size_t end) {
+        writer.fill({min.x, min.y, min.z + begin}, {max.x, max.y, min.z + end}, 0);
+    });
+
+    detail::parallel_for(subtrees.size(), num_threads, [&](size_t i, size_t) {
+        writer.write(subtrees[i].node, subtrees[i].level, subtrees[i].min);
+    });
+}
+
+void VDB::copy_to_dense(coord_t min, coord_t max, uint8_t* out, size_t num_threads) const {
+    glm::u64vec3 extent(max - glm::min(min, max));
+    copy_to_dense(min, max, out, glm::u64vec3(1, extent.x, extent.x * extent.y), num_threads);
+}
+
+VDB::Accessor::Accessor(const VDB& vdb)
+    : vdb_(vdb),
+      cached_level_(vdb.height_),
+      nodes_(vdb.height_ + 1),
+      keys_(vdb.height_ + 1, coord_t(0)),
+      shifts_(vdb.height_ + 1) {
+    if (vdb.h_nodes_.empty()) {
+        throw std::runtime_error("VDB is empty");
+    }
+
+    for (size_t level = 0; level <= vdb.height_; ++level) {
+        shifts_[level] = detail::Config::log2_extent(level);
+    }
+
+    // the root covers every position, it is the one node always on the path
+    nodes_[vdb.height_] = vdb.h_nodes_.front();
+}
+
+uint8_t VDB::Accessor::get_voxel(coord_t pos) {
+    if (pos.x >= vdb_.size_.x || pos.y >= vdb_.size_.y || pos.z >= vdb_.size_.z) {
+        throw std::invalid_argument("Voxel pos is out of bounds");
+    }
+
+    size_t level = cached_level_;
+    while (level < vdb_.height_ && (pos >> shifts_[level]) != keys_[level]) {
+        ++level;
+    }
+
+    SVNode current = nodes_[level];
+    while (true) {
+        if (detail::is_tile(current)) {
+            break;
+        }
+
+        // detail::child_index with the shift looked up rather than summed
+        auto local = (pos >> shifts_[level - 1]) & (detail::Config::dim(level) - 1);
+        auto index = detail::pos_to_index(local, detail::node_dim(level));
+        if (!(current.child_mask & (1ull << index))) {
+            break;
+        }
+
+        auto child_index = current.child_offset
+                           + std::bitset<64>(current.child_mask & ((1ull << index) - 1)).count();
+        if (level == 1) {
+            cached_level_ = level;
+            if (vdb_.encoding_ == VoxelEncoding::kPalette) {
+                return palette::decode_leaf(vdb_.h_voxels_.data() + current.child_offset,
+                                            child_index - current.child_offset);
+            }
+            return vdb_.h_voxels_[child_index];
+        }
+
+        current = vdb_.h_nodes_[child_index];
+        --level;
+        nodes_[level] = current;
+        keys_[level] = pos >> shifts_[level];
+    }
+
+    cached_level_ = level;
+    return detail::is_tile(current) ? current.child_offset : 0;
+}
+
+}  // namespace spor::vox
@@ -0,0 +1,383 @@
+#include "voxel/vdb.h"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstring>
+#include <stdexcept>
+
+namespace spor::vox {
+
+namespace {
+
+using detail::Config;
+using detail::kLeafVoxels;
+
+// How much of a node a brush paints
+enum class Cover {
+    kNone,     // nothing, the node is left alone
+    kFull,     // every voxel, with Brush::value
+    kPartial,  // some voxels, the node's children are edited
+};
+
+// Brushes paint the voxels of a region with `cover(min, max, level)` telling which part of the
+// node [min, max) at `level` they touch, `value` for the nodes they cover fully, and
+// `paint_leaf(min, voxels)` writing the painted voxels of the leaf at `min`, x-major. They never
+// paint outside the volume.
+
+struct BoxBrush {
+    VDB::coord_t min, max;
+    uint8_t value;
+
+    Cover cover(VDB::coord_t node_min, VDB::coord_t node_max, size_t) const {
+        if (glm::any(glm::greaterThanEqual(node_min, max))
+            || glm::any(glm::lessThanEqual(node_max, min))) {
+            return Cover::kNone;
+        }
+        if (glm::all(glm::greaterThanEqual(node_min, min))
+            && glm::all(glm::lessThanEqual(node_max, max))) {
+            return Cover::kFull;
+        }
+        return Cover::kPartial;
+    }
+
+    void paint_leaf(VDB::coord_t leaf_min, uint8_t* voxels) const {
+        auto lo = glm::max(min, leaf_min) - leaf_min;
+        auto hi = glm::min(max, leaf_min + detail::node_extent(1)) - leaf_min;
+        for (uint32_t z = lo.z; z < hi.z; ++z) {
+            for (uint32_t y = lo.y; y < hi.y; ++y) {
+                auto row = detail::pos_to_index(VDB::coord_t(lo.x, y, z), detail::node_extent(1));
+                std::memset(voxels + row, value, hi.x - lo.x);
+            }
+        }
+    }
+};
+
+struct SphereBrush {
+    glm::vec3 center;
+    float radius;
+    uint8_t value;
+    BoxBrush bounds;  // the voxels the sphere may touch
+
+    float distance2(glm::vec3 pos) const {
+        auto d = pos - center;
+        return glm::dot(d, d);
+    }
+
+    Cover cover(VDB::coord_t node_min, VDB::coord_t node_max, size_t level) const {
+        if (bounds.cover(node_min, node_max, level) == Cover::kNone) {
+            return Cover::kNone;
+        }
+
+        auto lo = glm::vec3(node_min), hi = glm::vec3(node_max - 1u);
+        auto nearest = glm::clamp(center, lo, hi);
+        auto furthest = glm::max(glm::abs(lo - center), glm::abs(hi - center));
+        if (distance2(nearest) > radius * radius) {
+            return Cover::kNone;
+        } else if (glm::dot(furthest, furthest) <= radius * radius) {
+            return Cover::kFull;
+        }
+        return Cover::kPartial;
+    }
+
+    void paint_leaf(VDB::coord_t leaf_min, uint8_t* voxels) const {
+        auto lo = glm::max(bounds.min, leaf_min) - leaf_min;
+        auto hi = glm::min(bounds.max, leaf_min + detail::node_extent(1)) - leaf_min;
+        for (uint32_t z = lo.z; z < hi.z; ++z) {
+            for (uint32_t y = lo.y; y < hi.y; ++y) {
+                for (uint32_t x = lo.x; x < hi.x; ++x) {
+                    VDB::coord_t local(x, y, z);
+                    if (distance2(glm::vec3(leaf_min + local)) <= radius * radius) {
+                        voxels[detail::pos_to_index(local, detail::node_extent(1))] = value;
+                    }
+                }
+            }
+        }
+    }
+};
+
+// Edits sorted by detail::tree_key, so that the ones within a node are a contiguous range
+struct ListBrush {
+    struct Edit {
+        uint64_t key;
+        uint8_t value;
+    };
+
+    std::vector<Edit> edits;
+    size_t height;
+    uint8_t value{0};  // unused, edit lists never cover a node fully
+
+    std::pair<size_t, size_t> range(VDB::coord_t node_min, size_t level) const {
+        auto shift = detail::tree_key_shift(level);
+        if (shift >= 64) {
+            return {0, edits.size()};
+        }
+
+        uint64_t first = detail::tree_key(node_min, height);  // nodes are aligned, the rest is 0
+        auto key_less = [](const Edit& edit, uint64_t key) { return edit.key < key; };
+        auto begin = std::lower_bound(edits.begin(), edits.end(), first, key_less);
+        auto end = std::lower_bound(begin, edits.end(), first + (uint64_t(1) << shift), key_less);
+        return {begin - edits.begin(), end - edits.begin()};
+    }
+
+    Cover cover(VDB::coord_t node_min, VDB::coord_t, size_t level) const {
+        auto [begin, end] = range(node_min, level);
+        return begin == end ? Cover::kNone : Cover::kPartial;
+    }
+
+    void paint_leaf(VDB::coord_t leaf_min, uint8_t* voxels) const {
+        auto [begin, end] = range(leaf_min, 1);
+        for (size_t i = begin; i < end; ++i) {
+            voxels[edits[i].key & (kLeafVoxels - 1)] = edits[i].value;
+        }
+    }
+};
+
+// Rewrites the nodes a brush paints, see VDB::edit
+template <typename Brush> class TreeEditor {
+public:
+    TreeEditor(const Brush& brush, VDB::coord_t dims, VoxelEncoding encoding, bool shared,
+               std::vector<SVNode>& nodes, std::vector<uint8_t>& voxels, EditResult& result)
+        : brush_(brush),
+          dims_(dims),
+          encoding_(encoding),
+          shared_(shared),
+          nodes_(nodes),
+          voxels_(voxels),
+          result_(result) {}
+
+    // Return `node` at `level` with the brush applied. Nodes are passed by value, editing may
+    // reallocate the arrays they come from.
+    SVNode edit(SVNode node, size_t level, VDB::coord_t min) {
+        auto extent = detail::node_extent(level);
+        auto max = glm::min(min + extent, dims_);
+
+        auto cover = brush_.cover(min, max, level);
+        if (cover == Cover::kNone) {
+            return node;
+        } else if (cover == Cover::kFull && max == min + extent) {
+            return brush_.value == 0 ? SVNode{0, 0, 0} : detail::make_tile(brush_.value);
+        }
+
+        return level == 1 ? edit_leaf(node, min) : edit_internal(node, level, min);
+    }
+
+private:
+    // Whether the arrays of `node` are its own and may be overwritten
+    bool owns_arrays(const SVNode& node) const {
+        return !shared_ && node.child_mask != 0;
+    }
+
+    size_t leaf_size(const SVNode& leaf) const {
+        size_t count = std::bitset<64>(leaf.child_mask).count();
+        if (encoding_ == VoxelEncoding::kPalette) {
+            return palette::leaf_size(voxels_.data() + leaf.child_offset, count);
+        }
+        return count;
+    }
+
+    void decode_leaf(const SVNode& leaf, uint8_t* out) const {
+        if (detail::is_tile(leaf)) {
+            std::memset(out, leaf.child_offset, kLeafVoxels);
+            return;
+        }
+
+        std::memset(out, 0, kLeafVoxels);
+        const uint8_t* data = voxels_.data() + leaf.child_offset;
+        for (size_t i = 0, j = 0; i < kLeafVoxels; ++i) {
+            if (leaf.child_mask & (1ull << i)) {
+                out[i] = encoding_ == VoxelEncoding::kPalette ? palette::decode_leaf(data, j)
+                                                              : data[j];
+                ++j;
+            }
+        }
+    }
+
+    SVNode edit_leaf(SVNode leaf, VDB::coord_t min) {
+        std::array<uint8_t, kLeafVoxels> voxels;
+        decode_leaf(leaf, voxels.data());
+        brush_.paint_leaf(min, voxels.data());
+
+        SVNode node{1, 0, detail::active_mask(voxels.data(), kLeafVoxels)};
+        if (node.child_mask == 0) {
+            return SVNode{0, 0, 0};
+        } else if (detail::uniform_leaf(voxels.data(), node.child_mask)) {
+            return detail::make_tile(voxels[0]);
+        }
+
+        size_t count = detail::compress_active(voxels.data(), kLeafVoxels, node.child_mask);
+        const uint8_t* data = voxels.data();
+        if (encoding_ == VoxelEncoding::kPalette) {
+            encoded_.clear();
+            palette::encode_leaf(voxels.data(), count, encoded_);
+            data = encoded_.data();
+            count = encoded_.size();
+        }
+
+        if (owns_arrays(leaf) && leaf.is_leaf && count <= leaf_size(leaf)) {
+            node.child_offset = leaf.child_offset;
+
+            // only the bytes that differ are reported
+            uint8_t* run = voxels_.data() + leaf.child_offset;
+            size_t first = 0, last = count;
+            while (first < count && run[first] == data[first]) {
+                ++first;
+            }
+            while (last > first && run[last - 1] == data[last - 1]) {
+                --last;
+            }
+            if (first < last) {
+                std::memcpy(run + first, data + first, last - first);
+                result_.voxels.push_back({leaf.child_offset + first, leaf.child_offset + last});
+            }
+            return node;
+        }
+
+        node.child_offset = voxels_.size();
+        voxels_.insert(voxels_.end(), data, data + count);
+        result_.voxels.push_back({node.child_offset, voxels_.size()});
+        return node;
+    }
+
+    SVNode edit_internal(SVNode node, size_t level, VDB::coord_t min) {
+        std::vector<SVNode> children;
+        children.reserve(Config::num_children(level));
+
+        SVNode result{0, 0, 0};
+        for (size_t i = 0, active = 0; i < Config::num_children(level); ++i) {
+            // children of a tile are tiles of the same value
+            SVNode child{0, 0, 0};
+            if (node.child_mask & (1ull << i)) {
+                child = nodes_[node.child_offset + active++];
+            } else if (detail::is_tile(node)) {
+                child = node;
+            }
+
+            auto child_min = min + detail::pos_from_index(i, detail::node_dim(level))
+                                       * detail::node_extent(level - 1);
+            if (!glm::any(glm::greaterThanEqual(child_min, dims_))) {
+                child = edit(child, level - 1, child_min);
+            }
+
+            if (detail::is_active(child)) {
+                result.child_mask |= 1ull << i;
+                children.push_back(child);
+            }
+        }
+
+        if (children.empty()) {
+            return SVNode{0, 0, 0};
+        } else if (detail::uniform_tiles(children, level)) {
+            return children.front();
+        }
+
+        // children removed from an array leave a gap at its end, added ones need a new array
+        if (owns_arrays(node) && !node.is_leaf
+            && children.size() <= std::bitset<64>(node.child_mask).count()) {
+            result.child_offset = node.child_offset;
+            for (size_t i = 0; i < children.size(); ++i) {
+                auto& slot = nodes_[node.child_offset + i];
+                if (std::memcmp(&slot, &children[i], sizeof(SVNode)) != 0) {
+                    slot = children[i];
+                    result_.nodes.push_back({node.child_offset + i, node.child_offset + i + 1});
+                }
+            }
+            return result;
+        }
+
+        result.child_offset = nodes_.size();
+        nodes_.insert(nodes_.end(), children.begin(), children.end());
+        result_.nodes.push_back({result.child_offset, nodes_.size()});
+        return result;
+    }
+
+    const Brush& brush_;
+    VDB::coord_t dims_;
+    VoxelEncoding encoding_;
+    bool shared_;
+
+    std::vector<SVNode>& nodes_;
+    std::vector<uint8_t>& voxels_;
+    EditResult& result_;
+
+    std::vector<uint8_t> encoded_;  // scratch for palette leaves
+};
+
+}  // namespace
+
+template <typename Brush> EditResult VDB::edit(const Brush& brush) {
+    if (h_nodes_.empty()) {
+        throw std::runtime_error("VDB is empty");
+    }
+
+    EditResult result;
+    TreeEditor<Brush> editor(brush, size_, encoding_, shared_, h_nodes_, h_voxels_, result);
+
+    auto root = editor.edit(h_nodes_[0], height_, coord_t(0));
+    if (std::memcmp(&root, &h_nodes_[0], sizeof(SVNode)) != 0) {
+        h_nodes_[0] = root;
+        result.nodes.push_back({0, 1});
+    }
+
+    merge_ranges(result.nodes);
+    merge_ranges(result.voxels);
+
+    dirty_nodes_.add(result.nodes);
+    dirty_voxels_.add(result.voxels);
+    return result;
+}
+
+EditResult VDB::set_voxel(coord_t pos, uint8_t value) {
+    if (pos.x >= size_.x || pos.y >= size_.y || pos.z >= size_.z) {
+        throw std::invalid_argument("Voxel pos is out of bounds");
+    }
+
+    return edit(BoxBrush{pos, pos + 1u, value});
+}
+
+EditResult VDB::fill_box(coord_t min, coord_t max, uint8_t value) {
+    max = glm::min(max, size_);
+    if (glm::any(glm::greaterThanEqual(min, max))) {
+        return {};
+    }
+
+    return edit(BoxBrush{min, max, value});
+}
+
+EditResult VDB::fill_sphere(glm::vec3 center, float radius, uint8_t value) {
+    if (radius < 0.f) {
+        return {};
+    }
+
+    auto lo = glm::max(glm::ceil(center - radius), glm::vec3(0.f));
+    auto hi = glm::min(glm::floor(center + radius) + 1.f, glm::vec3(size_));
+    if (glm::any(glm::greaterThanEqual(lo, hi))) {
+        return {};
+    }
+
+    return edit(SphereBrush{center, radius, value, BoxBrush{coord_t(lo), coord_t(hi), value}});
+}
+
+EditResult VDB::apply_edits(const std::vector<VoxelPoint>& edits) {
+    if (detail::tree_key_shift(height_) > 64) {
+        throw std::invalid_argument("VDB dimensions are too large for edit lists");
+    }
+
+    ListBrush brush;
+    brush.height = height_;
+    brush.edits.reserve(edits.size());
+    for (const auto& edit : edits) {
+        if (edit.pos.x >= size_.x || edit.pos.y >= size_.y || edit.pos.z >= size_.z) {
+            throw std::invalid_argument("Voxel pos is out of bounds");
+        }
+        brush.edits.push_back({detail::tree_key(edit.pos, height_), edit.value});
+    }
+
+    // stable, so that later edits of a voxel are applied last
+    std::stable_sort(brush.edits.begin(), brush.edits.end(),
+                     [](const auto& a, const auto& b) { return a.key < b.key; });
+
+    return edit(brush);
+}
+
+}  // namespace spor::vox
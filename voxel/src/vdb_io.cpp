@@ -0,0 +1,277 @@
+#include "voxel/vdb.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#    define NOMINMAX
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace spor::vox {
+
+namespace {
+
+constexpr char kMagic[8] = {'S', 'P', 'O', 'R', 'V', 'D', 'B', '\0'};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kByteOrder = 0x01020304;
+
+// Sections start on a page boundary so that a mapping of the file hands out aligned arrays
+constexpr uint64_t kPageSize = 4096;
+
+constexpr size_t kMaxLevels = 32;
+
+enum FileFlags : uint32_t {
+    kShared = 1,  // the arrays are deduplicated, see VDB::deduplicate
+};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // kByteOrder as written by the host that saved the file
+
+    uint64_t nodes_offset;
+    uint64_t node_count;
+    uint64_t voxels_offset;
+    uint64_t voxel_bytes;
+
+    uint32_t node_size;  // sizeof(SVNode)
+    uint32_t height;
+    uint32_t size[3];
+    uint32_t encoding;  // VoxelEncoding
+    uint32_t flags;     // FileFlags
+    uint32_t padding{0};
+
+    uint8_t log2_dims[kMaxLevels];  // NodeConfig::log2_dim of levels 1 to height
+};
+static_assert(sizeof(FileHeader) == 112, "FileHeader has unexpected padding");
+
+uint64_t align_to_page(uint64_t offset) { return (offset + kPageSize - 1) / kPageSize * kPageSize; }
+
+// A read-only mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Failed to open VDB file " + path);
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size)) {
+            throw std::runtime_error("Failed to read VDB file " + path);
+        }
+        size_ = static_cast<size_t>(size.QuadPart);
+        if (size_ == 0) {
+            return;
+        }
+
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_ == nullptr) {
+            throw std::runtime_error("Failed to map VDB file " + path);
+        }
+        data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+#else
+        fd_ = open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            throw std::runtime_error("Failed to open VDB file " + path);
+        }
+
+        struct stat info;
+        if (fstat(fd_, &info) != 0) {
+            throw std::runtime_error("Failed to read VDB file " + path);
+        }
+        size_ = static_cast<size_t>(info.st_size);
+        if (size_ == 0) {
+            return;
+        }
+
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (data != MAP_FAILED) {
+            data_ = static_cast<const uint8_t*>(data);
+            madvise(data, size_, MADV_SEQUENTIAL);
+        }
+#endif
+        if (data_ == nullptr) {
+            throw std::runtime_error("Failed to map VDB file " + path);
+        }
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data_) {
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_) {
+            CloseHandle(mapping_);
+        }
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+        }
+#else
+        if (data_) {
+            munmap(const_cast<uint8_t*>(data_), size_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+#ifdef _WIN32
+    HANDLE file_{INVALID_HANDLE_VALUE};
+    HANDLE mapping_{nullptr};
+#else
+    int fd_{-1};
+#endif
+    const uint8_t* data_{nullptr};
+    size_t size_{0};
+};
+
+}  // namespace
+
+bool VDB::child_arrays_valid(const std::vector<SVNode>& nodes, const std::vector<uint8_t>& voxels,
+                             VoxelEncoding encoding) {
+    for (const auto& node : nodes) {
+        if (detail::is_tile(node)) {
+            continue;
+        }
+
+        size_t count = detail::popcount(node.child_mask);
+        size_t end = node.child_offset + count;
+        if (node.is_leaf && encoding == VoxelEncoding::kPalette
+            && node.child_offset < voxels.size()) {
+            end = node.child_offset + palette::leaf_size(voxels.data() + node.child_offset, count);
+        }
+        if (end > (node.is_leaf ? voxels.size() : nodes.size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void VDB::save(const std::string& path) const {
+    if (height_ > kMaxLevels) {
+        throw std::runtime_error("VDB is too deep to be saved");
+    }
+
+    FileHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byte_order = kByteOrder;
+
+    header.nodes_offset = align_to_page(sizeof(FileHeader));
+    header.node_count = h_nodes_.size();
+    header.voxels_offset = align_to_page(header.nodes_offset + h_nodes_.size() * sizeof(SVNode));
+    header.voxel_bytes = h_voxels_.size();
+
+    header.node_size = sizeof(SVNode);
+    header.height = static_cast<uint32_t>(height_);
+    header.size[0] = size_.x;
+    header.size[1] = size_.y;
+    header.size[2] = size_.z;
+    header.encoding = static_cast<uint32_t>(encoding_);
+    header.flags = shared_ ? uint32_t(kShared) : 0u;
+    for (size_t level = 1; level <= height_; ++level) {
+        header.log2_dims[level - 1] = static_cast<uint8_t>(config_t::log2_dim(level));
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Failed to open VDB file " + path);
+    }
+
+    auto pad_to = [&file](uint64_t offset) {
+        static const char kZeros[kPageSize]{};
+        auto pos = static_cast<uint64_t>(file.tellp());
+        file.write(kZeros, static_cast<std::streamsize>(offset - pos));
+    };
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    pad_to(header.nodes_offset);
+    file.write(reinterpret_cast<const char*>(h_nodes_.data()),
+               static_cast<std::streamsize>(h_nodes_.size() * sizeof(SVNode)));
+    pad_to(header.voxels_offset);
+    file.write(reinterpret_cast<const char*>(h_voxels_.data()),
+               static_cast<std::streamsize>(h_voxels_.size()));
+
+    if (!file.flush()) {
+        throw std::runtime_error("Failed to write VDB file " + path);
+    }
+}
+
+void VDB::load(const std::string& path) {
+    MappedFile file(path);
+
+    FileHeader header;
+    if (file.size() < sizeof(header)) {
+        throw std::runtime_error("Not a VDB file: " + path);
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        throw std::runtime_error("Not a VDB file: " + path);
+    }
+    if (header.version != kVersion) {
+        throw std::runtime_error("Unsupported VDB file version " + std::to_string(header.version));
+    }
+    if (header.byte_order != kByteOrder || header.node_size != sizeof(SVNode)) {
+        throw std::runtime_error("VDB file was written by an incompatible host");
+    }
+    if (header.height > kMaxLevels
+        || header.encoding > static_cast<uint32_t>(VoxelEncoding::kPalette)
+        || (header.height == 0) != (header.node_count == 0)) {
+        throw std::runtime_error("VDB file is corrupt");
+    }
+    for (size_t level = 1; level <= header.height; ++level) {
+        if (header.log2_dims[level - 1] != config_t::log2_dim(level)) {
+            throw std::runtime_error("VDB file was written with a different node configuration");
+        }
+    }
+
+    // sections must lie within the file, the checks are ordered so that nothing overflows
+    uint64_t file_size = file.size();
+    if (header.nodes_offset > file_size
+        || header.node_count > (file_size - header.nodes_offset) / sizeof(SVNode)
+        || header.voxels_offset > file_size
+        || header.voxel_bytes > file_size - header.voxels_offset) {
+        throw std::runtime_error("VDB file is truncated");
+    }
+
+    std::vector<SVNode> nodes(header.node_count);
+    std::vector<uint8_t> voxels(header.voxel_bytes);
+    std::memcpy(nodes.data(), file.data() + header.nodes_offset, nodes.size() * sizeof(SVNode));
+    std::memcpy(voxels.data(), file.data() + header.voxels_offset, voxels.size());
+
+    auto encoding = static_cast<VoxelEncoding>(header.encoding);
+    if (!child_arrays_valid(nodes, voxels, encoding)) {
+        throw std::runtime_error("VDB file is corrupt");
+    }
+
+    h_nodes_ = std::move(nodes);
+    h_voxels_ = std::move(voxels);
+    height_ = header.height;
+    size_ = coord_t(header.size[0], header.size[1], header.size[2]);
+    encoding_ = encoding;
+    shared_ = (header.flags & kShared) != 0;
+
+    mark_all_dirty();
+}
+
+}  // namespace spor::vox
@@ -0,0 +1,429 @@
+#include "voxel/vdb.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "voxel/ray_clip.h"
+
+namespace spor::vox {
+
+namespace {
+
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+
+// A hit on a tile, the voxel is the one the ray enters the tile at
+RayHit tile_hit(glm::vec3 origin, glm::vec3 dir, VDB::coord_t size, glm::ivec3 node_min,
+                size_t level, uint8_t value, float t, glm::ivec3 normal) {
+    glm::ivec3 node_max = node_min + glm::ivec3(detail::node_extent(level)) - 1;
+    glm::ivec3 voxel = glm::ivec3(glm::floor(origin + dir * t));
+    voxel = glm::clamp(voxel, node_min, glm::min(node_max, glm::ivec3(size) - 1));
+    return RayHit{VDB::coord_t(voxel), value, normal, t};
+}
+
+uint8_t leaf_value(const std::vector<uint8_t>& voxels, VoxelEncoding encoding, uint32_t offset,
+                   size_t local_offset) {
+    const uint8_t* data = voxels.data() + offset;
+    return encoding == VoxelEncoding::kPalette ? palette::decode_leaf(data, local_offset)
+                                               : data[local_offset];
+}
+
+// Hierarchical DDA: every node is crossed cell by cell like a grid of its children, and only
+// active children are entered, each with the part of the ray inside of it.
+class RayCaster {
+public:
+    RayCaster(glm::vec3 origin, glm::vec3 dir, VDB::coord_t size, VoxelEncoding encoding,
+              const std::vector<SVNode>& nodes, const std::vector<uint8_t>& voxels)
+        : origin_(origin), dir_(dir), size_(size), encoding_(encoding), nodes_(nodes),
+          voxels_(voxels) {
+        for (int axis = 0; axis < 3; ++axis) {
+            step_[axis] = dir[axis] > 0.f ? 1 : dir[axis] < 0.f ? -1 : 0;
+            inv_dir_[axis] = step_[axis] != 0 ? 1.f / dir[axis] : kInfinity;
+        }
+    }
+
+    // Cast through the node at `level` whose box starts at `node_min`, for t in [t_begin, t_end).
+    // The ray enters the node at t_begin through the face with `normal`.
+    std::optional<RayHit> cast(const SVNode& node, size_t level, glm::ivec3 node_min,
+                               float t_begin, float t_end, glm::ivec3 normal) const {
+        if (detail::is_tile(node)) {
+            return tile_hit(origin_, dir_, size_, node_min, level,
+                            static_cast<uint8_t>(node.child_offset), t_begin, normal);
+        }
+
+        const int cell_size = 1 << detail::Config::log2_extent(level - 1);
+        const int dim = detail::Config::dim(level);
+
+        // the cell the ray enters the node in, clamped against rounding at the node's faces
+        glm::vec3 entry = origin_ + dir_ * t_begin;
+        glm::ivec3 cell;
+        glm::vec3 t_next;
+        for (int axis = 0; axis < 3; ++axis) {
+            float local = (entry[axis] - node_min[axis]) / cell_size;
+            cell[axis] = std::clamp(static_cast<int>(std::floor(local)), 0, dim - 1);
+            t_next[axis] = crossing(node_min, cell, cell_size, axis);
+        }
+
+        float t = t_begin;
+        while (t < t_end) {
+            float t_exit = std::min({t_next.x, t_next.y, t_next.z});
+
+            auto index = detail::pos_to_index(VDB::coord_t(cell), detail::node_dim(level));
+            uint64_t bit = 1ull << index;
+            if (node.child_mask & bit) {
+                auto local_offset = detail::popcount(node.child_mask & (bit - 1));
+                glm::ivec3 cell_min = node_min + cell * cell_size;
+
+                if (level == 1) {
+                    uint8_t value = leaf_value(voxels_, encoding_, node.child_offset, local_offset);
+                    return RayHit{VDB::coord_t(cell_min), value, normal, t};
+                }
+
+                auto child = cast(nodes_[node.child_offset + local_offset], level - 1, cell_min, t,
+                                  std::min(t_exit, t_end), normal);
+                if (child) {
+                    return child;
+                }
+            }
+
+            // step every axis the ray crosses at t_exit, through edges and corners diagonally,
+            // the normal is that of the first of them
+            int entered = -1;
+            for (int axis = 0; axis < 3; ++axis) {
+                if (t_next[axis] == t_exit) {
+                    cell[axis] += step_[axis];
+                    t_next[axis] = crossing(node_min, cell, cell_size, axis);
+                    entered = entered < 0 ? axis : entered;
+                }
+            }
+            if (glm::any(glm::lessThan(cell, glm::ivec3(0)))
+                || glm::any(glm::greaterThanEqual(cell, glm::ivec3(dim)))) {
+                break;
+            }
+
+            t = t_exit;
+            normal = detail::face_normal(entered, dir_);
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    // Where the ray leaves `cell` along `axis`. Computed from the face rather than stepped, so it
+    // does not drift and matches the slab tests of PacketCaster.
+    float crossing(glm::ivec3 node_min, glm::ivec3 cell, int cell_size, int axis) const {
+        if (step_[axis] == 0) {
+            return kInfinity;
+        }
+        int face = node_min[axis] + (cell[axis] + (step_[axis] > 0)) * cell_size;
+        return (face - origin_[axis]) * inv_dir_[axis];
+    }
+
+    glm::vec3 origin_, dir_;
+    glm::ivec3 step_;
+    glm::vec3 inv_dir_;
+
+    VDB::coord_t size_;
+    VoxelEncoding encoding_;
+    const std::vector<SVNode>& nodes_;
+    const std::vector<uint8_t>& voxels_;
+};
+
+// Casts the lanes of a packet that head into the same octant together. The children of a node
+// are visited in z, y, x order, each axis running in the octant's direction. A ray moves forward
+// along every axis, so a cell it reaches before another also comes first in that order, and the
+// first hit found for a lane is its closest one. Per child, all lanes are slab tested at once.
+template <size_t N> class PacketCaster {
+public:
+    // `t_exit` is where each lane leaves the volume or reaches its tmax
+    PacketCaster(const RayPacket<N>& packet, glm::ivec3 step, const float* t_exit,
+                 VDB::coord_t size, VoxelEncoding encoding, const std::vector<SVNode>& nodes,
+                 const std::vector<uint8_t>& voxels, RayHit* hits)
+        : origins_{packet.origin_x, packet.origin_y, packet.origin_z},
+          dirs_{packet.dir_x, packet.dir_y, packet.dir_z}, step_(step), t_exit_(t_exit),
+          size_(size), encoding_(encoding), nodes_(nodes), voxels_(voxels), hits_(hits) {
+        for (int axis = 0; axis < 3; ++axis) {
+            for (size_t lane = 0; lane < N; ++lane) {
+                inv_dir_[axis][lane] = 1.f / dirs_[axis][lane];
+            }
+        }
+    }
+
+    // Cast the lanes in `active` through the node at `level` whose box starts at `node_min`, lane
+    // i entering it at t_in[i] through the face on axis_in[i]. Returns the lanes that did not hit
+    // anything inside of it.
+    uint32_t cast(const SVNode& node, size_t level, glm::ivec3 node_min, uint32_t active,
+                  const float* t_in, const int* axis_in) const {
+        if (detail::is_tile(node)) {
+            for (uint32_t lanes = active; lanes; lanes &= lanes - 1) {
+                auto lane = detail::lowest_bit(lanes);
+                hits_[lane] = tile_hit(origin(lane), dir(lane), size_, node_min, level,
+                                       static_cast<uint8_t>(node.child_offset), t_in[lane],
+                                       normal(lane, axis_in[lane]));
+            }
+            return 0;
+        }
+
+        // the packet has diverged down to one lane, which walks the node on its own
+        if ((active & (active - 1)) == 0) {
+            auto lane = detail::lowest_bit(active);
+            RayCaster caster(origin(lane), dir(lane), size_, encoding_, nodes_, voxels_);
+            auto hit = caster.cast(node, level, node_min, t_in[lane], t_exit_[lane],
+                                   normal(lane, axis_in[lane]));
+            if (hit) {
+                hits_[lane] = *hit;
+                return 0;
+            }
+            return active;
+        }
+
+        const int cell_size = 1 << detail::Config::log2_extent(level - 1);
+        const int dim = detail::Config::dim(level);
+
+        glm::ivec3 first, last;
+        cell_range(node_min, dim, cell_size, active, t_in, first, last);
+
+        float t_child[N];
+        int axis_child[N];
+        glm::ivec3 count = last - first + 1;
+        for (int k_z = 0; k_z < count.z; ++k_z) {
+            for (int k_y = 0; k_y < count.y; ++k_y) {
+                for (int k_x = 0; k_x < count.x; ++k_x) {
+                    glm::ivec3 cell = ordered(first, last, glm::ivec3(k_x, k_y, k_z));
+                    auto index = detail::pos_to_index(VDB::coord_t(cell), detail::node_dim(level));
+                    uint64_t bit = 1ull << index;
+                    if (!(node.child_mask & bit)) {
+                        continue;
+                    }
+
+                    glm::ivec3 cell_min = node_min + cell * cell_size;
+                    uint32_t entering
+                        = active & enter(cell_min, cell_size, t_in, axis_in, t_child, axis_child);
+                    if (!entering) {
+                        continue;
+                    }
+
+                    auto local_offset = detail::popcount(node.child_mask & (bit - 1));
+                    if (level == 1) {
+                        uint8_t value
+                            = leaf_value(voxels_, encoding_, node.child_offset, local_offset);
+                        for (uint32_t lanes = entering; lanes; lanes &= lanes - 1) {
+                            auto lane = detail::lowest_bit(lanes);
+                            hits_[lane] = RayHit{VDB::coord_t(cell_min), value,
+                                                 normal(lane, axis_child[lane]), t_child[lane]};
+                        }
+                        active &= ~entering;
+                    } else {
+                        uint32_t missed = cast(nodes_[node.child_offset + local_offset], level - 1,
+                                               cell_min, entering, t_child, axis_child);
+                        active = (active & ~entering) | missed;
+                    }
+
+                    if (!active) {
+                        return 0;
+                    }
+                }
+            }
+        }
+
+        return active;
+    }
+
+private:
+    // The box of cells [first, last] between where the lanes enter and leave the node, widened
+    // against rounding at the faces of the cells. The slab tests decide which of them each lane
+    // actually crosses.
+    void cell_range(glm::ivec3 node_min, int dim, int cell_size, uint32_t active,
+                    const float* t_in, glm::ivec3& first, glm::ivec3& last) const {
+        constexpr float kSlack = 1e-3f;
+
+        float t_out[N];
+        for (size_t lane = 0; lane < N; ++lane) {
+            t_out[lane] = t_exit_[lane];
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            float face = static_cast<float>(node_min[axis] + (step_[axis] > 0) * dim * cell_size);
+            for (size_t lane = 0; lane < N; ++lane) {
+                float t_face = (face - origins_[axis][lane]) * inv_dir_[axis][lane];
+                t_out[lane] = std::min(t_out[lane], t_face);
+            }
+        }
+
+        for (int axis = 0; axis < 3; ++axis) {
+            float low = kInfinity, high = -kInfinity;
+            for (size_t lane = 0; lane < N; ++lane) {
+                bool on = active & (1u << lane);
+                float in = origins_[axis][lane] + dirs_[axis][lane] * t_in[lane];
+                float out = origins_[axis][lane] + dirs_[axis][lane] * t_out[lane];
+                low = std::min(low, on ? std::min(in, out) : kInfinity);
+                high = std::max(high, on ? std::max(in, out) : -kInfinity);
+            }
+
+            float scale = 1.f / cell_size;
+            first[axis] = static_cast<int>(std::floor((low - node_min[axis]) * scale - kSlack));
+            last[axis] = static_cast<int>(std::floor((high - node_min[axis]) * scale + kSlack));
+            first[axis] = std::clamp(first[axis], 0, dim - 1);
+            last[axis] = std::clamp(last[axis], 0, dim - 1);
+        }
+    }
+
+    // The k-th cell of [first, last] along each axis, counted in the octant's direction
+    glm::ivec3 ordered(glm::ivec3 first, glm::ivec3 last, glm::ivec3 k) const {
+        glm::ivec3 cell;
+        for (int axis = 0; axis < 3; ++axis) {
+            cell[axis] = step_[axis] > 0 ? first[axis] + k[axis] : last[axis] - k[axis];
+        }
+        return cell;
+    }
+
+    // Slab test every lane against the box of a child, which a lane enters at the latest of its
+    // entry into the parent and the child's near faces. Returns the mask of the lanes crossing it.
+    // Written over all N lanes without branches so that the compiler vectorizes it.
+    uint32_t enter(glm::ivec3 cell_min, int cell_size, const float* t_in, const int* axis_in,
+                   float* t_child, int* axis_child) const {
+        float near_face[3], far_face[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            near_face[axis] = static_cast<float>(cell_min[axis] + (step_[axis] < 0) * cell_size);
+            far_face[axis] = static_cast<float>(cell_min[axis] + (step_[axis] > 0) * cell_size);
+        }
+
+        bool inside[N];
+        for (size_t lane = 0; lane < N; ++lane) {
+            float t0 = t_in[lane], t1 = t_exit_[lane];
+            int axis0 = axis_in[lane];
+            for (int axis = 0; axis < 3; ++axis) {
+                float t_near = (near_face[axis] - origins_[axis][lane]) * inv_dir_[axis][lane];
+                float t_far = (far_face[axis] - origins_[axis][lane]) * inv_dir_[axis][lane];
+                axis0 = t_near > t0 ? axis : axis0;
+                t0 = std::max(t0, t_near);
+                t1 = std::min(t1, t_far);
+            }
+            t_child[lane] = t0;
+            axis_child[lane] = axis0;
+            inside[lane] = t0 < t1;
+        }
+
+        uint32_t mask = 0;
+        for (size_t lane = 0; lane < N; ++lane) {
+            mask |= uint32_t(inside[lane]) << lane;
+        }
+        return mask;
+    }
+
+    glm::vec3 origin(size_t lane) const {
+        return {origins_[0][lane], origins_[1][lane], origins_[2][lane]};
+    }
+
+    glm::vec3 dir(size_t lane) const { return {dirs_[0][lane], dirs_[1][lane], dirs_[2][lane]}; }
+
+    glm::ivec3 normal(size_t lane, int axis) const { return detail::face_normal(axis, dir(lane)); }
+
+    const float* origins_[3];
+    const float* dirs_[3];
+    glm::ivec3 step_;
+    const float* t_exit_;
+    float inv_dir_[3][N];
+
+    VDB::coord_t size_;
+    VoxelEncoding encoding_;
+    const std::vector<SVNode>& nodes_;
+    const std::vector<uint8_t>& voxels_;
+    RayHit* hits_;
+};
+
+}  // namespace
+
+std::optional<RayHit> VDB::raycast(glm::vec3 origin, glm::vec3 dir, float tmax) const {
+    if (h_nodes_.empty()) {
+        throw std::runtime_error("VDB is empty");
+    }
+
+    // clip the ray against the volume, remembering the face it enters through
+    auto clip = detail::clip_ray(origin, dir, tmax, size_);
+    if (!clip) {
+        return std::nullopt;
+    }
+
+    RayCaster caster(origin, dir, size_, encoding_, h_nodes_, h_voxels_);
+    return caster.cast(h_nodes_.front(), height_, glm::ivec3(0), clip->t_enter, clip->t_exit,
+                       detail::face_normal(clip->axis, dir));
+}
+
+std::optional<RayHit> VDB::raycast(const glm::mat4& inv_m, glm::vec3 origin, glm::vec3 dir,
+                                   float tmax) const {
+    // t is preserved by the affine transform, so it is the world-space parameter as well
+    return raycast(glm::vec3(inv_m * glm::vec4(origin, 1.f)),
+                   glm::vec3(inv_m * glm::vec4(dir, 0.f)), tmax);
+}
+
+template <size_t N> uint32_t VDB::raycast(const RayPacket<N>& packet, RayHit* hits) const {
+    if (h_nodes_.empty()) {
+        throw std::runtime_error("VDB is empty");
+    }
+
+    // clip every lane and group them by octant, lanes parallel to an axis plane are in none
+    float t_in[N], t_exit[N];
+    int axis_in[N];
+    uint32_t clipped = 0, octants[8] = {};
+    for (size_t lane = 0; lane < N; ++lane) {
+        t_in[lane] = t_exit[lane] = 0.f;
+        axis_in[lane] = -1;
+        if (!(packet.active & (1u << lane))) {
+            continue;
+        }
+
+        glm::vec3 dir(packet.dir_x[lane], packet.dir_y[lane], packet.dir_z[lane]);
+        glm::vec3 origin(packet.origin_x[lane], packet.origin_y[lane], packet.origin_z[lane]);
+        auto clip = detail::clip_ray(origin, dir, packet.tmax[lane], size_);
+        if (!clip) {
+            continue;
+        }
+
+        clipped |= 1u << lane;
+        t_in[lane] = clip->t_enter;
+        t_exit[lane] = clip->t_exit;
+        axis_in[lane] = clip->axis;
+        if (dir.x != 0.f && dir.y != 0.f && dir.z != 0.f) {
+            octants[(dir.x < 0.f) | (dir.y < 0.f) << 1 | (dir.z < 0.f) << 2] |= 1u << lane;
+        }
+    }
+
+    // the most common octant is cast as a packet, every other lane on its own
+    int octant = 0;
+    for (int i = 1; i < 8; ++i) {
+        if (detail::popcount(octants[i]) > detail::popcount(octants[octant])) {
+            octant = i;
+        }
+    }
+    uint32_t packed = detail::popcount(octants[octant]) > 1 ? octants[octant] : 0;
+
+    uint32_t missed = 0;
+    if (packed) {
+        glm::ivec3 step(octant & 1 ? -1 : 1, octant & 2 ? -1 : 1, octant & 4 ? -1 : 1);
+        PacketCaster<N> caster(packet, step, t_exit, size_, encoding_, h_nodes_, h_voxels_, hits);
+        missed = caster.cast(h_nodes_.front(), height_, glm::ivec3(0), packed, t_in, axis_in);
+    }
+
+    for (uint32_t lanes = clipped & ~packed; lanes; lanes &= lanes - 1) {
+        auto lane = detail::lowest_bit(lanes);
+        glm::vec3 origin(packet.origin_x[lane], packet.origin_y[lane], packet.origin_z[lane]);
+        glm::vec3 dir(packet.dir_x[lane], packet.dir_y[lane], packet.dir_z[lane]);
+
+        RayCaster caster(origin, dir, size_, encoding_, h_nodes_, h_voxels_);
+        auto hit = caster.cast(h_nodes_.front(), height_, glm::ivec3(0), t_in[lane],
+                               t_exit[lane], detail::face_normal(axis_in[lane], dir));
+        if (hit) {
+            hits[lane] = *hit;
+        } else {
+            missed |= 1u << lane;
+        }
+    }
+
+    return clipped & ~missed;
+}
+
+template uint32_t VDB::raycast<4>(const RayPacket<4>& packet, RayHit* hits) const;
+template uint32_t VDB::raycast<8>(const RayPacket<8>& packet, RayHit* hits) const;
+template uint32_t VDB::raycast<16>(const RayPacket<16>& packet, RayHit* hits) const;
+
+}  // namespace spor::vox
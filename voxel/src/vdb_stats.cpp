@@ -0,0 +1,144 @@
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+#include "voxel/vdb.h"
+
+namespace spor::vox {
+
+uint64_t VDBStats::nodes() const {
+    uint64_t count = 0;
+    for (const auto& level : levels) {
+        count += level.nodes;
+    }
+    return count;
+}
+
+uint64_t VDBStats::tiles() const {
+    uint64_t count = 0;
+    for (const auto& level : levels) {
+        count += level.tiles;
+    }
+    return count;
+}
+
+double VDBStats::tile_ratio() const {
+    uint64_t count = nodes();
+    return count == 0 ? 0.0 : static_cast<double>(tiles()) / count;
+}
+
+double VDBStats::empty_ratio() const {
+    uint64_t slots = 0, empty = 0;
+    for (const auto& level : levels) {
+        slots += level.child_slots;
+        empty += level.empty_slots;
+    }
+    return slots == 0 ? 0.0 : static_cast<double>(empty) / slots;
+}
+
+std::string VDBStats::to_json() const {
+    std::ostringstream json;
+    json << "{\"height\": " << height << ", \"size\": [" << size.x << ", " << size.y << ", "
+         << size.z << "], \"encoding\": \""
+         << (encoding == VoxelEncoding::kPalette ? "palette" : "bytes") << "\", \"nodes\": "
+         << nodes() << ", \"tiles\": " << tiles() << ", \"active_voxels\": " << active_voxels
+         << ", \"tile_ratio\": " << tile_ratio() << ", \"empty_ratio\": " << empty_ratio()
+         << ", \"host_bytes\": " << host_bytes << ", \"device_bytes\": " << device_bytes;
+
+    json << ", \"levels\": [";
+    for (size_t level = 1; level < levels.size(); ++level) {
+        const auto& stats = levels[level];
+        json << (level > 1 ? ", " : "") << "{\"level\": " << level << ", \"nodes\": " << stats.nodes
+             << ", \"tiles\": " << stats.tiles << ", \"child_slots\": " << stats.child_slots
+             << ", \"empty_slots\": " << stats.empty_slots << ", \"node_bytes\": "
+             << stats.node_bytes << ", \"voxel_bytes\": " << stats.voxel_bytes
+             << ", \"references\": " << stats.references << "}";
+    }
+
+    json << "], \"leaf_occupancy\": [";
+    for (size_t count = 0; count < leaf_occupancy.size(); ++count) {
+        json << (count > 0 ? ", " : "") << leaf_occupancy[count];
+    }
+    json << "]}";
+
+    return json.str();
+}
+
+VDBStats VDB::stats() const {
+    VDBStats stats;
+    stats.height = height_;
+    stats.size = size_;
+    stats.encoding = encoding_;
+    stats.levels.resize(height_ + 1);
+
+    stats.host_bytes = h_nodes_.size() * sizeof(SVNode) + h_voxels_.size();
+    for (const auto& buffer : {d_info_, d_nodes_, d_voxels_}) {
+        if (buffer) {
+            stats.device_bytes += buffer->size();
+        }
+    }
+
+    if (height_ == 0) {
+        return stats;
+    }
+
+    // Level by level from the root, every stored node once with the number of references to it.
+    // After deduplicate() a node may be referenced by several parents, its children are then
+    // visited once with the sum, so the walk follows the stored arrays, not the expanded tree.
+    std::vector<bool> counted_nodes(h_nodes_.size()), counted_voxels(h_voxels_.size());
+    std::unordered_map<uint32_t, uint64_t> level_refs{{0, 1}}, child_refs;
+    for (size_t level = height_; level > 0 && !level_refs.empty(); --level) {
+        auto& level_stats = stats.levels[level];
+        child_refs.clear();
+
+        for (auto [index, refs] : level_refs) {
+            const SVNode& node = h_nodes_[index];
+            level_stats.references += refs;
+
+            // an array of tiles may be shared by levels, its nodes are stored at the first
+            bool stored = !counted_nodes[index];
+            counted_nodes[index] = true;
+            if (stored) {
+                ++level_stats.nodes;
+                level_stats.node_bytes += sizeof(SVNode);
+            }
+
+            if (detail::is_tile(node)) {
+                level_stats.tiles += stored;
+                stats.active_voxels += refs << (3 * detail::Config::log2_extent(level));
+                continue;
+            }
+
+            uint32_t children = detail::popcount(node.child_mask);
+            if (stored) {
+                level_stats.child_slots += detail::Config::num_children(level);
+                level_stats.empty_slots += detail::Config::num_children(level) - children;
+            }
+
+            if (node.is_leaf) {
+                stats.active_voxels += refs * children;
+                if (stored) {
+                    ++stats.leaf_occupancy[children];
+
+                    // palette runs may be shared by leaves of different sizes, count bytes once
+                    size_t end = node.child_offset + leaf_data_size(node);
+                    for (size_t byte = node.child_offset; byte < end; ++byte) {
+                        level_stats.voxel_bytes += !counted_voxels[byte];
+                        counted_voxels[byte] = true;
+                    }
+                }
+                continue;
+            }
+
+            for (uint32_t i = 0; i < children; ++i) {
+                child_refs[node.child_offset + i] += refs;
+            }
+        }
+
+        std::swap(level_refs, child_refs);
+    }
+
+    return stats;
+}
+
+}  // namespace spor::vox
@@ -0,0 +1,195 @@
+#include "voxel/versioned_vdb.h"
+
+#include <algorithm>
+#include <bitset>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+namespace spor::vox {
+
+// A reader's hazard slot: the version it pins, which publish() must not reclaim
+struct VersionedVDB::ReadGuard::Slot {
+    std::atomic<bool> taken{false};
+    std::atomic<const Snapshot*> pinned{nullptr};
+};
+
+namespace {
+
+// Share the pages of `pages` that none of `dirty` touch, and copy the others from `data`
+template <typename T>
+void update_pages(std::vector<std::shared_ptr<const std::vector<T>>>& pages,
+                  const std::vector<T>& data, const DirtyRanges& dirty, size_t page_size) {
+    size_t num_pages = (data.size() + page_size - 1) / page_size;
+    pages.resize(num_pages);
+
+    std::vector<bool> stale(num_pages, false);
+    for (const auto& range : dirty.merged(data.size())) {
+        for (size_t page = range.begin / page_size; page * page_size < range.end; ++page) {
+            stale[page] = true;
+        }
+    }
+
+    for (size_t page = 0; page < num_pages; ++page) {
+        size_t begin = page * page_size;
+        size_t end = std::min(begin + page_size, data.size());
+        // the last page also changes when the array grows or shrinks within it
+        if (stale[page] || !pages[page] || pages[page]->size() != end - begin) {
+            pages[page] = std::make_shared<const std::vector<T>>(data.begin() + begin,
+                                                                 data.begin() + end);
+        }
+    }
+}
+
+}  // namespace
+
+uint8_t VersionedVDB::Snapshot::get_voxel(coord_t pos) const {
+    if (pos.x >= size_.x || pos.y >= size_.y || pos.z >= size_.z) {
+        throw std::invalid_argument("Voxel pos is out of bounds");
+    }
+
+    using MaskCounter = std::bitset<sizeof(decltype(SVNode::child_mask)) * 8>;
+
+    SVNode current = node(0);
+    for (size_t level = height_; level >= 1; --level) {
+        if (detail::is_tile(current)) {
+            return current.child_offset;
+        }
+
+        auto index = detail::child_index(pos, level);
+        if (!(current.child_mask & (1ull << index))) {
+            return 0;
+        }
+
+        size_t local_offset = MaskCounter(current.child_mask & ((1ull << index) - 1)).count();
+        if (level == 1) {
+            if (encoding_ == VoxelEncoding::kPalette) {
+                size_t leaf = current.child_offset;
+                return palette::decode_leaf_at([&](size_t i) { return voxel(leaf + i); },
+                                               local_offset);
+            }
+            return voxel(current.child_offset + local_offset);
+        }
+
+        current = node(current.child_offset + local_offset);
+    }
+
+    throw std::runtime_error("Something went wrong while traversing node tree");
+}
+
+VersionedVDB::ReadGuard::ReadGuard(ReadGuard&& other) noexcept
+    : slot_(other.slot_), snapshot_(other.snapshot_) {
+    other.slot_ = nullptr;
+    other.snapshot_ = nullptr;
+}
+
+VersionedVDB::ReadGuard& VersionedVDB::ReadGuard::operator=(ReadGuard&& other) noexcept {
+    if (this != &other) {
+        release();
+        slot_ = other.slot_;
+        snapshot_ = other.snapshot_;
+        other.slot_ = nullptr;
+        other.snapshot_ = nullptr;
+    }
+    return *this;
+}
+
+VersionedVDB::ReadGuard::~ReadGuard() { release(); }
+
+void VersionedVDB::ReadGuard::release() {
+    if (slot_) {
+        slot_->pinned.store(nullptr, std::memory_order_release);
+        slot_->taken.store(false, std::memory_order_release);
+        slot_ = nullptr;
+    }
+}
+
+VersionedVDB::VersionedVDB(VDB tree, size_t max_readers)
+    : tree_(std::move(tree)),
+      slots_(std::make_unique<ReadGuard::Slot[]>(max_readers)),
+      num_slots_(max_readers),
+      latest_(nullptr) {
+    if (tree_.h_nodes_.empty()) {
+        throw std::invalid_argument("VDB is empty");
+    }
+
+    tree_.mark_all_dirty();
+    publish();
+}
+
+VersionedVDB::~VersionedVDB() = default;
+
+VersionedVDB::ReadGuard VersionedVDB::read() const {
+    // start looking for a free slot at a different place on every thread
+    size_t start = std::hash<std::thread::id>{}(std::this_thread::get_id()) % num_slots_;
+
+    ReadGuard::Slot* slot = nullptr;
+    for (size_t i = 0; i < num_slots_ && !slot; ++i) {
+        auto& candidate = slots_[(start + i) % num_slots_];
+        bool taken = false;
+        if (!candidate.taken.load(std::memory_order_relaxed)
+            && candidate.taken.compare_exchange_strong(taken, true, std::memory_order_acquire)) {
+            slot = &candidate;
+        }
+    }
+
+    if (!slot) {
+        throw std::runtime_error("Too many concurrent readers");
+    }
+
+    // publish() scans the slots after replacing the latest version, so once the pin is visible
+    // and the version is still the latest, it can no longer be reclaimed
+    const Snapshot* snapshot = latest_.load();
+    while (true) {
+        slot->pinned.store(snapshot);
+        const Snapshot* latest = latest_.load();
+        if (latest == snapshot) {
+            break;
+        }
+        snapshot = latest;
+    }
+
+    return ReadGuard(slot, snapshot);
+}
+
+uint64_t VersionedVDB::version() const { return latest_.load()->version(); }
+
+size_t VersionedVDB::retained_versions() const {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return versions_.size();
+}
+
+uint64_t VersionedVDB::publish() {
+    auto next = versions_.empty() ? std::make_unique<Snapshot>()
+                                  : std::make_unique<Snapshot>(*versions_.back());
+    next->version_ = versions_.empty() ? 0 : versions_.back()->version_ + 1;
+    next->height_ = tree_.height_;
+    next->size_ = tree_.size_;
+    next->encoding_ = tree_.encoding_;
+
+    update_pages(next->nodes_, tree_.h_nodes_, tree_.dirty_nodes_, kNodePageSize);
+    update_pages(next->voxels_, tree_.h_voxels_, tree_.dirty_voxels_, kVoxelPageSize);
+    tree_.dirty_nodes_.clear();
+    tree_.dirty_voxels_.clear();
+
+    uint64_t version = next->version_;
+    latest_.store(next.get());
+    versions_.push_back(std::move(next));
+
+    // reclaim every older version no reader has pinned
+    std::vector<const Snapshot*> pinned;
+    for (size_t i = 0; i < num_slots_; ++i) {
+        if (auto* snapshot = slots_[i].pinned.load()) {
+            pinned.push_back(snapshot);
+        }
+    }
+
+    auto reclaimed = std::remove_if(versions_.begin(), versions_.end() - 1, [&](const auto& v) {
+        return std::find(pinned.begin(), pinned.end(), v.get()) == pinned.end();
+    });
+    versions_.erase(reclaimed, versions_.end() - 1);
+
+    return version;
+}
+
+}  // namespace spor::vox
@@ -0,0 +1,342 @@
+#include "voxel/voxelizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace spor::vox {
+
+namespace {
+
+// Triangles binned per worker before they are handed out
+constexpr size_t kTriangleBlock = 1024;
+
+constexpr float kBelowAll = -std::numeric_limits<float>::infinity();
+
+// A triangle overlapping a leaf, keyed by the tree_key of the leaf's min
+struct CellTriangle {
+    uint64_t key;
+    uint32_t triangle;
+
+    bool operator<(const CellTriangle& other) const {
+        return key < other.key || (key == other.key && triangle < other.triangle);
+    }
+};
+
+// Height of a z-ray through the center of a column of voxels where it crosses a triangle,
+// the column being y * dims.x + x
+struct Crossing {
+    uint64_t column;
+    float z;
+
+    bool operator<(const Crossing& other) const {
+        return column < other.column || (column == other.column && z < other.z);
+    }
+};
+
+struct Triangle {
+    glm::vec3 v[3];
+};
+
+// Whether the triangle and the closed box [min, max] overlap, by the separating axis test of
+// Akenine-Möller: the box's axes, the triangle's normal and the 9 cross products of their edges
+bool overlaps(const Triangle& triangle, glm::vec3 min, glm::vec3 max) {
+    glm::vec3 center = (min + max) * 0.5f;
+    glm::vec3 half = (max - min) * 0.5f;
+    glm::vec3 v0 = triangle.v[0] - center;
+    glm::vec3 v1 = triangle.v[1] - center;
+    glm::vec3 v2 = triangle.v[2] - center;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (std::min({v0[axis], v1[axis], v2[axis]}) > half[axis]
+            || std::max({v0[axis], v1[axis], v2[axis]}) < -half[axis]) {
+            return false;
+        }
+    }
+
+    // projected radius of the box onto `axis`
+    auto radius = [&](glm::vec3 axis) { return glm::dot(half, glm::abs(axis)); };
+
+    const glm::vec3 edges[3] = {v1 - v0, v2 - v1, v0 - v2};
+    glm::vec3 normal = glm::cross(edges[0], edges[1]);
+    if (std::abs(glm::dot(normal, v0)) > radius(normal)) {
+        return false;
+    }
+
+    for (const auto& edge : edges) {
+        for (int axis = 0; axis < 3; ++axis) {
+            glm::vec3 unit(0.f);
+            unit[axis] = 1.f;
+            glm::vec3 separating = glm::cross(unit, edge);
+
+            float p0 = glm::dot(separating, v0);
+            float p1 = glm::dot(separating, v1);
+            float p2 = glm::dot(separating, v2);
+            float r = radius(separating);
+            if (std::min({p0, p1, p2}) > r || std::max({p0, p1, p2}) < -r) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Add the crossings of the triangle with the voxel columns whose centers its projection onto xy
+// covers. Points on an edge are only covered by the triangles on one side of it, which makes
+// every z-ray cross a closed mesh an even number of times.
+void add_crossings(const Triangle& triangle, VDB::coord_t dims, std::vector<Crossing>& out) {
+    glm::dvec3 a(triangle.v[0]), b(triangle.v[1]), c(triangle.v[2]);
+    auto orient = [](glm::dvec3 u, glm::dvec3 v, double x, double y) {
+        return (v.x - u.x) * (y - u.y) - (v.y - u.y) * (x - u.x);
+    };
+
+    double area = orient(a, b, c.x, c.y);
+    if (area == 0.0) {
+        return;  // edge-on, the neighbouring triangles cover its columns
+    } else if (area < 0.0) {
+        std::swap(b, c);
+        area = -area;
+    }
+
+    // the edge from u to v owns the centers it passes through when the triangle is on this side
+    auto owns = [](glm::dvec3 u, glm::dvec3 v) {
+        return v.y > u.y || (v.y == u.y && v.x < u.x);
+    };
+    const bool owns_bc = owns(b, c), owns_ca = owns(c, a), owns_ab = owns(a, b);
+    auto covered = [](double w, bool owned) { return w > 0.0 || (w == 0.0 && owned); };
+
+    double min_x = std::min({a.x, b.x, c.x}), max_x = std::max({a.x, b.x, c.x});
+    double min_y = std::min({a.y, b.y, c.y}), max_y = std::max({a.y, b.y, c.y});
+    double x_begin = std::max(std::ceil(min_x - 0.5), 0.0);
+    double x_end = std::min(std::floor(max_x - 0.5), dims.x - 1.0);
+    double y_begin = std::max(std::ceil(min_y - 0.5), 0.0);
+    double y_end = std::min(std::floor(max_y - 0.5), dims.y - 1.0);
+
+    for (double y = y_begin; y <= y_end; ++y) {
+        for (double x = x_begin; x <= x_end; ++x) {
+            double w_a = orient(b, c, x + 0.5, y + 0.5);
+            double w_b = orient(c, a, x + 0.5, y + 0.5);
+            double w_c = orient(a, b, x + 0.5, y + 0.5);
+            if (covered(w_a, owns_bc) && covered(w_b, owns_ca) && covered(w_c, owns_ab)) {
+                double z = (w_a * a.z + w_b * b.z + w_c * c.z) / area;
+                out.push_back(Crossing{static_cast<uint64_t>(y) * dims.x + static_cast<uint64_t>(x),
+                                       static_cast<float>(z)});
+            }
+        }
+    }
+}
+
+// Bounding box of the triangle, clamped to a voxel around the volume so that it converts to ints
+void bounds(const Triangle& triangle, VDB::coord_t dims, glm::vec3& min, glm::vec3& max) {
+    glm::vec3 low(-1.f), high = glm::vec3(dims) + 1.f;
+    min = glm::clamp(glm::min(glm::min(triangle.v[0], triangle.v[1]), triangle.v[2]), low, high);
+    max = glm::clamp(glm::max(glm::max(triangle.v[0], triangle.v[1]), triangle.v[2]), low, high);
+}
+
+}  // namespace
+
+VDB::coord_t TriangleMesh::fit_to(uint32_t resolution) {
+    if (positions.empty()) {
+        throw std::invalid_argument("Mesh has no vertices");
+    }
+
+    glm::vec3 min = positions.front(), max = positions.front();
+    for (const auto& position : positions) {
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+    }
+
+    float longest = std::max({max.x - min.x, max.y - min.y, max.z - min.z});
+    if (longest <= 0.f) {
+        throw std::invalid_argument("Mesh has no extent");
+    }
+
+    float scale = resolution / longest;
+    for (auto& position : positions) {
+        position = (position - min) * scale;
+    }
+
+    VDB::coord_t dims(0);
+    for (int axis = 0; axis < 3; ++axis) {
+        dims[axis] = std::clamp(static_cast<uint32_t>(std::ceil((max[axis] - min[axis]) * scale)),
+                                1u, resolution);
+    }
+    return dims;
+}
+
+void voxelize_mesh(VDB& vdb, VDB::coord_t dims, const TriangleMesh& mesh,
+                   const VoxelizeOptions& options) {
+    if (dims.x == 0 || dims.y == 0 || dims.z == 0) {
+        throw std::invalid_argument("VDB dimensions must be non-zero");
+    }
+    if (mesh.indices.size() % 3 != 0) {
+        throw std::invalid_argument("Mesh indices are not a list of triangles");
+    }
+    if (std::any_of(mesh.indices.begin(), mesh.indices.end(),
+                    [&](uint32_t index) { return index >= mesh.positions.size(); })) {
+        throw std::invalid_argument("Mesh index is out of bounds");
+    }
+
+    const size_t height = detail::tree_height(dims);
+    if (detail::tree_key_shift(height) > 64) {
+        throw std::invalid_argument("VDB dimensions are too large to voxelize");
+    }
+
+    auto triangle_at = [&](size_t i) {
+        return Triangle{{mesh.positions[mesh.indices[3 * i]],
+                         mesh.positions[mesh.indices[3 * i + 1]],
+                         mesh.positions[mesh.indices[3 * i + 2]]}};
+    };
+
+    // Bin the triangles into the leaves they overlap, and with `solid` find the columns they
+    // cross, one block of triangles at a time per worker
+    const glm::vec3 leaf_extent(detail::node_extent(1));
+    const glm::ivec3 last_cell = glm::ivec3((dims - 1u) / detail::node_extent(1));
+    const size_t num_triangles = mesh.num_triangles();
+    const size_t num_blocks = (num_triangles + kTriangleBlock - 1) / kTriangleBlock;
+    const size_t num_threads = std::min(detail::resolve_num_threads(options.num_threads),
+                                        std::max<size_t>(num_blocks, 1));
+
+    std::vector<std::vector<CellTriangle>> thread_cells(num_threads);
+    std::vector<std::vector<Crossing>> thread_crossings(num_threads);
+    detail::parallel_for(num_blocks, num_threads, [&](size_t block, size_t thread) {
+        auto& cells = thread_cells[thread];
+        size_t end = std::min((block + 1) * kTriangleBlock, num_triangles);
+        for (size_t i = block * kTriangleBlock; i < end; ++i) {
+            auto triangle = triangle_at(i);
+            glm::vec3 min, max;
+            bounds(triangle, dims, min, max);
+
+            // the boxes are closed, so a triangle touching a cell's min face overlaps
+            // the cell below too
+            auto first = glm::max(glm::ivec3(glm::ceil(min / leaf_extent)) - 1, glm::ivec3(0));
+            auto last = glm::min(glm::ivec3(glm::floor(max / leaf_extent)), last_cell);
+            for (int z = first.z; z <= last.z; ++z) {
+                for (int y = first.y; y <= last.y; ++y) {
+                    for (int x = first.x; x <= last.x; ++x) {
+                        glm::vec3 cell_min = glm::vec3(x, y, z) * leaf_extent;
+                        if (overlaps(triangle, cell_min, cell_min + leaf_extent)) {
+                            auto pos = VDB::coord_t(x, y, z) * detail::node_extent(1);
+                            cells.push_back(CellTriangle{detail::tree_key(pos, height),
+                                                         static_cast<uint32_t>(i)});
+                        }
+                    }
+                }
+            }
+
+            if (options.solid) {
+                add_crossings(triangle, dims, thread_crossings[thread]);
+            }
+        }
+    });
+
+    // merge in tree order, releasing each worker's share as it goes
+    auto merge = [](auto& parts) {
+        size_t total = 0;
+        for (const auto& part : parts) {
+            total += part.size();
+        }
+
+        std::decay_t<decltype(parts.front())> merged;
+        merged.reserve(total);
+        for (auto& part : parts) {
+            merged.insert(merged.end(), part.begin(), part.end());
+            std::decay_t<decltype(part)>().swap(part);
+        }
+        std::sort(merged.begin(), merged.end());
+        return merged;
+    };
+    const auto cells = merge(thread_cells);
+    const auto crossings = merge(thread_crossings);
+
+    // number of crossings of the column below `z`, odd inside the mesh
+    auto crossings_below = [&](uint64_t column, float z) {
+        auto begin
+            = std::lower_bound(crossings.begin(), crossings.end(), Crossing{column, kBelowAll});
+        auto end = std::lower_bound(begin, crossings.end(), Crossing{column, z});
+        return static_cast<size_t>(end - begin);
+    };
+
+    BuildOptions build_options;
+    build_options.num_threads = options.num_threads;
+
+    // Nodes without binned triangles hold no surface, so they are either outside of the mesh or,
+    // since no surface separates their voxels, inside of it as a whole
+    build_options.classify_region = [&](glm::uvec3 min, glm::uvec3 max) {
+        uint32_t extent = std::max({max.x - min.x, max.y - min.y, max.z - min.z});
+        size_t level = 1;
+        while (detail::node_extent(level).x < extent) {
+            ++level;
+        }
+
+        uint64_t first = detail::tree_key(min, height);
+        size_t shift = detail::tree_key_shift(level);
+        auto it = std::lower_bound(cells.begin(), cells.end(), CellTriangle{first, 0});
+        if (it != cells.end() && (shift >= 64 || (it->key - first) >> shift == 0)) {
+            return Region{Region::Kind::kMixed};
+        }
+
+        if (options.solid
+            && crossings_below(static_cast<uint64_t>(min.y) * dims.x + min.x, min.z + 0.5f) % 2
+                   == 1) {
+            return Region{Region::Kind::kUniform, options.value};
+        }
+        return Region{Region::Kind::kEmpty};
+    };
+
+    auto sampler = [&](VDB::coord_t min, VDB::coord_t extent, uint8_t* out) {
+        const size_t row = extent.x, slice = static_cast<size_t>(extent.x) * extent.y;
+        std::fill(out, out + slice * extent.z, uint8_t(0));
+
+        if (options.solid) {
+            for (uint32_t y = 0; y < extent.y; ++y) {
+                for (uint32_t x = 0; x < extent.x; ++x) {
+                    uint64_t column = static_cast<uint64_t>(min.y + y) * dims.x + min.x + x;
+                    auto it = std::lower_bound(crossings.begin(), crossings.end(),
+                                               Crossing{column, kBelowAll});
+                    size_t below = 0;
+                    for (uint32_t z = 0; z < extent.z; ++z) {
+                        for (; it != crossings.end() && it->column == column
+                               && it->z < min.z + z + 0.5f;
+                             ++it) {
+                            ++below;
+                        }
+                        if (below % 2 == 1) {
+                            out[z * slice + y * row + x] = options.value;
+                        }
+                    }
+                }
+            }
+        }
+
+        // bricks are leaves, the triangles binned to the leaf are tested against its voxels
+        const glm::ivec3 first_voxel(min), last_voxel(min + extent - 1u);
+        uint64_t key = detail::tree_key(min, height);
+        auto it = std::lower_bound(cells.begin(), cells.end(), CellTriangle{key, 0});
+        for (; it != cells.end() && it->key == key; ++it) {
+            auto triangle = triangle_at(it->triangle);
+            glm::vec3 tri_min, tri_max;
+            bounds(triangle, dims, tri_min, tri_max);
+            auto first = glm::max(glm::ivec3(glm::ceil(tri_min)) - 1, first_voxel);
+            auto last = glm::min(glm::ivec3(glm::floor(tri_max)), last_voxel);
+
+            for (int z = first.z; z <= last.z; ++z) {
+                for (int y = first.y; y <= last.y; ++y) {
+                    for (int x = first.x; x <= last.x; ++x) {
+                        uint8_t& voxel = out[(z - min.z) * slice + (y - min.y) * row + (x - min.x)];
+                        glm::vec3 voxel_min(x, y, z);
+                        if (voxel == 0 && overlaps(triangle, voxel_min, voxel_min + 1.f)) {
+                            voxel = options.value;
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    vdb.build_from(dims, sampler, build_options);
+}
+
+}  // namespace spor::vox